@@ -2,6 +2,31 @@
 // 2015-07-03 by Jeff Rowberg <jeff@rowberg.net>
 //
 // Changelog:
+//  2026-10-19 - Add zero-copy EIR field iterator with name/UUID/TX power/manufacturer accessors and INQUIRY_EXTENDED filtering
+//  2026-10-19 - Add discovery cache merging INQUIRY/INQUIRY_PARTIAL/NAME results by address, with name lookup scheduling
+//  2026-10-19 - Add RSSI/TXPOWER/BER/TEMP/BATTERY parsing and batched link quality polling with per-link sample rings
+//  2026-10-19 - Add sniff/active power manager with hysteresis and time-in-mode reporting
+//  2026-10-19 - Add multicast send of one payload to many links via vectored writes
+//  2026-10-19 - Add optional per-link coalescing of small data writes
+//  2026-10-19 - Add per-link send credits seeded from LIST buffer field
+//  2026-10-19 - Add TX scheduler: command channel first, weighted fair queuing and rate caps for links
+//  2026-10-19 - Add lock-free multi-producer TX queue drained by a single writer
+//  2026-10-19 - Add per-link RX rings with high/low water backpressure
+//  2026-10-19 - Add per-link message reassembly (length prefix, delimiter, fixed size framers)
+//  2026-10-19 - Split outgoing data into MUX frames of at most 1023 bytes (or per-link MTU) without copying
+//  2026-10-19 - Receive MUX frames with full 10-bit length, reserve whole frame once header is known
+//  2026-10-19 - Add callback profiling with slow handler hook
+//  2026-10-19 - Keep running sum in histograms (for metrics export)
+//  2026-10-19 - Add per-link traffic counters and EWMA throughput
+//  2026-10-19 - Add RX byte timestamps and UART gap/burst histograms
+//  2026-10-19 - Add binary flight recorder (trace ring)
+//  2026-10-19 - Render debug output one line per frame, add TX debug output and sampling/rate limit
+//  2026-10-19 - Add log-linear histograms and per-command round-trip latency tracking
+//  2026-10-19 - Add optional parser statistics with sequence-locked snapshots
+//  2026-10-19 - Add allocation-free iwrap_cmd_* builders and pending command kind tracking
+//  2026-10-19 - Add iwrap_send_frame() for pre-built MUX frames
+//  2026-10-19 - Add iwrap_track_line() shared by C parser and C++ parser template
+//  2026-10-19 - Add typed event records, per-event decoders and bounded event queue
 //  2015-07-03 - Fix signed/unsigned compiler warnings in Arduino 1.6.5
 //  2015-04-27 - Fix MUX frame parser "length" value code
 //  2014-12-06 - Add missing parser reset when MUX frame error occurs
@@ -52,12 +77,197 @@ uint8_t iwrap_last_command_result = 0;
 uint8_t iwrap_pending_boot = 0;
 uint8_t iwrap_pending_commands = 0;
 uint8_t iwrap_pending_info = 0;
+#if (IWRAP_COMMAND_FIFO_SIZE & (IWRAP_COMMAND_FIFO_SIZE - 1)) || IWRAP_COMMAND_FIFO_SIZE > 128
+    #error IWRAP_COMMAND_FIFO_SIZE must be a power of 2 and at most 128
+#endif
+uint8_t iwrap_command_fifo[IWRAP_COMMAND_FIFO_SIZE];
+uint8_t iwrap_command_fifo_tail = 0;
+
+// flags kept in upper bits of iwrap_command_fifo[] entries
+#define IWRAP_COMMAND_KIND_MASK         0x1F
+#define IWRAP_COMMAND_FLAG_TIMED        0x20    // send time stored in iwrap_command_sent[]
+#define IWRAP_COMMAND_FLAG_UNKNOWN      0x40    // did not fit into FIFO when sent, kind and send time unknown
+#define IWRAP_COMMAND_FLAG_ANSWERED     0x80    // CALL already answered with "CALL {link_id}"
+#if IWRAP_COMMAND_COUNT > IWRAP_COMMAND_KIND_MASK + 1
+    #error IWRAP_COMMAND_COUNT does not fit into IWRAP_COMMAND_KIND_MASK
+#endif
+
+#ifdef IWRAP_INCLUDE_LATENCY
+    iwrap_latency_t iwrap_latency;
+    iwrap_time_t iwrap_command_sent[IWRAP_COMMAND_FIFO_SIZE];
+    iwrap_time_t iwrap_call_sent[IWRAP_MAX_LINKS];
+    uint8_t iwrap_call_pending[IWRAP_MAX_LINKS];
+#endif
+
+const char *iwrap_command_names[IWRAP_COMMAND_COUNT] = { "", "AT", "CALL", "CLOSE", "INFO", "INQUIRY", "LIST", "RESET", "SET" };
+#if defined(IWRAP_INCLUDE_STATS) || defined(IWRAP_INCLUDE_PROFILE)
+    const char *iwrap_event_names[IWRAP_EVENT_COUNT] = {
+        "UNMATCHED", "OK", "RSP_AT", "RSP_CALL", "RSP_HID_GET", "RSP_INFO", "RSP_INQUIRY_COUNT",
+        "RSP_INQUIRY_RESULT", "RSP_LIST_COUNT", "RSP_LIST_RESULT", "RSP_PAIR", "RSP_SET",
+        "RSP_SYNTAX_ERROR", "A2DP_STREAMING_START", "A2DP_STREAMING_STOP", "CONNECT", "HID_OUTPUT",
+        "HID_SUSPEND", "HFP", "HFP_AG", "IDENT", "IDENT_ERROR", "INQUIRY_EXTENDED", "INQUIRY_PARTIAL",
+        "NAME", "NAME_ERROR", "NO_CARRIER", "PAIR", "READY", "RING", "RSP_BER", "RSP_RSSI", "RSP_TEMP",
+        "RSP_TXPOWER", "BATTERY", "BATTERY_FULL", "BATTERY_LOW", "BATTERY_SHUTDOWN"
+    };
+#endif
+
+iwrap_event_t iwrap_rx_event;
+
+#ifdef IWRAP_INCLUDE_STATS
+    iwrap_stats_t iwrap_stats;
+    // writer side of the sequence lock around counter updates (parser context only)
+    #define IWRAP_STATS_BEGIN()     do { iwrap_stats.sequence++; IWRAP_STATS_BARRIER(); } while (0)
+    #define IWRAP_STATS_END()       do { IWRAP_STATS_BARRIER(); iwrap_stats.sequence++; } while (0)
+#endif
+
+#ifdef IWRAP_INCLUDE_PROFILE
+    iwrap_profile_t iwrap_profile;
+    iwrap_time_t iwrap_callback_budget = 0;
+#endif
+
+#ifdef IWRAP_INCLUDE_REASSEMBLY
+    iwrap_framer_t iwrap_framers[IWRAP_MAX_LINKS];
+#endif
+
+#ifdef IWRAP_INCLUDE_RX_RINGS
+    iwrap_rx_ring_t iwrap_rx_rings[IWRAP_MAX_LINKS];
+#endif
+
+#ifdef IWRAP_INCLUDE_TX_SCHEDULER
+    #if IWRAP_TX_SCHED_BURST < IWRAP_MUX_MAX_PAYLOAD
+        #error IWRAP_TX_SCHED_BURST must hold at least one full frame (1023 bytes)
+    #endif
+    iwrap_tx_scheduler_t iwrap_tx_scheduler;
+    // frame header in TX flow buffers: 2-byte length, mode
+    #define IWRAP_TX_FLOW_HEADER    3
+#endif
+
+#ifdef IWRAP_INCLUDE_COALESCE
+    iwrap_coalescer_t iwrap_coalescers[IWRAP_MAX_LINKS];
+#endif
+
+#ifdef IWRAP_INCLUDE_POWER
+    iwrap_power_link_t iwrap_power_links[IWRAP_MAX_LINKS];
+    uint8_t iwrap_power_manage = 0;                 // set to 1 to let iwrap_power_poll() manage links connected from then on
+    iwrap_time_t iwrap_power_latency = IWRAP_POWER_LATENCY;
+    iwrap_time_t iwrap_power_idle = IWRAP_POWER_IDLE;
+    iwrap_time_t iwrap_power_dwell = IWRAP_POWER_DWELL;
+    iwrap_time_t iwrap_power_window = IWRAP_POWER_WINDOW;
+    uint16_t iwrap_power_wake_bytes = IWRAP_POWER_WAKE_BYTES;
+#endif
+
+#ifdef IWRAP_INCLUDE_LINK_QUALITY
+    #if !defined(IWRAP_INCLUDE_RSP_RSSI) || !defined(IWRAP_INCLUDE_RSP_TXPOWER) || !defined(IWRAP_INCLUDE_RSP_BER)
+        #error IWRAP_INCLUDE_LINK_QUALITY needs IWRAP_INCLUDE_RSP_RSSI, IWRAP_INCLUDE_RSP_TXPOWER and IWRAP_INCLUDE_RSP_BER
+    #endif
+    #if (IWRAP_QUALITY_SAMPLES & (IWRAP_QUALITY_SAMPLES - 1)) || IWRAP_QUALITY_SAMPLES > 128
+        #error IWRAP_QUALITY_SAMPLES must be a power of 2 and at most 128
+    #endif
+    iwrap_quality_link_t iwrap_quality_links[IWRAP_MAX_LINKS];
+    uint8_t iwrap_quality_metrics = (1 << IWRAP_QUALITY_RSSI) | (1 << IWRAP_QUALITY_TXPOWER) | (1 << IWRAP_QUALITY_BER);
+    iwrap_time_t iwrap_quality_interval = IWRAP_QUALITY_INTERVAL;
+    uint8_t iwrap_quality_batch = IWRAP_QUALITY_BATCH;
+    iwrap_time_t iwrap_quality_round_start = 0;
+    uint16_t iwrap_quality_cursor = 0;                                          // next link * IWRAP_QUALITY_METRICS + metric to poll (end = round finished)
+    uint16_t iwrap_quality_requests[IWRAP_QUALITY_PENDING];                     // unanswered polls, oldest first, same encoding as cursor
+    uint8_t iwrap_quality_requested = 0;
+#endif
+
+#ifdef IWRAP_INCLUDE_DISCOVERY
+    #if !defined(IWRAP_INCLUDE_RSP_INQUIRY_RESULT) || !defined(IWRAP_INCLUDE_EVT_NAME) || !defined(IWRAP_INCLUDE_EVT_NAME_ERROR)
+        #error IWRAP_INCLUDE_DISCOVERY needs IWRAP_INCLUDE_RSP_INQUIRY_RESULT, IWRAP_INCLUDE_EVT_NAME and IWRAP_INCLUDE_EVT_NAME_ERROR
+    #endif
+    #if (IWRAP_DISCOVERY_SIZE & (IWRAP_DISCOVERY_SIZE - 1)) || IWRAP_DISCOVERY_SIZE < 4 || IWRAP_DISCOVERY_SIZE > 32768
+        #error IWRAP_DISCOVERY_SIZE must be a power of 2 from 4 to 32768
+    #endif
+    iwrap_discovery_t iwrap_discovery;
+    iwrap_time_t iwrap_discovery_name_ttl = IWRAP_DISCOVERY_NAME_TTL;
+    iwrap_time_t iwrap_discovery_name_retry = IWRAP_DISCOVERY_NAME_RETRY;
+#endif
+
+#ifdef IWRAP_INCLUDE_EIR
+    #if !defined(IWRAP_INCLUDE_EVT_INQUIRY_EXTENDED)
+        #error IWRAP_INCLUDE_EIR needs IWRAP_INCLUDE_EVT_INQUIRY_EXTENDED
+    #endif
+    iwrap_eir_filter_t iwrap_eir_filter;
+    uint32_t iwrap_eir_filtered;
+#endif
+
+#ifdef IWRAP_INCLUDE_MULTICAST
+    #if !defined(IWRAP_INCLUDE_MUX) || IWRAP_MULTICAST_BATCH > 85
+        #error IWRAP_INCLUDE_MULTICAST needs IWRAP_INCLUDE_MUX, and IWRAP_MULTICAST_BATCH must be at most 85
+    #endif
+#endif
+
+#ifdef IWRAP_INCLUDE_LINK_CREDITS
+    #if !defined(IWRAP_INCLUDE_TX_SCHEDULER) || !defined(IWRAP_INCLUDE_RSP_LIST_RESULT)
+        #error IWRAP_INCLUDE_LINK_CREDITS needs IWRAP_INCLUDE_TX_SCHEDULER and IWRAP_INCLUDE_RSP_LIST_RESULT
+    #endif
+    iwrap_link_credit_t iwrap_link_credits[IWRAP_MAX_LINKS];
+    uint16_t iwrap_link_credit_window = IWRAP_LINK_CREDIT_WINDOW;
+    iwrap_time_t iwrap_link_credit_interval = IWRAP_LINK_CREDIT_INTERVAL;
+    iwrap_time_t iwrap_link_credit_requested = 0;   // time of last LIST refresh
+#endif
+
+#ifdef IWRAP_INCLUDE_TX_QUEUE
+    #if (IWRAP_TX_QUEUE_SIZE & (IWRAP_TX_QUEUE_SIZE - 1)) || IWRAP_TX_SLOT_SIZE > IWRAP_MUX_MAX_PAYLOAD
+        #error IWRAP_TX_QUEUE_SIZE must be a power of 2 and IWRAP_TX_SLOT_SIZE at most 1023
+    #endif
+    iwrap_tx_queue_t iwrap_tx_queue;
+#endif
+
+#ifdef IWRAP_INCLUDE_LINK_STATS
+    iwrap_link_stats_t iwrap_link_stats[IWRAP_MAX_LINKS];
+#endif
+
+#ifdef IWRAP_INCLUDE_RX_TIMING
+    iwrap_rx_timing_t iwrap_rx_timing;
+    iwrap_time_t iwrap_rx_burst_gap = IWRAP_RX_BURST_GAP;
+    iwrap_time_t iwrap_rx_time_first = 0;
+    iwrap_time_t iwrap_rx_time_last = 0;
+    iwrap_time_t iwrap_rx_time_previous = 0;    // arrival of previous byte
+    iwrap_time_t iwrap_rx_time_supplied = 0;    // arrival of next byte, from iwrap_parse_at()
+    uint8_t iwrap_rx_time_flags = 0;            // bit 0: previous byte seen, bit 1: next byte time supplied
+    uint16_t iwrap_rx_burst_length = 0;
+#endif
+
+#ifdef IWRAP_INCLUDE_TRACE
+    #if (IWRAP_TRACE_SIZE & (IWRAP_TRACE_SIZE - 1)) || IWRAP_TRACE_PAYLOAD > 255
+        #error IWRAP_TRACE_SIZE must be a power of 2 and IWRAP_TRACE_PAYLOAD at most 255
+    #endif
+    iwrap_trace_t iwrap_trace;
+#endif
+
+// link events (CONNECT/RING/NO CARRIER) are tracked for per-link state
+#if defined(IWRAP_INCLUDE_LATENCY) || defined(IWRAP_INCLUDE_LINK_STATS) || defined(IWRAP_INCLUDE_REASSEMBLY) || defined(IWRAP_INCLUDE_TX_SCHEDULER) || defined(IWRAP_INCLUDE_LINK_CREDITS) || defined(IWRAP_INCLUDE_COALESCE) || defined(IWRAP_INCLUDE_POWER) || defined(IWRAP_INCLUDE_LINK_QUALITY)
+    #define IWRAP_TRACK_LINKS
+#endif
+
+// full length of MUX frame from its 4-byte header (10-bit payload length + 5)
+#define IWRAP_MUX_FRAME_LENGTH(header)  ((uint16_t)((((header)[2] & 0x03) << 8) | (header)[3]) + 5)
+
+#ifdef IWRAP_INCLUDE_EVENTS
+    #define IWRAP_EVENT_SINKS       (iwrap_callback_event || iwrap_event_queue)
+    #define IWRAP_EMIT_EVENT(e)     iwrap_emit_event(e)
+    void iwrap_emit_event(const iwrap_event_t *event);
+#else
+    #define IWRAP_EVENT_SINKS       0
+    #define IWRAP_EMIT_EVENT(e)
+#endif
 
 #ifdef IWRAP_DEBUG
+    #if IWRAP_DEBUG_LINE_SIZE < 64
+        #error IWRAP_DEBUG_LINE_SIZE must be at least 64
+    #endif
     int (*iwrap_debug)(const char *data);
-    int iwrap_debug_char(char b);
-    int iwrap_debug_hex(uint8_t b);
-    int iwrap_debug_int(int32_t i);
+    uint16_t iwrap_debug_sample = 1;
+    uint16_t iwrap_debug_rate_limit = 0;
+    uint32_t iwrap_debug_suppressed = 0;
+    uint32_t iwrap_debug_unreported = 0;
+    uint16_t iwrap_debug_sample_count = 0;
+    uint16_t iwrap_debug_window_count = 0;
+    iwrap_time_t iwrap_debug_window_start = 0;
+    char iwrap_debug_line[IWRAP_DEBUG_LINE_SIZE];
 #endif
 
 /**
@@ -69,130 +279,765 @@ uint8_t iwrap_pending_info = 0;
  * @see IWRAP_MODE_MUX
  */
 uint8_t iwrap_send_command(const char *cmd, uint8_t mode) {
+    uint16_t length;
+
+    // verify assigned output function
+    if (!iwrap_output) return 0xFF;
+    
+    length = strlen(cmd);
     #ifdef IWRAP_INCLUDE_MUX
-        uint16_t mux_length;
-        uint8_t *mux_data, result;
+        // verify command fits into one MUX frame
+        if (mode == IWRAP_MODE_MUX && length > IWRAP_MUX_MAX_PAYLOAD) return 2;
     #endif
     
+    // update pending command state
+    iwrap_track_command(iwrap_command_kind((const uint8_t *)cmd, length), (const uint8_t *)cmd, length);
+    
+    if (mode == IWRAP_MODE_MUX) {
+        #ifdef IWRAP_INCLUDE_MUX
+            // send mux packet
+            iwrap_output_mux_frame(0xFF, length, (const uint8_t *)cmd);
+        #else
+            return 0xFE; // MUX mode not supported
+        #endif
+    } else {
+        // send normal packet
+        iwrap_output(length, (uint8_t *)cmd);
+        iwrap_output(2, (uint8_t *)"\r\n");
+    }
+    return 0;
+}
+
+/**
+ * @brief Send pre-built MUX frame (e.g. one built at compile time by iwrap::mux_frame())
+ * @param length Full length of MUX frame
+ * @param frame MUX frame byte array
+ * @param mode Sending mode (MUX sends whole frame, non-MUX sends only the payload)
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_send_frame(uint16_t length, const uint8_t *frame, uint8_t mode) {
     // verify assigned output function
     if (!iwrap_output) return 0xFF;
     
+    // verify frame format (payload length and start byte)
+    if (length < 5 || frame[0] != 0xBF || length != IWRAP_MUX_FRAME_LENGTH(frame)) return 2;
+    
+    if (frame[1] == 0xFF) {
+        // update pending command state
+        iwrap_track_command(iwrap_command_kind(frame + 4, length - 5), frame + 4, length - 5);
+    } else {
+        iwrap_track_data(frame[1], length - 5, frame + 4);
+    }
+    
+    if (mode == IWRAP_MODE_MUX) {
+        #ifdef IWRAP_INCLUDE_MUX
+            // frame is already complete
+            iwrap_output(length, (unsigned char *)frame);
+        #else
+            return 0xFE; // MUX mode not supported
+        #endif
+    } else {
+        // send payload only
+        iwrap_output(length - 5, (unsigned char *)frame + 4);
+        if (frame[1] == 0xFF) iwrap_output(2, (uint8_t *)"\r\n");
+    }
+    return 0;
+}
+
+/**
+ * @brief Update pending command state for an outgoing command
+ * @param kind Command kind (IWRAP_COMMAND_*)
+ * @param cmd Command being sent, in ASCII format (no line endings, need not be null terminated)
+ * @param length Length of command in bytes
+ */
+void iwrap_track_command(uint8_t kind, const uint8_t *cmd, uint16_t length) {
     #ifdef IWRAP_INCLUDE_BUSY
         // trigger "busy" callback if previously idle
         if (iwrap_callback_busy && !iwrap_pending_commands) iwrap_callback_busy();
     #endif
 
-    // check which command is being sent
-    if (strncmp(cmd, "RESET", 5) == 0) {
+    if (kind == IWRAP_COMMAND_RESET) {
         iwrap_pending_boot++;
     } else {
+        // remember kind (and send time) in order, as long as there is room for it
+        if (iwrap_pending_commands < IWRAP_COMMAND_FIFO_SIZE) {
+            iwrap_command_fifo[(iwrap_command_fifo_tail + iwrap_pending_commands) & (IWRAP_COMMAND_FIFO_SIZE - 1)] = kind;
+            #ifdef IWRAP_INCLUDE_LATENCY
+                if (iwrap_timestamp) {
+                    iwrap_command_sent[(iwrap_command_fifo_tail + iwrap_pending_commands) & (IWRAP_COMMAND_FIFO_SIZE - 1)] = iwrap_timestamp();
+                    iwrap_command_fifo[(iwrap_command_fifo_tail + iwrap_pending_commands) & (IWRAP_COMMAND_FIFO_SIZE - 1)] |= IWRAP_COMMAND_FLAG_TIMED;
+                }
+            #endif
+        }
         iwrap_pending_commands++;
-        if (strncmp(cmd, "INFO", 4) == 0) {
+        if (kind == IWRAP_COMMAND_INFO) {
             iwrap_pending_info++;
         }
     }
     
     #ifdef IWRAP_INCLUDE_TXCOMMAND
         // trigger outgoing command callback
-        if (iwrap_callback_txcommand) iwrap_callback_txcommand(strlen(cmd), (uint8_t *)cmd);
+        if (iwrap_callback_txcommand) iwrap_callback_txcommand(length, cmd);
     #endif
-    
+    #ifdef IWRAP_INCLUDE_TRACE
+        iwrap_trace_record(IWRAP_TRACE_TX_COMMAND, 0xFF, kind, length, cmd);
+    #endif
+    #ifdef IWRAP_DEBUG
+        iwrap_debug_frame("=> TX ", 0xFF, length, cmd);
+    #endif
+}
+
+/**
+ * @brief Determine kind of a command from its text
+ * @param cmd Command in ASCII format (no line endings, need not be null terminated)
+ * @param length Length of command in bytes
+ * @return Command kind (IWRAP_COMMAND_*), IWRAP_COMMAND_OTHER if not tracked separately
+ */
+uint8_t iwrap_command_kind(const uint8_t *cmd, uint16_t length) {
+    uint8_t kind;
+    uint16_t n;
+    for (kind = 1; kind < IWRAP_COMMAND_COUNT; kind++) {
+        n = strlen(iwrap_command_names[kind]);
+        if (length >= n && memcmp(cmd, iwrap_command_names[kind], n) == 0 && (length == n || cmd[n] == ' ')) return kind;
+    }
+    return IWRAP_COMMAND_OTHER;
+}
+
+/**
+ * @brief Get kind of the oldest command still waiting for "OK."
+ * @return Command kind (IWRAP_COMMAND_*), IWRAP_COMMAND_OTHER if none pending or not remembered
+ */
+uint8_t iwrap_pending_command_kind() {
+    if (!iwrap_pending_commands) return IWRAP_COMMAND_OTHER;
+    return iwrap_command_fifo[iwrap_command_fifo_tail] & IWRAP_COMMAND_KIND_MASK;
+}
+
+/**
+ * @brief Append string to command being built
+ * @param frame Command frame buffer (IWRAP_COMMAND_FRAME_SIZE bytes)
+ * @param pos Write position, moved past IWRAP_COMMAND_FRAME_SIZE - 2 if it does not fit
+ * @param str String to append
+ */
+void iwrap_cmd_append(uint8_t *frame, uint16_t *pos, const char *str) {
+    // last two bytes are kept for MUX trailer or CR/LF
+    while (*str && *pos < IWRAP_COMMAND_FRAME_SIZE - 2) frame[(*pos)++] = *str++;
+    if (*str) *pos = IWRAP_COMMAND_FRAME_SIZE;
+}
+
+/**
+ * @brief Append unsigned decimal value to command being built
+ * @param frame Command frame buffer (IWRAP_COMMAND_FRAME_SIZE bytes)
+ * @param pos Write position
+ * @param value Value to append
+ */
+void iwrap_cmd_append_dec(uint8_t *frame, uint16_t *pos, uint16_t value) {
+    char s[6], *p = s + 5;
+    *p = 0;
+    do { *--p = '0' + (value % 10); value /= 10; } while (value);
+    iwrap_cmd_append(frame, pos, p);
+}
+
+/**
+ * @brief Append hexadecimal value (uppercase, no leading zeros) to command being built
+ * @param frame Command frame buffer (IWRAP_COMMAND_FRAME_SIZE bytes)
+ * @param pos Write position
+ * @param value Value to append
+ */
+void iwrap_cmd_append_hex(uint8_t *frame, uint16_t *pos, uint16_t value) {
+    char s[5], *p = s + 4;
+    *p = 0;
+    do { *--p = (value & 0x0f) + 48 + ((value & 0x0f) / 10 * 7); value >>= 4; } while (value);
+    iwrap_cmd_append(frame, pos, p);
+}
+
+/**
+ * @brief Append Bluetooth address in "AA:BB:CC:DD:EE:FF" format to command being built
+ * @param frame Command frame buffer (IWRAP_COMMAND_FRAME_SIZE bytes)
+ * @param pos Write position
+ * @param address Address to append
+ */
+void iwrap_cmd_append_address(uint8_t *frame, uint16_t *pos, const iwrap_address_t *address) {
+    char *dest;
+    if (*pos + 17 > IWRAP_COMMAND_FRAME_SIZE - 2) {
+        *pos = IWRAP_COMMAND_FRAME_SIZE;
+        return;
+    }
+    dest = (char *)frame + *pos;
+    iwrap_bintohexstr(address -> address, 6, &dest, ':', 0);
+    *pos += 17;
+}
+
+/**
+ * @brief Complete command built in place after the 4-byte frame header and send it
+ * @param kind Command kind (IWRAP_COMMAND_*)
+ * @param frame Command frame buffer (IWRAP_COMMAND_FRAME_SIZE bytes), command text starting at frame[4]
+ * @param pos Write position (end of command text)
+ * @param mode Sending mode (MUX or non-MUX)
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_cmd_send(uint8_t kind, uint8_t *frame, uint16_t pos, uint8_t mode) {
+    uint16_t length = pos - 4;
+
+    // verify assigned output function
+    if (!iwrap_output) return 0xFF;
+
+    // verify that command fit into the frame buffer
+    if (pos > IWRAP_COMMAND_FRAME_SIZE - 2) return 3;
+
+    // update pending command state
+    iwrap_track_command(kind, frame + 4, length);
+
     if (mode == IWRAP_MODE_MUX) {
         #ifdef IWRAP_INCLUDE_MUX
-            // build and send mux packet
-            if ((result = iwrap_pack_mux_frame(0xFF, strlen(cmd), (uint8_t *)cmd, &mux_length, &mux_data))) { return result; }
-            iwrap_output(mux_length, mux_data);
-            free(mux_data);
+            // fill in header and trailer around command text
+            frame[0] = 0xBF;
+            frame[1] = 0xFF;
+            frame[2] = (length >> 8) & 0x03;
+            frame[3] = length & 0xFF;
+            frame[pos++] = 0x00; // 0xFF ^ 0xFF
+            iwrap_output(pos, frame);
         #else
             return 0xFE; // MUX mode not supported
         #endif
     } else {
-        // send normal packet
-        iwrap_output(strlen(cmd), (uint8_t *)cmd);
-        iwrap_output(2, (uint8_t *)"\r\n");
+        frame[pos++] = '\r';
+        frame[pos++] = '\n';
+        iwrap_output(length + 2, frame + 4);
     }
     return 0;
 }
 
 /**
- * @brief Send data, automatically wrapping in MUX frame if specified
+ * @brief Send "CALL {address} {target} {profile}" command
+ * @param address Remote Bluetooth address
+ * @param target Target UUID/PSM/channel, sent in hex (IWRAP_CALL_TARGET_ANY sends "*")
+ * @param profile Connection profile, e.g. "RFCOMM", "A2DP", "HFP"
+ * @param mode Sending mode (MUX or non-MUX)
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_cmd_call(const iwrap_address_t *address, uint16_t target, const char *profile, uint8_t mode) {
+    uint8_t frame[IWRAP_COMMAND_FRAME_SIZE];
+    uint16_t pos = 4;
+    iwrap_cmd_append(frame, &pos, "CALL ");
+    iwrap_cmd_append_address(frame, &pos, address);
+    iwrap_cmd_append(frame, &pos, " ");
+    if (target == IWRAP_CALL_TARGET_ANY) iwrap_cmd_append(frame, &pos, "*");
+    else iwrap_cmd_append_hex(frame, &pos, target);
+    iwrap_cmd_append(frame, &pos, " ");
+    iwrap_cmd_append(frame, &pos, profile);
+    return iwrap_cmd_send(IWRAP_COMMAND_CALL, frame, pos, mode);
+}
+
+/**
+ * @brief Send "CLOSE {link_id}" command
+ * @param link_id Link to close
+ * @param mode Sending mode (MUX or non-MUX)
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_cmd_close(uint8_t link_id, uint8_t mode) {
+    uint8_t frame[IWRAP_COMMAND_FRAME_SIZE];
+    uint16_t pos = 4;
+    iwrap_cmd_append(frame, &pos, "CLOSE ");
+    iwrap_cmd_append_dec(frame, &pos, link_id);
+    return iwrap_cmd_send(IWRAP_COMMAND_CLOSE, frame, pos, mode);
+}
+
+/**
+ * @brief Send "INQUIRY {timeout} [NAME]" command
+ * @param timeout Inquiry length in units of 1.28 seconds
+ * @param name Non-zero to also request friendly names
+ * @param mode Sending mode (MUX or non-MUX)
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_cmd_inquiry(uint8_t timeout, uint8_t name, uint8_t mode) {
+    uint8_t frame[IWRAP_COMMAND_FRAME_SIZE];
+    uint16_t pos = 4;
+    iwrap_cmd_append(frame, &pos, "INQUIRY ");
+    iwrap_cmd_append_dec(frame, &pos, timeout);
+    if (name) iwrap_cmd_append(frame, &pos, " NAME");
+    return iwrap_cmd_send(IWRAP_COMMAND_INQUIRY, frame, pos, mode);
+}
+
+/**
+ * @brief Send "SET [{category} [{option} [{value}]]]" command
+ * @param category Setting category (IWRAP_SET_CATEGORY_*), or 0 to dump all settings
+ * @param option Option name, e.g. "PAIR" or "PAGEMODE" (may be null)
+ * @param value Option value (may be null)
+ * @param mode Sending mode (MUX or non-MUX)
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_cmd_set(uint8_t category, const char *option, const char *value, uint8_t mode) {
+    uint8_t frame[IWRAP_COMMAND_FRAME_SIZE];
+    uint16_t pos = 4;
+    iwrap_cmd_append(frame, &pos, "SET");
+    if (category == IWRAP_SET_CATEGORY_BT) iwrap_cmd_append(frame, &pos, " BT");
+    else if (category == IWRAP_SET_CATEGORY_CONTROL) iwrap_cmd_append(frame, &pos, " CONTROL");
+    else if (category == IWRAP_SET_CATEGORY_PROFILE) iwrap_cmd_append(frame, &pos, " PROFILE");
+    if (category && option) {
+        iwrap_cmd_append(frame, &pos, " ");
+        iwrap_cmd_append(frame, &pos, option);
+        if (value) {
+            iwrap_cmd_append(frame, &pos, " ");
+            iwrap_cmd_append(frame, &pos, value);
+        }
+    }
+    return iwrap_cmd_send(IWRAP_COMMAND_SET, frame, pos, mode);
+}
+
+/**
+ * @brief Send "SNIFF {link_id} {max} {min} [{attempt} {timeout}]" command
+ * @param link_id Link to put into sniff mode
+ * @param max_interval Maximum sniff interval in baseband slots (0.625 ms, even)
+ * @param min_interval Minimum sniff interval in baseband slots (0.625 ms, even)
+ * @param attempt Sniff attempt in slots (0 to leave out attempt and timeout)
+ * @param timeout Sniff timeout in slots
+ * @param mode Sending mode (MUX or non-MUX)
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_cmd_sniff(uint8_t link_id, uint16_t max_interval, uint16_t min_interval, uint16_t attempt, uint16_t timeout, uint8_t mode) {
+    uint8_t frame[IWRAP_COMMAND_FRAME_SIZE];
+    uint16_t pos = 4;
+    iwrap_cmd_append(frame, &pos, "SNIFF ");
+    iwrap_cmd_append_dec(frame, &pos, link_id);
+    iwrap_cmd_append(frame, &pos, " ");
+    iwrap_cmd_append_dec(frame, &pos, max_interval);
+    iwrap_cmd_append(frame, &pos, " ");
+    iwrap_cmd_append_dec(frame, &pos, min_interval);
+    if (attempt) {
+        iwrap_cmd_append(frame, &pos, " ");
+        iwrap_cmd_append_dec(frame, &pos, attempt);
+        iwrap_cmd_append(frame, &pos, " ");
+        iwrap_cmd_append_dec(frame, &pos, timeout);
+    }
+    return iwrap_cmd_send(IWRAP_COMMAND_OTHER, frame, pos, mode);
+}
+
+/**
+ * @brief Send "ACTIVE {link_id}" command
+ * @param link_id Link to return to active mode
+ * @param mode Sending mode (MUX or non-MUX)
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_cmd_active(uint8_t link_id, uint8_t mode) {
+    uint8_t frame[IWRAP_COMMAND_FRAME_SIZE];
+    uint16_t pos = 4;
+    iwrap_cmd_append(frame, &pos, "ACTIVE ");
+    iwrap_cmd_append_dec(frame, &pos, link_id);
+    return iwrap_cmd_send(IWRAP_COMMAND_OTHER, frame, pos, mode);
+}
+
+/**
+ * @brief Send "RSSI {link_id}" command (answered with "RSSI {bd_addr} {rssi}")
+ * @param link_id Link to measure
+ * @param mode Sending mode (MUX or non-MUX)
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_cmd_rssi(uint8_t link_id, uint8_t mode) {
+    uint8_t frame[IWRAP_COMMAND_FRAME_SIZE];
+    uint16_t pos = 4;
+    iwrap_cmd_append(frame, &pos, "RSSI ");
+    iwrap_cmd_append_dec(frame, &pos, link_id);
+    return iwrap_cmd_send(IWRAP_COMMAND_OTHER, frame, pos, mode);
+}
+
+/**
+ * @brief Send "TXPOWER {link_id}" command (answered with "TXPOWER {bd_addr} {txpower}")
+ * @param link_id Link to measure
+ * @param mode Sending mode (MUX or non-MUX)
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_cmd_txpower(uint8_t link_id, uint8_t mode) {
+    uint8_t frame[IWRAP_COMMAND_FRAME_SIZE];
+    uint16_t pos = 4;
+    iwrap_cmd_append(frame, &pos, "TXPOWER ");
+    iwrap_cmd_append_dec(frame, &pos, link_id);
+    return iwrap_cmd_send(IWRAP_COMMAND_OTHER, frame, pos, mode);
+}
+
+/**
+ * @brief Send "BER {link_id}" command (answered with "BER {bd_addr} {ber}")
+ * @param link_id Link to measure
+ * @param mode Sending mode (MUX or non-MUX)
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_cmd_ber(uint8_t link_id, uint8_t mode) {
+    uint8_t frame[IWRAP_COMMAND_FRAME_SIZE];
+    uint16_t pos = 4;
+    iwrap_cmd_append(frame, &pos, "BER ");
+    iwrap_cmd_append_dec(frame, &pos, link_id);
+    return iwrap_cmd_send(IWRAP_COMMAND_OTHER, frame, pos, mode);
+}
+
+/**
+ * @brief Send "NAME {bd_addr}" command (answered with "NAME" or "NAME ERROR" event)
+ * @param address Device whose friendly name to look up
+ * @param mode Sending mode (MUX or non-MUX)
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_cmd_name(const iwrap_address_t *address, uint8_t mode) {
+    uint8_t frame[IWRAP_COMMAND_FRAME_SIZE];
+    uint16_t pos = 4;
+    iwrap_cmd_append(frame, &pos, "NAME ");
+    iwrap_cmd_append_address(frame, &pos, address);
+    return iwrap_cmd_send(IWRAP_COMMAND_OTHER, frame, pos, mode);
+}
+
+/**
+ * @brief Send data, automatically split into MUX frames if specified
  * @param channel Link ID to which to send data
- * @param data_len Length of data to send in bytes
+ * @param data_len Length of data to send in bytes (any size)
  * @param data Byte array of all data to send
  * @param mode Sending mode (MUX or non-MUX)
  * @return Result code (non-zero indicates error)
+ *
+ * Data is sent in segments of at most iwrap_link_mtu[channel] bytes (or
+ * IWRAP_MUX_MAX_PAYLOAD if not set) straight from the given buffer; the
+ * txdata callback, link statistics and trace see one entry per segment.
+ *
+ * With IWRAP_INCLUDE_LINK_CREDITS, on a link with credit control and a
+ * scheduler queue, data beyond the link's send credit is copied to that
+ * queue instead (result 3 if the queue is full, in which case the data
+ * within the credit was still sent). Links without a queue are written
+ * to as usual.
+ *
+ * With IWRAP_INCLUDE_COALESCE, small writes to a link set up with
+ * iwrap_coalesce_setup() are collected and sent later as one frame.
  */
-uint8_t iwrap_send_data(uint8_t channel, uint16_t data_len, const uint8_t *data, uint8_t mode) {
-    #ifdef IWRAP_INCLUDE_MUX
-        uint16_t mux_length;
-        uint8_t *mux_data, result;
-    #endif
-    
+uint8_t iwrap_send_data(uint8_t channel, uint32_t data_len, const uint8_t *data, uint8_t mode) {
     // verify assigned output function
     if (!iwrap_output) return 0xFF;
 
-    #ifdef IWRAP_INCLUDE_TXDATA
-        // trigger outgoing data callback
-        if (iwrap_callback_txdata) iwrap_callback_txdata(channel, data_len, data);
+    #ifdef IWRAP_INCLUDE_COALESCE
+        if (channel < IWRAP_MAX_LINKS && iwrap_coalescers[channel].size) return iwrap_coalesce_data(channel, data_len, data, mode);
+    #endif
+    return iwrap_send_segments(channel, data_len, data, mode);
+}
+
+/**
+ * @brief Send data right away, split into segments as described for iwrap_send_data()
+ * @param channel Link ID to which to send data
+ * @param data_len Length of data to send in bytes (any size)
+ * @param data Byte array of all data to send
+ * @param mode Sending mode (MUX or non-MUX)
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_send_segments(uint8_t channel, uint32_t data_len, const uint8_t *data, uint8_t mode) {
+    uint16_t segment, max_segment = IWRAP_MUX_MAX_PAYLOAD;
+    uint8_t result;
+    #ifdef IWRAP_INCLUDE_LINK_CREDITS
+        int32_t credits;
     #endif
 
+    if (channel < IWRAP_MAX_LINKS && iwrap_link_mtu[channel] && iwrap_link_mtu[channel] < IWRAP_MUX_MAX_PAYLOAD) max_segment = iwrap_link_mtu[channel];
+    
+    // always send at least one (possibly empty) segment
+    do {
+        segment = data_len > max_segment ? max_segment : data_len;
+        #ifdef IWRAP_INCLUDE_LINK_CREDITS
+            // credit control needs a queue to hold back data, links without one are written to
+            if (channel < IWRAP_MAX_LINKS && iwrap_link_credits[channel].window && iwrap_tx_scheduler.flows[channel].size) {
+                credits = iwrap_link_credits[channel].credits;
+                if (!iwrap_tx_scheduler.flows[channel].used && credits > 0 && credits < segment) {
+                    // send what still fits, the rest is queued on the next pass
+                    segment = credits;
+                } else if (iwrap_tx_scheduler.flows[channel].used || credits < segment) {
+                    // out of credit, or older data still waiting: queue the rest for iwrap_tx_sched_run()
+                    if (credits < segment) iwrap_link_credits_stall(channel);
+                    return iwrap_tx_sched_data(channel, data_len, data, mode) ? 3 : 0;
+                }
+            }
+        #endif
+        if ((result = iwrap_send_segment(channel, segment, data, mode))) return result;
+        data += segment;
+        data_len -= segment;
+    } while (data_len);
+    return 0;
+}
+
+/**
+ * @brief Send data supplied in chunks by an iterator, split into MUX frames like iwrap_send_data()
+ * @param channel Link ID to which to send data
+ * @param next Iterator returning next chunk length and pointer (0 when done)
+ * @param context Passed through to iterator
+ * @param mode Sending mode (MUX or non-MUX)
+ * @return Result code (non-zero indicates error)
+ *
+ * Chunks are not copied or merged, so each frame holds data from one chunk.
+ */
+uint8_t iwrap_send_stream(uint8_t channel, uint32_t (*next)(void *context, const uint8_t **chunk), void *context, uint8_t mode) {
+    const uint8_t *chunk;
+    uint32_t length;
+    uint8_t result;
+    while ((length = next(context, &chunk))) {
+        if ((result = iwrap_send_data(channel, length, chunk, mode))) return result;
+    }
+    return 0;
+}
+
+/**
+ * @brief Send one data segment which fits into a single MUX frame
+ * @param channel Link ID to which to send data
+ * @param length Length of data (at most IWRAP_MUX_MAX_PAYLOAD)
+ * @param data Data to send
+ * @param mode Sending mode (MUX or non-MUX)
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_send_segment(uint8_t channel, uint16_t length, const uint8_t *data, uint8_t mode) {
+    iwrap_track_data(channel, length, data);
+
     if (mode == IWRAP_MODE_MUX) {
         #ifdef IWRAP_INCLUDE_MUX
-            // build and send mux packet
-            if ((result = iwrap_pack_mux_frame(channel, data_len, (uint8_t *)data, &mux_length, &mux_data))) { return result; }
-            iwrap_output(mux_length, mux_data);
-            free(mux_data);
+            // send mux packet around caller's data
+            iwrap_output_mux_frame(channel, length, data);
         #else
             return 0xFE; // MUX mode not supported
         #endif
     } else {
         // send normal packet
-        iwrap_output(data_len, (unsigned char *)data);
+        iwrap_output(length, (unsigned char *)data);
     }
     return 0;
 }
 
 /**
- * @brief Parse incoming data from iWRAP module
- * @param b Incoming byte to parse
- * @param mode Receiving mode (MUX or non-MUX)
- * @return Result code (non-zero indicates error)
+ * @brief Update callbacks, statistics, credits, trace and debug output for one outgoing data segment
+ * @param channel Link ID
+ * @param length Length of data
+ * @param data Data being sent
  */
-uint8_t iwrap_parse(uint8_t b, uint8_t mode) {
-    // make sure our packet container is big enough (always at least +1 byte)
-    if (iwrap_rx_packet_length + 1 >= iwrap_rx_packet_size) {
-        if (iwrap_rx_packet_size) {
-            // increase by 16 bytes and verify allocation
-            iwrap_tptr = (uint8_t *)realloc(iwrap_rx_packet, iwrap_rx_packet_size += 16);
-            if (!iwrap_tptr) { return 1; }
-            iwrap_rx_packet = iwrap_tptr;
-        } else {
-            // start with 64 bytes and verify allocation
-            iwrap_rx_packet = (uint8_t *)malloc(iwrap_rx_packet_size = 64);
-            if (!iwrap_rx_packet) { return 1; }
+void iwrap_track_data(uint8_t channel, uint16_t length, const uint8_t *data) {
+    #ifdef IWRAP_INCLUDE_TXDATA
+        // trigger outgoing data callback
+        if (iwrap_callback_txdata) iwrap_callback_txdata(channel, length, data);
+    #endif
+    #ifdef IWRAP_INCLUDE_LINK_STATS
+        if (channel < IWRAP_MAX_LINKS) iwrap_link_stats_account(channel, 1, length);
+    #endif
+    #ifdef IWRAP_INCLUDE_LINK_CREDITS
+        if (channel < IWRAP_MAX_LINKS && iwrap_link_credits[channel].window) {
+            iwrap_link_credits[channel].credits -= length;
+            iwrap_link_credits[channel].inflight += length;
+        }
+    #endif
+    #ifdef IWRAP_INCLUDE_POWER
+        if (channel < IWRAP_MAX_LINKS) iwrap_power_traffic(channel, length);
+    #endif
+    #ifdef IWRAP_INCLUDE_TRACE
+        iwrap_trace_record(IWRAP_TRACE_TX_DATA, channel, 0, length, data);
+    #endif
+    #ifdef IWRAP_DEBUG
+        iwrap_debug_frame("=> TX ", channel, length, data);
+    #endif
+}
+
+#ifdef IWRAP_INCLUDE_MULTICAST
+    /**
+     * @brief Send one payload to several links in MUX mode without copying it
+     * @param count Number of links
+     * @param links Link IDs to send to
+     * @param data_len Length of data (any size)
+     * @param data Data to send
+     * @param results Optional array of count result codes, one per link (0 = sent or queued)
+     * @return Result code (0 if all links succeeded, 1 if any failed, 0xFF if no output)
+     *
+     * Frames for up to IWRAP_MULTICAST_BATCH links go out in one call to
+     * iwrap_output_vector, each as its own 4-byte header and 1-byte trailer
+     * around the shared payload. Data larger than the smallest link MTU is
+     * sent in segments of that size. Links which are out of send credit or
+     * have data waiting (IWRAP_INCLUDE_LINK_CREDITS) take the normal
+     * iwrap_send_segments() path instead, so their order is kept.
+     */
+    uint8_t iwrap_send_multicast(uint8_t count, const uint8_t *links, uint32_t data_len, const uint8_t *data, uint8_t *results) {
+        uint8_t headers[IWRAP_MULTICAST_BATCH][4], trailers[IWRAP_MULTICAST_BATCH];
+        uint8_t batch[IWRAP_MULTICAST_BATCH], skip[32];
+        iwrap_iovec_t vector[IWRAP_MULTICAST_BATCH * 3];
+        uint16_t segment, max_segment = IWRAP_MUX_MAX_PAYLOAD;
+        uint8_t i, j, n, channel, result, failed = 0;
+
+        // verify assigned output function
+        if (!iwrap_output) return 0xFF;
+
+        // pick links which can share frames, and the segment size which suits all of them
+        memset(skip, 0, sizeof(skip));
+        for (i = 0; i < count; i++) {
+            channel = links[i];
+            result = 0;
+            if (channel == 0xFF) {
+                result = 1; // command channel
+            } else if (channel < IWRAP_MAX_LINKS) {
+                #ifdef IWRAP_INCLUDE_COALESCE
+                    // small writes still waiting go first
+                    result = iwrap_coalesce_flush(channel);
+                #endif
+                #ifdef IWRAP_INCLUDE_LINK_CREDITS
+                    if (!result && iwrap_link_credits[channel].window && iwrap_tx_scheduler.flows[channel].size && (iwrap_tx_scheduler.flows[channel].used || iwrap_link_credits[channel].credits < (int32_t)data_len)) {
+                        result = iwrap_send_segments(channel, data_len, data, IWRAP_MODE_MUX);
+                        skip[i >> 3] |= 1 << (i & 7);
+                        if (result) failed = 1;
+                        if (results) results[i] = result;
+                        continue;
+                    }
+                #endif
+                if (!result && iwrap_link_mtu[channel] && iwrap_link_mtu[channel] < max_segment) max_segment = iwrap_link_mtu[channel];
+            }
+            if (result) {
+                skip[i >> 3] |= 1 << (i & 7);
+                failed = 1;
+            }
+            if (results) results[i] = result;
+        }
+
+        // always send at least one (possibly empty) segment
+        do {
+            segment = data_len > max_segment ? max_segment : data_len;
+            for (i = 0; i < count; ) {
+                // collect next batch of links
+                for (n = 0; i < count && n < IWRAP_MULTICAST_BATCH; i++) {
+                    if (!(skip[i >> 3] & (1 << (i & 7)))) batch[n++] = links[i];
+                }
+                for (j = 0; j < n; j++) {
+                    channel = batch[j];
+                    iwrap_track_data(channel, segment, data);
+                    headers[j][0] = 0xBF;
+                    headers[j][1] = channel;
+                    headers[j][2] = (segment >> 8) & 0x03;
+                    headers[j][3] = segment;
+                    trailers[j] = channel ^ 0xFF;
+                    vector[j * 3].data = headers[j];
+                    vector[j * 3].length = 4;
+                    vector[j * 3 + 1].data = data;
+                    vector[j * 3 + 1].length = segment;
+                    vector[j * 3 + 2].data = &trailers[j];
+                    vector[j * 3 + 2].length = 1;
+                    if (!iwrap_output_vector) iwrap_output_mux_frame(channel, segment, data);
+                }
+                if (n && iwrap_output_vector) iwrap_output_vector(n * 3, vector);
+            }
+            data += segment;
+            data_len -= segment;
+        } while (data_len);
+        return failed;
+    }
+#endif /* IWRAP_INCLUDE_MULTICAST */
+
+/**
+ * @brief Parse incoming data from iWRAP module
+ * @param b Incoming byte to parse
+ * @param mode Receiving mode (MUX or non-MUX)
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_parse(uint8_t b, uint8_t mode) {
+    #ifdef IWRAP_INCLUDE_MUX
+        uint8_t result;
+    #endif
+    #ifdef IWRAP_INCLUDE_TRACE
+        iwrap_trace_entry_t *trace;
+    #endif
+    #ifdef IWRAP_INCLUDE_RX_TIMING
+        iwrap_time_t now, gap;
+    #endif
+    #ifdef IWRAP_INCLUDE_PROFILE
+        iwrap_time_t t_callback = 0;
+    #endif
+    #ifdef IWRAP_INCLUDE_STATS
+        iwrap_time_t t_start = 0, t_dispatch = 0;
+
+        IWRAP_STATS_BEGIN();
+        iwrap_stats.bytes++;
+        IWRAP_STATS_END();
+    #endif
+
+    #ifdef IWRAP_INCLUDE_RX_TIMING
+        // byte arrival time, from transport (iwrap_parse_at) or library clock
+        if (iwrap_rx_time_flags & 2) {
+            now = iwrap_rx_time_supplied;
+            iwrap_rx_time_flags &= ~2;
+        } else {
+            now = iwrap_timestamp ? iwrap_timestamp() : 0;
+        }
+        if (iwrap_rx_time_flags & 1) {
+            gap = now - iwrap_rx_time_previous;
+            iwrap_histogram_record(&iwrap_rx_timing.gap, gap);
+            if (gap > iwrap_rx_burst_gap) {
+                iwrap_histogram_record(&iwrap_rx_timing.burst, iwrap_rx_burst_length);
+                iwrap_rx_burst_length = 0;
+            }
+        }
+        iwrap_rx_time_flags |= 1;
+        iwrap_rx_time_previous = now;
+        iwrap_rx_burst_length++;
+    #endif
+
+    // make sure our packet container is big enough (always at least +1 byte)
+    if (iwrap_rx_packet_length + 1 >= iwrap_rx_packet_size) {
+        if (iwrap_rx_packet_size) {
+            // increase by 16 bytes and verify allocation
+            iwrap_tptr = (uint8_t *)realloc(iwrap_rx_packet, iwrap_rx_packet_size += 16);
+            if (!iwrap_tptr) { return 1; }
+            iwrap_rx_packet = iwrap_tptr;
+            #ifdef IWRAP_INCLUDE_STATS
+                IWRAP_STATS_BEGIN();
+                iwrap_stats.reallocs++;
+                IWRAP_STATS_END();
+            #endif
+        } else {
+            // start with 64 bytes and verify allocation
+            iwrap_rx_packet = (uint8_t *)malloc(iwrap_rx_packet_size = 64);
+            if (!iwrap_rx_packet) { return 1; }
         }
     }
 
     // make sure data is valid
     if (mode != IWRAP_MODE_MUX || iwrap_in_packet || b == 0xBF) {
+        #ifdef IWRAP_INCLUDE_RX_TIMING
+            if (!iwrap_in_packet) iwrap_rx_time_first = now;
+        #endif
+
         // append this byte to packet
         iwrap_rx_packet[iwrap_rx_packet_length++] = b;
         iwrap_in_packet = 1;
         
+        // MUX header complete, so reserve whole frame (+1 for null terminator) at once
+        if (mode == IWRAP_MODE_MUX && iwrap_rx_packet_length == 4 && iwrap_rx_packet_size < IWRAP_MUX_FRAME_LENGTH(iwrap_rx_packet) + 1) {
+            iwrap_tptr = (uint8_t *)realloc(iwrap_rx_packet, IWRAP_MUX_FRAME_LENGTH(iwrap_rx_packet) + 1);
+            if (!iwrap_tptr) { return 1; }
+            iwrap_rx_packet = iwrap_tptr;
+            iwrap_rx_packet_size = IWRAP_MUX_FRAME_LENGTH(iwrap_rx_packet) + 1;
+            #ifdef IWRAP_INCLUDE_STATS
+                IWRAP_STATS_BEGIN();
+                iwrap_stats.reallocs++;
+                IWRAP_STATS_END();
+            #endif
+        }
+        
         // check for a complete packet
-        if ((mode == IWRAP_MODE_MUX && iwrap_rx_packet_length > 4 && iwrap_rx_packet_length == (uint16_t)(iwrap_rx_packet[3] + 5)) || (mode != IWRAP_MODE_MUX && b == '\n')) {
+        if ((mode == IWRAP_MODE_MUX && iwrap_rx_packet_length > 4 && iwrap_rx_packet_length == IWRAP_MUX_FRAME_LENGTH(iwrap_rx_packet)) || (mode != IWRAP_MODE_MUX && b == '\n')) {
+            #ifdef IWRAP_INCLUDE_STATS
+                if (iwrap_timestamp) t_start = iwrap_timestamp();
+            #endif
+            #ifdef IWRAP_INCLUDE_RX_TIMING
+                iwrap_rx_time_last = now;
+                iwrap_histogram_record(&iwrap_rx_timing.frame, now - iwrap_rx_time_first);
+            #endif
+
             // validate all correct packet
             if (mode == IWRAP_MODE_MUX) {
                 #ifdef IWRAP_INCLUDE_MUX
                     // unpack MUX packet
-                    if (iwrap_unpack_mux_frame(
+                    if ((result = iwrap_unpack_mux_frame(
                             iwrap_rx_packet_length,
                             iwrap_rx_packet,
                             &iwrap_rx_packet_channel,
                             &iwrap_rx_packet_flags,
                             &iwrap_rx_payload_length,
                             &iwrap_tptr,
-                            0)) {
+                            0))) {
+                        #ifdef IWRAP_INCLUDE_STATS
+                            IWRAP_STATS_BEGIN();
+                            if (result == 3) iwrap_stats.mux_checksum_errors++;
+                            else iwrap_stats.mux_format_errors++;
+                            IWRAP_STATS_END();
+                        #endif
                            
                         // reset all packet metadata (MUX parsing error occurred)
                         iwrap_rx_packet_length = 0;
@@ -219,502 +1064,471 @@ uint8_t iwrap_parse(uint8_t b, uint8_t mode) {
                 }
             }
             
+            // record before dispatch, so a callback that never returns still leaves its trigger in the trace
+            #ifdef IWRAP_INCLUDE_TRACE
+                trace = iwrap_trace_record(IWRAP_TRACE_RX, iwrap_rx_packet_channel, 0, iwrap_rx_payload_length, iwrap_tptr);
+            #endif
+
             // debug output
             #ifdef IWRAP_DEBUG
-                if (iwrap_debug) {
-                    uint16_t i;
-                    iwrap_debug("<= RX ");
-                    iwrap_debug_hex(iwrap_rx_packet_channel);
-                    iwrap_debug(", ");
-                    iwrap_debug_int(iwrap_rx_payload_length);
-                    iwrap_debug(":\t");
-                    for (i = 0; i < iwrap_rx_payload_length; i++) {
-                        if (iwrap_tptr[i] > 31 && iwrap_tptr[i] < 127) {
-                            iwrap_debug_char(iwrap_tptr[i]);
-                        } else if (iwrap_tptr[i] == 9) {
-                            iwrap_debug("\\t");
-                        } else if (iwrap_tptr[i] == 10) {
-                            iwrap_debug("\\n");
-                        } else if (iwrap_tptr[i] == 13) {
-                            iwrap_debug("\\r");
-                        } else {
-                            iwrap_debug("\\x");
-                            iwrap_debug_hex(iwrap_tptr[i]);
-                        }
-                    }
-                    iwrap_debug("\n");
-                }
+                iwrap_debug_frame("<= RX ", iwrap_rx_packet_channel, iwrap_rx_payload_length, iwrap_tptr);
             #endif /* IWRAP_DEBUG */
             
+            #ifdef IWRAP_INCLUDE_STATS
+                if (iwrap_timestamp) t_dispatch = iwrap_timestamp();
+            #endif
+            #ifdef IWRAP_INCLUDE_PROFILE
+                if (iwrap_timestamp) t_callback = iwrap_timestamp();
+            #endif
+
             // process iWRAP command channel data
             if (iwrap_rx_packet_channel == 0xFF) {
                 #ifdef IWRAP_INCLUDE_RXOUTPUT
                     // trigger general "RX output" callback
                     if (iwrap_callback_rxoutput) iwrap_callback_rxoutput(iwrap_rx_payload_length, iwrap_tptr);
                 #endif
-                    
-                // check for known iWRAP responses/events
-                if (strncmp((char *)iwrap_tptr, "OK.", 3) == 0) { // this one first since it happens most
-                    if (iwrap_pending_commands) iwrap_pending_commands--;
-                    if (iwrap_pending_info) iwrap_pending_info--;
-                    #ifdef IWRAP_INCLUDE_IDLE
-                        if (!iwrap_pending_commands && iwrap_callback_idle) iwrap_callback_idle(iwrap_last_command_result);
-                    #endif
-                    #ifdef IWRAP_INCLUDE_EVT_OK
-                        if (iwrap_evt_ok) iwrap_evt_ok();
-                    #endif
-                    iwrap_last_command_result = 0;
-              #if defined(IWRAP_INCLUDE_EVT_A2DP_STREAMING_START) || defined(IWRAP_INCLUDE_A2DP_STREAMING_STOP)
-                } else if (strncmp((char *)iwrap_tptr, "A2DP STR", 8) == 0) {
-                    if (iwrap_tptr[17] == 'A') {
-                      #ifdef IWRAP_INCLUDE_EVT_A2DP_STREAMING_START
+
+                // check for known iWRAP responses/events and update pending command state
+                iwrap_rx_event.type = iwrap_track_line(iwrap_classify_line(iwrap_tptr, iwrap_rx_payload_length), iwrap_tptr, iwrap_rx_payload_length);
+                iwrap_rx_event.length = iwrap_rx_payload_length;
+                iwrap_rx_event.line = iwrap_tptr;
+                #ifdef IWRAP_INCLUDE_TRACE
+                    trace -> event = iwrap_rx_event.type;
+                #endif
+
+                switch (iwrap_rx_event.type) {
+                    case IWRAP_EVENT_OK: // this one first since it happens most
+                        #ifdef IWRAP_INCLUDE_IDLE
+                            if (!iwrap_pending_commands && iwrap_callback_idle) iwrap_callback_idle(iwrap_last_command_result);
+                        #endif
+                        #ifdef IWRAP_INCLUDE_EVT_OK
+                            if (iwrap_evt_ok) iwrap_evt_ok();
+                        #endif
+                        IWRAP_EMIT_EVENT(&iwrap_rx_event);
+                        iwrap_last_command_result = 0;
+                        break;
+                  #ifdef IWRAP_INCLUDE_EVT_A2DP_STREAMING_START
+                    case IWRAP_EVENT_A2DP_STREAMING_START:
                         // A2DP STREAMING START {link_id}
-                        if (iwrap_evt_a2dp_streaming_start) {
-                            char *test = (char *)iwrap_tptr + 20;
-                            uint8_t link_id = strtol(test, &test, 10);
-                            iwrap_evt_a2dp_streaming_start(link_id);
+                        if ((iwrap_evt_a2dp_streaming_start || IWRAP_EVENT_SINKS) && !iwrap_decode_evt_a2dp_streaming_start(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.evt_a2dp_streaming_start)) {
+                            if (iwrap_evt_a2dp_streaming_start) iwrap_evt_a2dp_streaming_start(iwrap_rx_event.data.evt_a2dp_streaming_start.link_id);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
                         }
-                      #endif
-                    } else {
-                      #ifdef IWRAP_INCLUDE_EVT_A2DP_STREAMING_STOP
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_EVT_A2DP_STREAMING_STOP
+                    case IWRAP_EVENT_A2DP_STREAMING_STOP:
                         // A2DP STREAMING STOP {link_id}
-                        if (iwrap_evt_a2dp_streaming_stop) {
-                            char *test = (char *)iwrap_tptr + 19;
-                            uint8_t link_id = strtol(test, &test, 10);
-                            iwrap_evt_a2dp_streaming_stop(link_id);
+                        if ((iwrap_evt_a2dp_streaming_stop || IWRAP_EVENT_SINKS) && !iwrap_decode_evt_a2dp_streaming_stop(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.evt_a2dp_streaming_stop)) {
+                            if (iwrap_evt_a2dp_streaming_stop) iwrap_evt_a2dp_streaming_stop(iwrap_rx_event.data.evt_a2dp_streaming_stop.link_id);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
                         }
-                      #endif
-                    }
-              #endif
-              #ifdef IWRAP_INCLUDE_RSP_CALL
-                } else if (strncmp((char *)iwrap_tptr, "CALL ", 5) == 0) {
-                    // CALL 
-                    if (iwrap_rsp_call) {
-                        char *test = (char *)iwrap_tptr + 5;
-                        uint8_t link_id = strtol(test, &test, 10);
-                        iwrap_rsp_call(link_id);
-                    }
-              #endif
-              #ifdef IWRAP_INCLUDE_EVT_CONNECT
-                } else if (strncmp((char *)iwrap_tptr, "CONN", 4) == 0) {
-                    // CONNECT {link_id} {SCO | RFCOMM | A2DP | HID | HFP | HFP-AG {target} [address]
-                    if (iwrap_evt_connect) {
-                        char *test = (char *)iwrap_tptr + 8;
-                        uint8_t link_id = strtol(test, &test, 10); test++;
-                        char *profile = test;
-                        test = strchr(test, ' ');
-                        test[0] = 0; // null terminate target
-                        test++;
-                        uint16_t target = strtol(test, &test, 16); test++;
-                        iwrap_address_t mac;
-                        if ((uint16_t)((iwrap_tptr - (uint8_t *)test) + 17) < iwrap_rx_payload_length) {
-                            // optional [address] parameter present
-                            iwrap_hexstrtobin(test, &test, mac.address, 0); test++;
-                            iwrap_evt_connect(link_id, profile, target, &mac);
-                        } else {
-                            iwrap_evt_connect(link_id, profile, target, 0);
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_RSP_CALL
+                    case IWRAP_EVENT_RSP_CALL:
+                        // CALL {link_id}
+                        if ((iwrap_rsp_call || IWRAP_EVENT_SINKS) && !iwrap_decode_rsp_call(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.rsp_call)) {
+                            if (iwrap_rsp_call) iwrap_rsp_call(iwrap_rx_event.data.rsp_call.link_id);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
                         }
-                    }
-              #endif
-              #ifdef IWRAP_INCLUDE_RSP_HID_GET
-                } else if (strncmp((char *)iwrap_tptr, "HID GET ", 8) == 0) {
-                    // HID GET {length} {descriptor}
-                    if (iwrap_rsp_hid_get) {
-                        char *test = (char *)iwrap_tptr + 8;
-                        uint8_t length = strtol(test, &test, 16); test++;
-                        uint8_t descriptor[length];
-                        iwrap_hexstrtobin(test, &test, descriptor, length * 2);
-                        iwrap_rsp_hid_get(length, descriptor);
-                    }
-              #endif
-              #if defined(IWRAP_INCLUDE_EVT_HID_OUTPUT) || defined(IWRAP_INCLUDE_EVT_HID_SUSPEND)
-                } else if (strncmp((char *)iwrap_tptr, "HID ", 4) == 0 && iwrap_tptr[4] < 0x40) {
-                    char *test = (char *)iwrap_tptr + 4;
-                    uint8_t link_id = strtol(test, &test, 10); test++;
-                    if (test[0] == 'O') {
-                      #ifdef IWRAP_INCLUDE_EVT_HID_OUTPUT
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_EVT_BATTERY
+                    case IWRAP_EVENT_BATTERY:
+                        // BATTERY {mv}
+                        if ((iwrap_evt_battery || IWRAP_EVENT_SINKS) && !iwrap_decode_evt_battery(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.evt_battery)) {
+                            if (iwrap_evt_battery) iwrap_evt_battery(iwrap_rx_event.data.evt_battery.mv);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
+                        }
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_EVT_BATTERY_FULL
+                    case IWRAP_EVENT_BATTERY_FULL:
+                        // BATTERY FULL [mv]
+                        if ((iwrap_evt_battery_full || IWRAP_EVENT_SINKS) && !iwrap_decode_evt_battery_full(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.evt_battery_full)) {
+                            if (iwrap_evt_battery_full) iwrap_evt_battery_full(iwrap_rx_event.data.evt_battery_full.mv);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
+                        }
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_EVT_BATTERY_LOW
+                    case IWRAP_EVENT_BATTERY_LOW:
+                        // BATTERY LOW [mv]
+                        if ((iwrap_evt_battery_low || IWRAP_EVENT_SINKS) && !iwrap_decode_evt_battery_low(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.evt_battery_low)) {
+                            if (iwrap_evt_battery_low) iwrap_evt_battery_low(iwrap_rx_event.data.evt_battery_low.mv);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
+                        }
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_EVT_BATTERY_SHUTDOWN
+                    case IWRAP_EVENT_BATTERY_SHUTDOWN:
+                        // BATTERY SHUTDOWN [mv]
+                        if ((iwrap_evt_battery_shutdown || IWRAP_EVENT_SINKS) && !iwrap_decode_evt_battery_shutdown(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.evt_battery_shutdown)) {
+                            if (iwrap_evt_battery_shutdown) iwrap_evt_battery_shutdown(iwrap_rx_event.data.evt_battery_shutdown.mv);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
+                        }
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_RSP_BER
+                    case IWRAP_EVENT_RSP_BER:
+                        // BER {bd_addr} {ber}
+                        if ((iwrap_rsp_ber || IWRAP_EVENT_SINKS) && !iwrap_decode_rsp_ber(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.rsp_ber)) {
+                            if (iwrap_rsp_ber) iwrap_rsp_ber(&iwrap_rx_event.data.rsp_ber.bd_addr, iwrap_rx_event.data.rsp_ber.ber);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
+                        }
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_EVT_CONNECT
+                    case IWRAP_EVENT_CONNECT:
+                        // CONNECT {link_id} {SCO | RFCOMM | A2DP | HID | HFP | HFP-AG {target} [address]
+                        if ((iwrap_evt_connect || IWRAP_EVENT_SINKS) && !iwrap_decode_evt_connect(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.evt_connect)) {
+                            if (iwrap_evt_connect) iwrap_evt_connect(
+                                iwrap_rx_event.data.evt_connect.link_id,
+                                iwrap_rx_event.data.evt_connect.profile,
+                                iwrap_rx_event.data.evt_connect.target,
+                                iwrap_rx_event.data.evt_connect.has_address ? &iwrap_rx_event.data.evt_connect.address : 0);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
+                        }
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_RSP_HID_GET
+                    case IWRAP_EVENT_RSP_HID_GET:
+                        // HID GET {length} {descriptor}
+                        if ((iwrap_rsp_hid_get || IWRAP_EVENT_SINKS) && !iwrap_decode_rsp_hid_get(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.rsp_hid_get)) {
+                            if (iwrap_rsp_hid_get) iwrap_rsp_hid_get(iwrap_rx_event.data.rsp_hid_get.length, iwrap_rx_event.data.rsp_hid_get.descriptor);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
+                        }
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_EVT_HID_OUTPUT
+                    case IWRAP_EVENT_HID_OUTPUT:
                         // HID {link_id} OUTPUT {data_length} {data}
-                        if (iwrap_evt_hid_output) {
-                            uint8_t length = strtol(test, &test, 16); test++;
-                            uint8_t data[length];
-                            iwrap_hexstrtobin(test, &test, data, length * 2);
-                            iwrap_evt_hid_output(link_id, length, data);
+                        if ((iwrap_evt_hid_output || IWRAP_EVENT_SINKS) && !iwrap_decode_evt_hid_output(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.evt_hid_output)) {
+                            if (iwrap_evt_hid_output) iwrap_evt_hid_output(
+                                iwrap_rx_event.data.evt_hid_output.link_id,
+                                iwrap_rx_event.data.evt_hid_output.data_length,
+                                iwrap_rx_event.data.evt_hid_output.data);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
                         }
-                      #endif
-                    } else {
-                      #ifdef IWRAP_INCLUDE_EVT_HID_SUSPEND
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_EVT_HID_SUSPEND
+                    case IWRAP_EVENT_HID_SUSPEND:
                         // HID {link_id} SUSPEND
-                        if (iwrap_evt_hid_suspend) {
-                            iwrap_evt_hid_suspend(link_id);
+                        if ((iwrap_evt_hid_suspend || IWRAP_EVENT_SINKS) && !iwrap_decode_evt_hid_suspend(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.evt_hid_suspend)) {
+                            if (iwrap_evt_hid_suspend) iwrap_evt_hid_suspend(iwrap_rx_event.data.evt_hid_suspend.link_id);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
                         }
-                      #endif
-                    }
-              #endif
-              #ifdef IWRAP_INCLUDE_EVT_HFP
-                } else if (strncmp((char *)iwrap_tptr, "HFP ", 4) == 0) {
-                    // HFP {link_id} ...content...
-                    if (iwrap_evt_hfp) {
-                        char *test = (char *)iwrap_tptr + 4;
-                        uint8_t link_id = strtol(test, &test, 10); test++;
-                        char *type = test;
-                        test = strchr(test, ' ') + 1;
-                        char *detail = test;
-                        iwrap_tptr[iwrap_rx_payload_length - 2] = 0; // null terminate
-                        iwrap_evt_hfp(link_id, type, detail);
-                    }
-              #endif
-              #ifdef IWRAP_INCLUDE_EVT_HFP_AG
-                } else if (strncmp((char *)iwrap_tptr, "HFP-AG ", 7) == 0) {
-                    // HFP-AG {link_id} ...content...
-                    if (iwrap_evt_hfp_ag) {
-                        char *test = (char *)iwrap_tptr + 7;
-                        uint8_t link_id = strtol(test, &test, 10); test++;
-                        char *type = test;
-                        test = strchr(test, ' ') + 1;
-                        char *detail = test;
-                        iwrap_tptr[iwrap_rx_payload_length - 2] = 0; // null terminate
-                        iwrap_evt_hfp_ag(link_id, type, detail);
-                    }
-              #endif
-              #ifdef IWRAP_INCLUDE_EVT_IDENT
-                } else if (strncmp((char *)iwrap_tptr, "IDENT ", 6) == 0 && iwrap_tptr[6] != 'E') {
-                    // IDENT {src}:{vendor_id} {product_id} {version} "[descr]"
-                    if (iwrap_evt_ident) {
-                        char *test = (char *)iwrap_tptr + 6;
-                        char *src = test;
-                        test = strchr(test, ':');
-                        test[0] = 0; // null terminate "src" string
-                        test++;
-                        uint16_t vendor_id = strtol(test, &test, 16); test++;
-                        uint16_t product_id = strtol(test, &test, 16); test++;
-                        char *version = test;
-                        test = strchr(test, ' ');
-                        test[0] = 0; // null terminate "version" string
-                        test += 2; // advance to first " character
-                        char *descr = test;
-                        test = strchr(test, '"');
-                        test[0] = 0; // null terminate "descr" string
-                        iwrap_evt_ident(src, vendor_id, product_id, version, descr);
-                    }
-              #endif
-              #ifdef IWRAP_INCLUDE_EVT_IDENT_ERROR
-                } else if (strncmp((char *)iwrap_tptr, "IDENT ER", 8) == 0) {
-                    // IDENT ERROR {error_code} {address} [message]
-                    if (iwrap_evt_ident_error) {
-                        char *test = (char *)iwrap_tptr + 12;
-                        uint16_t error_code = strtol(test, &test, 16); test++;
-                        iwrap_address_t mac;
-                        iwrap_hexstrtobin(test, &test, mac.address, 0); test++;
-                        if ((uint16_t)((iwrap_tptr - (uint8_t *)test) + 3) < iwrap_rx_payload_length) {
-                            // optional [message] parameter present
-                            iwrap_tptr[iwrap_rx_payload_length - 2] = 0; // null terminate
-                            iwrap_evt_ident_error(error_code, &mac, test);
-                        } else {
-                            iwrap_evt_ident_error(error_code, &mac, 0);
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_EVT_HFP
+                    case IWRAP_EVENT_HFP:
+                        // HFP {link_id} {type} [detail]
+                        if ((iwrap_evt_hfp || IWRAP_EVENT_SINKS) && !iwrap_decode_evt_hfp(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.evt_hfp)) {
+                            if (iwrap_evt_hfp) iwrap_evt_hfp(iwrap_rx_event.data.evt_hfp.link_id, iwrap_rx_event.data.evt_hfp.type, iwrap_rx_event.data.evt_hfp.detail);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
                         }
-                    }
-              #endif
-              #if defined(IWRAP_INCLUDE_RSP_INQUIRY_COUNT) || defined(IWRAP_INCLUDE_RSP_INQUIRY_RESULT)
-                } else if (strncmp((char *)iwrap_tptr, "INQUIRY ", 8) == 0) {
-                    if (iwrap_rx_payload_length < 13) {
-                      #ifdef IWRAP_INCLUDE_RSP_INQUIRY_COUNT
-                        // INQUIRY {num_of_devices} 
-                        if (iwrap_rsp_inquiry_count) {
-                            char *test = (char *)iwrap_tptr + 5;
-                            uint8_t num_of_devices = strtol(test, &test, 10);
-                            iwrap_rsp_inquiry_count(num_of_devices);
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_EVT_HFP_AG
+                    case IWRAP_EVENT_HFP_AG:
+                        // HFP-AG {link_id} {type} [detail]
+                        if ((iwrap_evt_hfp_ag || IWRAP_EVENT_SINKS) && !iwrap_decode_evt_hfp_ag(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.evt_hfp_ag)) {
+                            if (iwrap_evt_hfp_ag) iwrap_evt_hfp_ag(iwrap_rx_event.data.evt_hfp_ag.link_id, iwrap_rx_event.data.evt_hfp_ag.type, iwrap_rx_event.data.evt_hfp_ag.detail);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
                         }
-                      #endif
-                    } else {
-                      #ifdef IWRAP_INCLUDE_RSP_INQUIRY_RESULT
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_EVT_IDENT
+                    case IWRAP_EVENT_IDENT:
+                        // IDENT {src}:{vendor_id} {product_id} {version} "[descr]"
+                        if ((iwrap_evt_ident || IWRAP_EVENT_SINKS) && !iwrap_decode_evt_ident(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.evt_ident)) {
+                            if (iwrap_evt_ident) iwrap_evt_ident(
+                                iwrap_rx_event.data.evt_ident.src,
+                                iwrap_rx_event.data.evt_ident.vendor_id,
+                                iwrap_rx_event.data.evt_ident.product_id,
+                                iwrap_rx_event.data.evt_ident.version,
+                                iwrap_rx_event.data.evt_ident.descr);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
+                        }
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_EVT_IDENT_ERROR
+                    case IWRAP_EVENT_IDENT_ERROR:
+                        // IDENT ERROR {error_code} {address} [message]
+                        if ((iwrap_evt_ident_error || IWRAP_EVENT_SINKS) && !iwrap_decode_evt_ident_error(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.evt_ident_error)) {
+                            if (iwrap_evt_ident_error) iwrap_evt_ident_error(
+                                iwrap_rx_event.data.evt_ident_error.error_code,
+                                &iwrap_rx_event.data.evt_ident_error.address,
+                                iwrap_rx_event.data.evt_ident_error.message);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
+                        }
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_RSP_INQUIRY_COUNT
+                    case IWRAP_EVENT_RSP_INQUIRY_COUNT:
+                        // INQUIRY {num_of_devices}
+                        if ((iwrap_rsp_inquiry_count || IWRAP_EVENT_SINKS) && !iwrap_decode_rsp_inquiry_count(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.rsp_inquiry_count)) {
+                            if (iwrap_rsp_inquiry_count) iwrap_rsp_inquiry_count(iwrap_rx_event.data.rsp_inquiry_count.num_of_devices);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
+                        }
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_RSP_INQUIRY_RESULT
+                    case IWRAP_EVENT_RSP_INQUIRY_RESULT:
                         // INQUIRY {addr} {class_of_device} [rssi]
-                        if (iwrap_rsp_list_result) {
-                            char *test = (char *)iwrap_tptr + 8;
-                            iwrap_address_t mac;
-                            iwrap_hexstrtobin(test, &test, mac.address, 0); test++;
-                            uint32_t class_of_device = strtol(test, &test, 16);
-                            int8_t rssi = 0;
-                            if (test[0] == ' ') {
-                                rssi = strtol(test + 1, &test, 10);
-                            }
-                            iwrap_rsp_inquiry_result(&mac, class_of_device, rssi);
+                        if ((iwrap_rsp_inquiry_result || IWRAP_EVENT_SINKS) && !iwrap_decode_rsp_inquiry_result(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.rsp_inquiry_result)) {
+                            if (iwrap_rsp_inquiry_result) iwrap_rsp_inquiry_result(
+                                &iwrap_rx_event.data.rsp_inquiry_result.bd_addr,
+                                iwrap_rx_event.data.rsp_inquiry_result.class_of_device,
+                                iwrap_rx_event.data.rsp_inquiry_result.rssi);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
                         }
-                      #endif
-                    }
-              #endif
-              #ifdef IWRAP_INCLUDE_EVT_INQUIRY_EXTENDED
-                } else if (strncmp((char *)iwrap_tptr, "INQUIRY_E", 9) == 0) {
-                    // INQUIRY_EXTENDED {addr} RAW {data}
-                    if (iwrap_evt_inquiry_extended) {
-                        char *test = (char *)iwrap_tptr + 16;
-                        iwrap_address_t mac;
-                        iwrap_hexstrtobin(test, &test, mac.address, 0); test += 5;
-                        uint8_t data[(iwrap_rx_payload_length - 39) / 2];
-                        uint8_t length = iwrap_hexstrtobin(test, 0, data, 0) / 2;
-                        iwrap_evt_inquiry_extended(&mac, length, data);
-                    }
-              #endif
-              #ifdef IWRAP_INCLUDE_EVT_INQUIRY_PARTIAL
-                } else if (strncmp((char *)iwrap_tptr, "INQUIRY_P", 9) == 0) {
-                    // INQUIRY_PARTIAL {address} {class_of_device} [{cached_name} {rssi}]
-                    if (iwrap_evt_inquiry_partial) {
-                        char *test = (char *)iwrap_tptr + 16;
-                        iwrap_address_t mac;
-                        iwrap_hexstrtobin(test, &test, mac.address, 0); test++;
-                        uint32_t class_of_device = strtol(test, &test, 16); test++;
-                        if (test[0] == '"') {
-                            // optional [{cached_name} {rssi}] values present
-                            char *name = ++test;
-                            test = strchr(test, '"');
-                            test[0] = 0; // null terminate name string
-                            test++;
-                            int8_t rssi = strtol(test, &test, 10);
-                            iwrap_evt_inquiry_partial(&mac, class_of_device, name, rssi);
-                        } else {
-                            // name and RSSI not present
-                            iwrap_evt_inquiry_partial(&mac, class_of_device, 0, 0);
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_EVT_INQUIRY_EXTENDED
+                    case IWRAP_EVENT_INQUIRY_EXTENDED:
+                        // INQUIRY_EXTENDED {addr} RAW {data}
+                        if ((iwrap_evt_inquiry_extended || IWRAP_EVENT_SINKS) && !iwrap_decode_evt_inquiry_extended(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.evt_inquiry_extended)) {
+                            if (iwrap_evt_inquiry_extended) iwrap_evt_inquiry_extended(
+                                &iwrap_rx_event.data.evt_inquiry_extended.address,
+                                iwrap_rx_event.data.evt_inquiry_extended.length,
+                                iwrap_rx_event.data.evt_inquiry_extended.data);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
                         }
-                    }
-              #endif
-              #if defined(IWRAP_INCLUDE_RSP_LIST_COUNT) || defined(IWRAP_INCLUDE_RSP_LIST_RESULT)
-                } else if (strncmp((char *)iwrap_tptr, "LIST ", 5) == 0) {
-                    if (iwrap_rx_payload_length < 10) {
-                      #ifdef IWRAP_INCLUDE_RSP_LIST_COUNT
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_EVT_INQUIRY_PARTIAL
+                    case IWRAP_EVENT_INQUIRY_PARTIAL:
+                        // INQUIRY_PARTIAL {address} {class_of_device} [{cached_name} {rssi}]
+                        if ((iwrap_evt_inquiry_partial || IWRAP_EVENT_SINKS) && !iwrap_decode_evt_inquiry_partial(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.evt_inquiry_partial)) {
+                            if (iwrap_evt_inquiry_partial) iwrap_evt_inquiry_partial(
+                                &iwrap_rx_event.data.evt_inquiry_partial.address,
+                                iwrap_rx_event.data.evt_inquiry_partial.class_of_device,
+                                iwrap_rx_event.data.evt_inquiry_partial.cached_name,
+                                iwrap_rx_event.data.evt_inquiry_partial.rssi);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
+                        }
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_RSP_LIST_COUNT
+                    case IWRAP_EVENT_RSP_LIST_COUNT:
                         // LIST {num_of_connections}
-                        if (iwrap_rsp_list_count) {
-                            char *test = (char *)iwrap_tptr + 5;
-                            uint8_t num_of_connections = strtol(test, &test, 10);
-                            iwrap_rsp_list_count(num_of_connections);
+                        if ((iwrap_rsp_list_count || IWRAP_EVENT_SINKS) && !iwrap_decode_rsp_list_count(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.rsp_list_count)) {
+                            if (iwrap_rsp_list_count) iwrap_rsp_list_count(iwrap_rx_event.data.rsp_list_count.num_of_connections);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
                         }
-                      #endif
-                    } else {
-                      #ifdef IWRAP_INCLUDE_RSP_LIST_RESULT
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_RSP_LIST_RESULT
+                    case IWRAP_EVENT_RSP_LIST_RESULT:
                         // LIST {link_id} CONNECTED {mode} {blocksize} 0 0 {elapsed_time} {local_msc} {remote_msc} {addr} {channel} {direction} {powermode} {role} {crypt} {buffer} [ERETX]
-                        if (iwrap_rsp_list_result) {
-                            char *test = (char *)iwrap_tptr + 5;
-                            uint8_t link_id = strtol(test, &test, 10); test += 11;
-                            char *mode = test;
-                            test = strchr(test, ' ');
-                            test[0] = 0; // null terminate for in-place string access to "mode" w/o reallocation
-                            test++;
-                            uint16_t blocksize = strtol(test, &test, 10); test++;
-                            strtol(test, &test, 10); test++; // ...two fixed "0" arguments...
-                            strtol(test, &test, 10); test++; // ?
-                            uint32_t elapsed_time = strtol(test, &test, 10); test++;
-                            uint16_t local_msc = strtol(test, &test, 16); test++;
-                            uint16_t remote_msc = strtol(test, &test, 16); test++;
-                            iwrap_address_t addr;
-                            iwrap_hexstrtobin(test, &test, addr.address, 0); test++;
-                            uint16_t channel = strtol(test, &test, 16); test++;
-                            uint8_t direction = 0;
-                            if (test[0] == 'O') { direction = IWRAP_CONNECTION_DIRECTION_OUTGOING; test += 9; }
-                            else if (test[0] == 'I') { direction = IWRAP_CONNECTION_DIRECTION_INCOMING; test += 9; }
-                            uint8_t powermode = 0;
-                            if (test[0] == 'A') { powermode = IWRAP_CONNECTION_POWERMODE_ACTIVE; test += 7; }
-                            else if (test[0] == 'S') { powermode = IWRAP_CONNECTION_POWERMODE_SNIFF; test += 6; }
-                            else if (test[0] == 'H') { powermode = IWRAP_CONNECTION_POWERMODE_HOLD; test += 5; }
-                            else if (test[0] == 'P') { powermode = IWRAP_CONNECTION_POWERMODE_PARK; test += 5; }
-                            uint8_t role = 0;
-                            if (test[0] == 'M') { role = IWRAP_CONNECTION_ROLE_MASTER; test += 7; }
-                            else if (test[0] == 'S') { role = IWRAP_CONNECTION_ROLE_SLAVE; test += 6; }
-                            uint8_t crypt = 0;
-                            if (test[0] == 'P') { crypt = IWRAP_CONNECTION_CRYPT_PLAIN; test += 6; }
-                            else if (test[0] == 'E') { crypt = IWRAP_CONNECTION_CRYPT_ENCRYPTED; test += 10; }
-                            uint16_t buffer = strtol(test, &test, 10); test++;
-                            uint8_t eretx = 0;
-                            if (test[0] == 'E') { eretx = 1; }
-                            iwrap_rsp_list_result(link_id, mode, blocksize, elapsed_time, local_msc, remote_msc, &addr, channel, direction, powermode, role, crypt, buffer, eretx);
+                        if ((iwrap_rsp_list_result || IWRAP_EVENT_SINKS) && !iwrap_decode_rsp_list_result(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.rsp_list_result)) {
+                            if (iwrap_rsp_list_result) iwrap_rsp_list_result(
+                                iwrap_rx_event.data.rsp_list_result.link_id,
+                                iwrap_rx_event.data.rsp_list_result.mode,
+                                iwrap_rx_event.data.rsp_list_result.blocksize,
+                                iwrap_rx_event.data.rsp_list_result.elapsed_time,
+                                iwrap_rx_event.data.rsp_list_result.local_msc,
+                                iwrap_rx_event.data.rsp_list_result.remote_msc,
+                                &iwrap_rx_event.data.rsp_list_result.bd_addr,
+                                iwrap_rx_event.data.rsp_list_result.channel,
+                                iwrap_rx_event.data.rsp_list_result.direction,
+                                iwrap_rx_event.data.rsp_list_result.powermode,
+                                iwrap_rx_event.data.rsp_list_result.role,
+                                iwrap_rx_event.data.rsp_list_result.crypt,
+                                iwrap_rx_event.data.rsp_list_result.buffer,
+                                iwrap_rx_event.data.rsp_list_result.eretx);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
                         }
-                      #endif
-                    }
-              #endif
-              #ifdef IWRAP_INCLUDE_EVT_NAME
-                } else if (strncmp((char *)iwrap_tptr, "NAME", 4) == 0 && iwrap_tptr[7] == ':') {
-                    // NAME {bd_addr} "{name}"
-                    if (iwrap_evt_name) {
-                        char *test = (char *)iwrap_tptr + 5;
-                        iwrap_address_t mac;
-                        iwrap_hexstrtobin(test, &test, mac.address, 0); test += 2; // advance to first " character
-                        char *friendly_name = test;
-                        test = strchr(test, '"');
-                        test[0] = 0; // null terminate name string
-                        iwrap_evt_name(&mac, friendly_name);
-                    }
-              #endif
-              #ifdef IWRAP_INCLUDE_EVT_NAME_ERROR
-                } else if (strncmp((char *)iwrap_tptr, "NAME ER", 7) == 0) {
-                    // NAME ERROR {error_code} {bd_addr} {reason}
-                    if (iwrap_evt_name_error) {
-                        char *test = (char *)iwrap_tptr + 11;
-                        uint16_t error_code = strtol(test, &test, 16); test++;
-                        iwrap_address_t mac;
-                        iwrap_hexstrtobin(test, &test, mac.address, 0); test++;
-                        if ((uint16_t)((iwrap_tptr - (uint8_t *)test) + 3) < iwrap_rx_payload_length) {
-                            // optional [message] parameter present
-                            iwrap_tptr[iwrap_rx_payload_length - 2] = 0; // null terminate
-                            iwrap_evt_name_error(error_code, &mac, test);
-                        } else {
-                            iwrap_evt_name_error(error_code, &mac, 0);
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_EVT_NAME
+                    case IWRAP_EVENT_NAME:
+                        // NAME {bd_addr} "{name}"
+                        if ((iwrap_evt_name || IWRAP_EVENT_SINKS) && !iwrap_decode_evt_name(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.evt_name)) {
+                            if (iwrap_evt_name) iwrap_evt_name(&iwrap_rx_event.data.evt_name.address, iwrap_rx_event.data.evt_name.friendly_name);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
                         }
-                    }
-              #endif
-              #ifdef IWRAP_INCLUDE_EVT_NO_CARRIER
-                } else if (strncmp((char *)iwrap_tptr, "NO CA", 5) == 0) {
-                    if (iwrap_evt_no_carrier) {
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_EVT_NAME_ERROR
+                    case IWRAP_EVENT_NAME_ERROR:
+                        // NAME ERROR {error_code} {bd_addr} {reason}
+                        if ((iwrap_evt_name_error || IWRAP_EVENT_SINKS) && !iwrap_decode_evt_name_error(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.evt_name_error)) {
+                            if (iwrap_evt_name_error) iwrap_evt_name_error(
+                                iwrap_rx_event.data.evt_name_error.error_code,
+                                &iwrap_rx_event.data.evt_name_error.address,
+                                iwrap_rx_event.data.evt_name_error.message);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
+                        }
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_EVT_NO_CARRIER
+                    case IWRAP_EVENT_NO_CARRIER:
                         // NO CARRIER {link_id} ERROR {error_code} [message]
-                        char *test = (char *)iwrap_tptr + 11;
-                        uint8_t link_id = strtol(test, &test, 10); test += 7;
-                        uint16_t error_code = strtol(test, &test, 16); test++;
-                        iwrap_tptr[iwrap_rx_payload_length - 2] = 0; // null terminate
-                        iwrap_evt_no_carrier(link_id, error_code, test);
-                    }
-              #endif
-              #ifdef IWRAP_INCLUDE_RSP_AT
-                } else if (strncmp((char *)iwrap_tptr, "OK", 2) == 0) {
-                    // OK
-                    if (iwrap_rsp_at) iwrap_rsp_at();
-              #endif
-              #if defined(IWRAP_INCLUDE_RSP_PAIR) || defined(IWRAP_INCLUDE_EVT_PAIR)
-                } else if (strncmp((char *)iwrap_tptr, "PAIR", 4) == 0) {
-                    if (iwrap_rx_payload_length < 32) {
-                      #ifdef IWRAP_INCLUDE_RSP_PAIR
+                        if ((iwrap_evt_no_carrier || IWRAP_EVENT_SINKS) && !iwrap_decode_evt_no_carrier(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.evt_no_carrier)) {
+                            if (iwrap_evt_no_carrier) iwrap_evt_no_carrier(
+                                iwrap_rx_event.data.evt_no_carrier.link_id,
+                                iwrap_rx_event.data.evt_no_carrier.error_code,
+                                iwrap_rx_event.data.evt_no_carrier.message);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
+                        }
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_RSP_AT
+                    case IWRAP_EVENT_RSP_AT:
+                        // OK
+                        if (iwrap_rsp_at) iwrap_rsp_at();
+                        IWRAP_EMIT_EVENT(&iwrap_rx_event);
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_RSP_PAIR
+                    case IWRAP_EVENT_RSP_PAIR:
                         // PAIR {bd_addr} {result}
-                        if (iwrap_rsp_pair) {
-                            char *test = (char *)iwrap_tptr + 5;
-                            iwrap_address_t mac;
-                            iwrap_hexstrtobin(test, &test, mac.address, 0); test++; // advance to first " character
-                            iwrap_rsp_pair(&mac, test[0] == 'O' ? 0 : 1);
+                        if ((iwrap_rsp_pair || IWRAP_EVENT_SINKS) && !iwrap_decode_rsp_pair(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.rsp_pair)) {
+                            if (iwrap_rsp_pair) iwrap_rsp_pair(&iwrap_rx_event.data.rsp_pair.bd_addr, iwrap_rx_event.data.rsp_pair.result);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
                         }
-                      #endif
-                    } else {
-                      #ifdef IWRAP_INCLUDE_EVT_PAIR
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_EVT_PAIR
+                    case IWRAP_EVENT_PAIR:
                         // PAIR {address} {key_type} {link_key}
-                        if (iwrap_evt_pair) {
-                            char *test = (char *)iwrap_tptr + 5;
-                            iwrap_address_t mac;
-                            iwrap_hexstrtobin(test, &test, mac.address, 0); test++; // advance to first " character
-                            uint8_t key_type = strtol(test, &test, 16); test++;
-                            uint8_t link_key[16];
-                            iwrap_hexstrtobin(test, &test, link_key, 32);
-                            iwrap_evt_pair(&mac, key_type, link_key);
+                        if ((iwrap_evt_pair || IWRAP_EVENT_SINKS) && !iwrap_decode_evt_pair(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.evt_pair)) {
+                            if (iwrap_evt_pair) iwrap_evt_pair(&iwrap_rx_event.data.evt_pair.address, iwrap_rx_event.data.evt_pair.key_type, iwrap_rx_event.data.evt_pair.link_key);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
                         }
-                      #endif
-                    }
-              #endif
-              #ifdef IWRAP_INCLUDE_EVT_READY
-                } else if (strncmp((char *)iwrap_tptr, "READY", 5) == 0) {
-                    // READY.
-                    if (iwrap_pending_boot) {
-                        iwrap_pending_boot = 0;
-                        iwrap_pending_commands = 0;
-                    }
-                    if (iwrap_evt_ready) iwrap_evt_ready();
-              #endif
-              #ifdef IWRAP_INCLUDE_EVT_RING
-                } else if (strncmp((char *)iwrap_tptr, "RING", 4) == 0) {
-                    // RING {link_id} {address} {SCO | {channel} {profile}}
-                    if (iwrap_evt_ring) {
-                        char *test = (char *)iwrap_tptr + 5;
-                        uint8_t link_id = strtol(test, &test, 10); test++;
-                        iwrap_address_t address;
-                        iwrap_hexstrtobin(test, &test, address.address, 0); test++;
-                        if (test[0] == 'S') {
-                            // SCO (no "channel" parameter)
-                            char *profile = test;
-                            test = strchr(test, ' ');
-                            test[0] = 0; // null terminate for in-place string access to "mode" w/o reallocation
-                            iwrap_evt_ring(link_id, &address, 0, profile);
-                        } else {
-                            // not SCO
-                            uint16_t channel = strtol(test, &test, 16); test++;
-                            char *profile = test;
-                            test = strchr(test, ' ');
-                            test[0] = 0; // null terminate for in-place string access to "mode" w/o reallocation
-                            iwrap_evt_ring(link_id, &address, channel, profile);
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_EVT_READY
+                    case IWRAP_EVENT_READY:
+                        // READY.
+                        if (iwrap_evt_ready) iwrap_evt_ready();
+                        IWRAP_EMIT_EVENT(&iwrap_rx_event);
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_EVT_RING
+                    case IWRAP_EVENT_RING:
+                        // RING {link_id} {address} {SCO | {channel} {profile}}
+                        if ((iwrap_evt_ring || IWRAP_EVENT_SINKS) && !iwrap_decode_evt_ring(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.evt_ring)) {
+                            if (iwrap_evt_ring) iwrap_evt_ring(
+                                iwrap_rx_event.data.evt_ring.link_id,
+                                &iwrap_rx_event.data.evt_ring.address,
+                                iwrap_rx_event.data.evt_ring.channel,
+                                iwrap_rx_event.data.evt_ring.profile);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
                         }
-                    }
-              #endif
-              #ifdef IWRAP_INCLUDE_RSP_SET
-                } else if (strncmp((char *)iwrap_tptr, "SET ", 4) == 0) {
-                    // SET [{category} [{option} {value}]]
-                    if (iwrap_rsp_set) {
-                        uint8_t category = 0;
-                        char *option, *value;
-                        if (iwrap_tptr[4] == 'B') { // SET BT ...
-                            category = IWRAP_SET_CATEGORY_BT;
-                            option = (char *)(iwrap_tptr + 7);
-                        } else if (iwrap_tptr[4] == 'C') {  // SET CONTROL ...
-                            category = IWRAP_SET_CATEGORY_CONTROL;
-                            option = (char *)(iwrap_tptr + 12);
-                        } else if (iwrap_tptr[4] == 'P') {  // SET PROFILE ...
-                            category = IWRAP_SET_CATEGORY_PROFILE;
-                            option = (char *)(iwrap_tptr + 12);
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_RSP_RSSI
+                    case IWRAP_EVENT_RSP_RSSI:
+                        // RSSI {bd_addr} {rssi}
+                        if ((iwrap_rsp_rssi || IWRAP_EVENT_SINKS) && !iwrap_decode_rsp_rssi(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.rsp_rssi)) {
+                            if (iwrap_rsp_rssi) iwrap_rsp_rssi(&iwrap_rx_event.data.rsp_rssi.bd_addr, iwrap_rx_event.data.rsp_rssi.rssi);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
+                        }
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_RSP_SET
+                    case IWRAP_EVENT_RSP_SET:
+                        // SET [{category} [{option} {value}]]
+                        // (SET dump finished is logically handled by "OK." event following, if enabled)
+                        if ((iwrap_rsp_set || IWRAP_EVENT_SINKS) && !iwrap_decode_rsp_set(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.rsp_set)) {
+                            if (iwrap_rsp_set) iwrap_rsp_set(iwrap_rx_event.data.rsp_set.category, iwrap_rx_event.data.rsp_set.option, iwrap_rx_event.data.rsp_set.value);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
                         }
-                        
-                        // ensure we have detected a valid category
-                        if (category) {
-                            iwrap_tptr[iwrap_rx_payload_length - 2] = 0;
-                            value = strchr((char *)option, ' ');
-                            value[0] = 0; value++;
-                            iwrap_rsp_set(category, option, value);
+                        break;
+                  #endif
+                    case IWRAP_EVENT_RSP_SYNTAX_ERROR:
+                        // SYNTAX ERROR
+                        #ifdef IWRAP_INCLUDE_RSP_SYNTAX_ERROR
+                            if (iwrap_rsp_syntax_error) iwrap_rsp_syntax_error();
+                        #endif
+                        IWRAP_EMIT_EVENT(&iwrap_rx_event);
+                        break;
+                  #ifdef IWRAP_INCLUDE_RSP_TEMP
+                    case IWRAP_EVENT_RSP_TEMP:
+                        // TEMP {temp}
+                        if ((iwrap_rsp_temp || IWRAP_EVENT_SINKS) && !iwrap_decode_rsp_temp(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.rsp_temp)) {
+                            if (iwrap_rsp_temp) iwrap_rsp_temp(iwrap_rx_event.data.rsp_temp.temp);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
                         }
-                    }
-                //} else if (strncmp((char *)iwrap_tptr, "SET", 3) == 0) {
-                    // SET dump finished, should be logically handled by "OK." event following (if enabled)
-              #endif
-                } else if (strncmp((char *)iwrap_tptr, "SYN", 3) == 0) {
-                    // SYNTAX ERROR
-                    iwrap_last_command_result = 1;
-                    #ifdef IWRAP_INCLUDE_RSP_SYNTAX_ERROR
-                        if (iwrap_rsp_syntax_error) iwrap_rsp_syntax_error();
-                    #endif
-                } else {
-                    // unmatched packet, check for pending INFO request
+                        break;
+                  #endif
+                  #ifdef IWRAP_INCLUDE_RSP_TXPOWER
+                    case IWRAP_EVENT_RSP_TXPOWER:
+                        // TXPOWER {bd_addr} {txpower}
+                        if ((iwrap_rsp_txpower || IWRAP_EVENT_SINKS) && !iwrap_decode_rsp_txpower(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.rsp_txpower)) {
+                            if (iwrap_rsp_txpower) iwrap_rsp_txpower(&iwrap_rx_event.data.rsp_txpower.bd_addr, iwrap_rx_event.data.rsp_txpower.txpower);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
+                        }
+                        break;
+                  #endif
                   #ifdef IWRAP_INCLUDE_RSP_INFO
-                    // (INFO command produces lines with various output formats
-                    if (iwrap_pending_info && iwrap_rsp_info) {
-                        iwrap_tptr[iwrap_rx_payload_length - 2] = 0;
-                        iwrap_rsp_info(iwrap_rx_payload_length - 2, (char *)iwrap_tptr);
-                    } else
+                    case IWRAP_EVENT_RSP_INFO:
+                        // unmatched line while INFO request is pending
+                        if ((iwrap_rsp_info || IWRAP_EVENT_SINKS) && !iwrap_decode_rsp_info(iwrap_tptr, iwrap_rx_payload_length, &iwrap_rx_event.data.rsp_info)) {
+                            if (iwrap_rsp_info) iwrap_rsp_info(iwrap_rx_event.data.rsp_info.length, iwrap_rx_event.data.rsp_info.info);
+                            IWRAP_EMIT_EVENT(&iwrap_rx_event);
+                        }
+                        break;
                   #endif
-                    {
+                    default:
                         // TODO: TEMP DEBUG OUTPUT FOR UNMATCHED RX PACKET
-                        #ifdef IWRAP_DEBUG_TEMP
-                            if (iwrap_debug) {
-                                int i;
-                                iwrap_debug("?? RX ");
-                                iwrap_debug_hex(iwrap_rx_packet_channel);
-                                iwrap_debug(", ");
-                                iwrap_debug_int(iwrap_rx_payload_length);
-                                iwrap_debug(":\t");
-                                for (i = 0; i < iwrap_rx_payload_length; i++) {
-                                    if (iwrap_tptr[i] > 31 && iwrap_tptr[i] < 127) {
-                                        iwrap_debug_char(iwrap_tptr[i]);
-                                    } else if (iwrap_tptr[i] == 9) {
-                                        iwrap_debug("\\t");
-                                    } else if (iwrap_tptr[i] == 10) {
-                                        iwrap_debug("\\n");
-                                    } else if (iwrap_tptr[i] == 13) {
-                                        iwrap_debug("\\r");
-                                    } else {
-                                        iwrap_debug("\\x");
-                                        iwrap_debug_hex(iwrap_tptr[i]);
-                                    }
-                                }
-                                iwrap_debug("\n");
-                            }
-                        #endif /* IWRAP_DEBUG */
-                    }
+                        #if defined(IWRAP_DEBUG) && defined(IWRAP_DEBUG_TEMP)
+                            iwrap_debug_frame("?? RX ", iwrap_rx_packet_channel, iwrap_rx_payload_length, iwrap_tptr);
+                        #endif
+                        break;
                 }
-          #ifdef IWRAP_INCLUDE_RXDATA
             } else {
+                #ifdef IWRAP_INCLUDE_LINK_STATS
+                    if (iwrap_rx_packet_channel < IWRAP_MAX_LINKS) iwrap_link_stats_account(iwrap_rx_packet_channel, 0, iwrap_rx_payload_length);
+                #endif
+                #ifdef IWRAP_INCLUDE_POWER
+                    if (iwrap_rx_packet_channel < IWRAP_MAX_LINKS) iwrap_power_traffic(iwrap_rx_packet_channel, iwrap_rx_payload_length);
+                #endif
+              #ifdef IWRAP_INCLUDE_RXDATA
                 // data packet, so let the user app handle it
                 if (iwrap_callback_rxdata) {
                     iwrap_tptr[iwrap_rx_payload_length] = 0; // null terminate
                     iwrap_callback_rxdata(iwrap_rx_packet_channel, iwrap_rx_payload_length, iwrap_tptr);
                 }
-          #endif
+              #endif
+                #ifdef IWRAP_INCLUDE_RX_RINGS
+                    // queue for consumer
+                    if (iwrap_rx_packet_channel < IWRAP_MAX_LINKS) iwrap_rx_ring_push(iwrap_rx_packet_channel, iwrap_rx_payload_length, iwrap_tptr);
+                #endif
+                #ifdef IWRAP_INCLUDE_REASSEMBLY
+                    // rebuild application messages
+                    if (iwrap_rx_packet_channel < IWRAP_MAX_LINKS) iwrap_framer_input(iwrap_rx_packet_channel, iwrap_rx_payload_length, iwrap_tptr);
+                #endif
             }
+
+            #ifdef IWRAP_INCLUDE_PROFILE
+                if (iwrap_timestamp) {
+                    t_callback = iwrap_timestamp() - t_callback;
+                    iwrap_histogram_record(iwrap_rx_packet_channel == 0xFF ? &iwrap_profile.events[iwrap_rx_event.type] : &iwrap_profile.rxdata, t_callback);
+                    if (iwrap_callback_budget && t_callback > iwrap_callback_budget) {
+                        iwrap_profile.slow++;
+                        if (iwrap_callback_slow) iwrap_callback_slow(iwrap_rx_packet_channel == 0xFF ? iwrap_rx_event.type : IWRAP_EVENT_NONE, iwrap_rx_packet_channel, t_callback);
+                    }
+                }
+            #endif
+
+            #ifdef IWRAP_INCLUDE_STATS
+                IWRAP_STATS_BEGIN();
+                if (mode == IWRAP_MODE_MUX) iwrap_stats.frames++;
+                else iwrap_stats.lines++;
+                if (iwrap_rx_payload_length > iwrap_stats.max_line_length) iwrap_stats.max_line_length = iwrap_rx_payload_length;
+                if (iwrap_rx_packet_channel == 0xFF) iwrap_stats.events[iwrap_rx_event.type]++;
+                if (iwrap_timestamp) {
+                    iwrap_stats.parse_time += t_dispatch - t_start;
+                    iwrap_stats.dispatch_time += iwrap_timestamp() - t_dispatch;
+                }
+                IWRAP_STATS_END();
+            #endif
             
             // reset all packet metadata
             iwrap_rx_packet_length = 0;
@@ -723,81 +1537,3435 @@ uint8_t iwrap_parse(uint8_t b, uint8_t mode) {
             iwrap_in_packet = 0;
             
             // free memory if necessary
-            if (iwrap_rx_packet_size > 64) {
+            if (iwrap_rx_packet_size > IWRAP_RX_BUFFER_KEEP) {
                 // decrease to 64 bytes and verify allocation
                 iwrap_tptr = (uint8_t *)realloc(iwrap_rx_packet, iwrap_rx_packet_size = 64);
                 if (!iwrap_tptr) { return 1; }
                 iwrap_rx_packet = iwrap_tptr;
+                #ifdef IWRAP_INCLUDE_STATS
+                    IWRAP_STATS_BEGIN();
+                    iwrap_stats.reallocs++;
+                    IWRAP_STATS_END();
+                #endif
             }
         }
     }
-	return 0;
+	return 0;
+}
+
+#ifdef IWRAP_INCLUDE_STATS
+    /**
+     * @brief Take consistent snapshot of parser statistics
+     * @param snapshot Destination for copy of all counters
+     *
+     * May run on another thread than iwrap_parse(), but not in an interrupt
+     * which can preempt iwrap_parse(), since it waits for updates to finish.
+     */
+    void iwrap_get_stats(iwrap_stats_t *snapshot) {
+        uint16_t sequence;
+        do {
+            while ((sequence = iwrap_stats.sequence) & 1);
+            IWRAP_STATS_BARRIER();
+            memcpy(snapshot, (const void *)&iwrap_stats, sizeof(iwrap_stats_t));
+            IWRAP_STATS_BARRIER();
+        } while (sequence != iwrap_stats.sequence);
+    }
+
+    /**
+     * @brief Clear all parser statistics (call from same context as iwrap_parse())
+     */
+    void iwrap_reset_stats() {
+        IWRAP_STATS_BEGIN();
+        memset((uint8_t *)&iwrap_stats + sizeof(iwrap_stats.sequence), 0, sizeof(iwrap_stats_t) - sizeof(iwrap_stats.sequence));
+        IWRAP_STATS_END();
+    }
+#endif /* IWRAP_INCLUDE_STATS */
+
+#ifdef IWRAP_INCLUDE_TRACE
+    /**
+     * @brief Record one frame/line in the flight recorder ring, overwriting the oldest entry
+     * @param direction Direction and type (IWRAP_TRACE_*)
+     * @param channel MUX channel or link ID (0xFF for command channel)
+     * @param event Event or command kind (IWRAP_EVENT_* or IWRAP_COMMAND_*, 0 if not applicable)
+     * @param length Full payload length
+     * @param data Payload data (only the first IWRAP_TRACE_PAYLOAD bytes are kept)
+     * @return Recorded entry, valid until IWRAP_TRACE_SIZE more entries are recorded
+     */
+    iwrap_trace_entry_t *iwrap_trace_record(uint8_t direction, uint8_t channel, uint8_t event, uint16_t length, const uint8_t *data) {
+        iwrap_trace_entry_t *entry = &iwrap_trace.entries[iwrap_trace.recorded++ & (IWRAP_TRACE_SIZE - 1)];
+        entry -> timestamp = iwrap_timestamp ? (uint32_t)iwrap_timestamp() : 0;
+        entry -> length = length;
+        entry -> direction = direction;
+        entry -> channel = channel;
+        entry -> event = event;
+        entry -> captured = length < IWRAP_TRACE_PAYLOAD ? length : IWRAP_TRACE_PAYLOAD;
+        memcpy(entry -> payload, data, entry -> captured);
+        return entry;
+    }
+
+    /**
+     * @brief Write flight recorder contents, oldest entry first, in binary format for offline decoding
+     * @param write Output function (same signature as iwrap_output, so a UART, file or socket writer fits)
+     * @return Result code (non-zero indicates error, 0xFF = no output function)
+     *
+     * Does not allocate and does not touch parser state, so it may be called from
+     * a fatal error handler. All multi-byte fields are little-endian:
+     *
+     * Header (12 bytes):
+     *   0  char[4]  magic "iWTR"
+     *   4  uint8    format version (IWRAP_TRACE_VERSION)
+     *   5  uint8    payload bytes per entry (IWRAP_TRACE_PAYLOAD)
+     *   6  uint16   number of entries that follow
+     *   8  uint32   entries recorded since reset (more than the count means older ones were overwritten)
+     *
+     * Entry (10 + payload bytes per entry):
+     *   0  uint32   timestamp (low 32 bits of iwrap_timestamp(), 0 without clock)
+     *   4  uint16   full payload length
+     *   6  uint8    direction (0 = RX, 1 = TX command, 2 = TX data)
+     *   7  uint8    channel/link ID (0xFF = command channel)
+     *   8  uint8    event (IWRAP_EVENT_* for RX on 0xFF, IWRAP_COMMAND_* for TX command, else 0)
+     *   9  uint8    payload bytes captured
+     *  10  uint8[]  payload, zero padded to payload bytes per entry
+     */
+    uint8_t iwrap_trace_dump(int (*write)(int length, unsigned char *data)) {
+        uint8_t buf[10 + IWRAP_TRACE_PAYLOAD];
+        uint32_t i, count;
+        const iwrap_trace_entry_t *entry;
+
+        if (!write) return 0xFF;
+
+        count = iwrap_trace.recorded < IWRAP_TRACE_SIZE ? iwrap_trace.recorded : IWRAP_TRACE_SIZE;
+        buf[0] = 'i';
+        buf[1] = 'W';
+        buf[2] = 'T';
+        buf[3] = 'R';
+        buf[4] = IWRAP_TRACE_VERSION;
+        buf[5] = IWRAP_TRACE_PAYLOAD;
+        buf[6] = count & 0xFF;
+        buf[7] = count >> 8;
+        buf[8] = iwrap_trace.recorded & 0xFF;
+        buf[9] = (iwrap_trace.recorded >> 8) & 0xFF;
+        buf[10] = (iwrap_trace.recorded >> 16) & 0xFF;
+        buf[11] = iwrap_trace.recorded >> 24;
+        write(12, buf);
+
+        for (i = iwrap_trace.recorded - count; i != iwrap_trace.recorded; i++) {
+            entry = &iwrap_trace.entries[i & (IWRAP_TRACE_SIZE - 1)];
+            buf[0] = entry -> timestamp & 0xFF;
+            buf[1] = (entry -> timestamp >> 8) & 0xFF;
+            buf[2] = (entry -> timestamp >> 16) & 0xFF;
+            buf[3] = entry -> timestamp >> 24;
+            buf[4] = entry -> length & 0xFF;
+            buf[5] = entry -> length >> 8;
+            buf[6] = entry -> direction;
+            buf[7] = entry -> channel;
+            buf[8] = entry -> event;
+            buf[9] = entry -> captured;
+            memcpy(buf + 10, entry -> payload, entry -> captured);
+            memset(buf + 10 + entry -> captured, 0, IWRAP_TRACE_PAYLOAD - entry -> captured);
+            write(sizeof(buf), buf);
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Clear flight recorder (call from same context as iwrap_parse())
+     */
+    void iwrap_trace_reset() {
+        memset(&iwrap_trace, 0, sizeof(iwrap_trace_t));
+    }
+#endif /* IWRAP_INCLUDE_TRACE */
+
+#ifdef IWRAP_INCLUDE_MUX
+    
+    /**
+     * @brief Build MUX frame from given raw data and channel
+     * @param channel Link ID or iWRAP command channel (0xFF)
+     * @param in_len Full length of raw data byte array to pack into MUX frame
+     * @param in Raw data byte array
+     * @param out_len Full length of populated MUX frame byte array
+     * @param out Byte array to populate with new data (must be pre-allocated)
+     * @return Result code (non-zero indicates error)
+     */
+    uint8_t iwrap_pack_mux_frame(uint8_t channel, uint16_t in_len, uint8_t *in, uint16_t *out_len, uint8_t **out) {
+        // payload length is only 10 bits
+        if (in_len > IWRAP_MUX_MAX_PAYLOAD) { return 2; }
+        
+        // allocate enough memory for the whole MUX frame
+        *out = (uint8_t *)malloc(in_len + 5);
+        
+        // make sure allocation completed successfully
+        if (*out == 0) { return 1; }
+        
+        // build frame
+        *out_len = in_len + 5;
+        (*out)[0] = 0xBF;
+        (*out)[1] = channel;
+        (*out)[2] = 0x00 | ((in_len >> 8) & 0x03); // flags = 0 always in latest iWRAP (2014-05-05)
+        (*out)[3] = in_len;
+        memcpy((*out) + 4, in, in_len);
+        (*out)[in_len + 4] = channel ^ 0xFF;
+        return 0;
+    }
+
+    /**
+     * @brief Output MUX frame header, payload and trailer without building the frame in memory
+     * @param channel Link ID or iWRAP command channel (0xFF)
+     * @param length Payload length (at most IWRAP_MUX_MAX_PAYLOAD)
+     * @param data Payload data
+     *
+     * Uses a single iwrap_output_vector call if assigned, otherwise three iwrap_output calls.
+     */
+    void iwrap_output_mux_frame(uint8_t channel, uint16_t length, const uint8_t *data) {
+        uint8_t header[4], trailer;
+        iwrap_iovec_t vector[3];
+        header[0] = 0xBF;
+        header[1] = channel;
+        header[2] = (length >> 8) & 0x03; // flags = 0 always in latest iWRAP (2014-05-05)
+        header[3] = length;
+        trailer = channel ^ 0xFF;
+        if (iwrap_output_vector) {
+            vector[0].data = header;
+            vector[0].length = 4;
+            vector[1].data = data;
+            vector[1].length = length;
+            vector[2].data = &trailer;
+            vector[2].length = 1;
+            iwrap_output_vector(3, vector);
+        } else {
+            iwrap_output(4, header);
+            if (length) iwrap_output(length, (unsigned char *)data);
+            iwrap_output(1, &trailer);
+        }
+    }
+
+    /**
+     * @brief Disassemble MUX frame into components
+     * @param in_len Full length of MUX frame
+     * @param in MUX frame byte array
+     * @param channel MUX frame channel
+     * @param flags MUX frame flags byte
+     * @param length Payload data length
+     * @param out Payload data byte array
+     * @param copy Flag to enable copying to new memory (non-zero), or just pointers to existing memory
+     * @return Result code (non-zero indicates error)
+     */
+    uint8_t iwrap_unpack_mux_frame(uint16_t in_len, uint8_t *in, uint8_t *channel, uint8_t *flags, uint16_t *length, uint8_t **out, uint8_t copy) {
+        if (in_len < 5 || in[0] != 0xBF) { return 2; }          // invalid MUX frame size/format
+        if ((in[1] ^ 0xFF) != in[in_len - 1]) { return 3; }     // checksum failure
+        
+        *channel = in[1];
+        *flags = in[2] >> 2;
+        *length = in[3] | ((in[2] & 0x03) << 8);
+        
+        if (copy) {
+            // allocate enough memory for the payload data
+            *out = (uint8_t *)malloc(*length);
+            
+            // make sure allocation completed successfully
+            if (out == 0) { return 1; }
+            
+            // copy payload into new allocated block
+            memcpy(*out, in + 4, *length);
+        } else {
+            // just create a pointer
+            *out = in + 4;
+        }
+        return 0;
+    }
+#endif /* IWRAP_INCLUDE_MUX */
+
+/**
+ * @brief Identify which response or event a command channel line contains
+ * @param line Raw line received from iWRAP (including CR/LF)
+ * @param length Length of raw line in bytes
+ * @return Event type (IWRAP_EVENT_NONE if not recognized)
+ * @see IWRAP_EVENT_OK
+ */
+uint8_t iwrap_classify_line(const uint8_t *line, uint16_t length) {
+    const char *s = (const char *)line;
+    if (length < 2) return IWRAP_EVENT_NONE;
+    switch (s[0]) {
+        case 'O':
+            if (strncmp(s, "OK.", 3) == 0) return IWRAP_EVENT_OK; // this one first since it happens most
+          #ifdef IWRAP_INCLUDE_RSP_AT
+            if (strncmp(s, "OK", 2) == 0) return IWRAP_EVENT_RSP_AT;
+          #endif
+            break;
+        case 'A':
+          #if defined(IWRAP_INCLUDE_EVT_A2DP_STREAMING_START) || defined(IWRAP_INCLUDE_EVT_A2DP_STREAMING_STOP)
+            if (strncmp(s, "A2DP STR", 8) == 0 && length > 17) return s[17] == 'A' ? IWRAP_EVENT_A2DP_STREAMING_START : IWRAP_EVENT_A2DP_STREAMING_STOP;
+          #endif
+            break;
+        case 'B':
+          #if defined(IWRAP_INCLUDE_EVT_BATTERY) || defined(IWRAP_INCLUDE_EVT_BATTERY_FULL) || defined(IWRAP_INCLUDE_EVT_BATTERY_LOW) || defined(IWRAP_INCLUDE_EVT_BATTERY_SHUTDOWN)
+            if (strncmp(s, "BATTERY", 7) == 0) {
+                // "BATTERY {mv}" answers the BATTERY command, the others are unsolicited
+                if (length > 8 && s[8] == 'F') return IWRAP_EVENT_BATTERY_FULL;
+                if (length > 8 && s[8] == 'L') return IWRAP_EVENT_BATTERY_LOW;
+                if (length > 8 && s[8] == 'S') return IWRAP_EVENT_BATTERY_SHUTDOWN;
+                return IWRAP_EVENT_BATTERY;
+            }
+          #endif
+          #ifdef IWRAP_INCLUDE_RSP_BER
+            if (strncmp(s, "BER ", 4) == 0) return IWRAP_EVENT_RSP_BER;
+          #endif
+            break;
+        case 'C':
+          #ifdef IWRAP_INCLUDE_RSP_CALL
+            if (strncmp(s, "CALL ", 5) == 0) return IWRAP_EVENT_RSP_CALL;
+          #endif
+          #ifdef IWRAP_INCLUDE_EVT_CONNECT
+            if (strncmp(s, "CONN", 4) == 0) return IWRAP_EVENT_CONNECT;
+          #endif
+            break;
+        case 'H':
+          #ifdef IWRAP_INCLUDE_RSP_HID_GET
+            if (strncmp(s, "HID GET ", 8) == 0) return IWRAP_EVENT_RSP_HID_GET;
+          #endif
+          #if defined(IWRAP_INCLUDE_EVT_HID_OUTPUT) || defined(IWRAP_INCLUDE_EVT_HID_SUSPEND)
+            if (strncmp(s, "HID ", 4) == 0 && s[4] < 0x40) {
+                uint16_t i;
+                for (i = 4; i < length && s[i] != ' '; i++); // skip over {link_id}
+                return (i + 1 < length && s[i + 1] == 'O') ? IWRAP_EVENT_HID_OUTPUT : IWRAP_EVENT_HID_SUSPEND;
+            }
+          #endif
+          #ifdef IWRAP_INCLUDE_EVT_HFP
+            if (strncmp(s, "HFP ", 4) == 0) return IWRAP_EVENT_HFP;
+          #endif
+          #ifdef IWRAP_INCLUDE_EVT_HFP_AG
+            if (strncmp(s, "HFP-AG ", 7) == 0) return IWRAP_EVENT_HFP_AG;
+          #endif
+            break;
+        case 'I':
+          #ifdef IWRAP_INCLUDE_EVT_IDENT
+            if (strncmp(s, "IDENT ", 6) == 0 && length > 6 && s[6] != 'E') return IWRAP_EVENT_IDENT;
+          #endif
+          #ifdef IWRAP_INCLUDE_EVT_IDENT_ERROR
+            if (strncmp(s, "IDENT ER", 8) == 0) return IWRAP_EVENT_IDENT_ERROR;
+          #endif
+          #if defined(IWRAP_INCLUDE_RSP_INQUIRY_COUNT) || defined(IWRAP_INCLUDE_RSP_INQUIRY_RESULT)
+            if (strncmp(s, "INQUIRY ", 8) == 0) return length < 13 ? IWRAP_EVENT_RSP_INQUIRY_COUNT : IWRAP_EVENT_RSP_INQUIRY_RESULT;
+          #endif
+          #ifdef IWRAP_INCLUDE_EVT_INQUIRY_EXTENDED
+            if (strncmp(s, "INQUIRY_E", 9) == 0) return IWRAP_EVENT_INQUIRY_EXTENDED;
+          #endif
+          #ifdef IWRAP_INCLUDE_EVT_INQUIRY_PARTIAL
+            if (strncmp(s, "INQUIRY_P", 9) == 0) return IWRAP_EVENT_INQUIRY_PARTIAL;
+          #endif
+            break;
+        case 'L':
+          #if defined(IWRAP_INCLUDE_RSP_LIST_COUNT) || defined(IWRAP_INCLUDE_RSP_LIST_RESULT)
+            if (strncmp(s, "LIST ", 5) == 0) return length < 10 ? IWRAP_EVENT_RSP_LIST_COUNT : IWRAP_EVENT_RSP_LIST_RESULT;
+          #endif
+            break;
+        case 'N':
+          #ifdef IWRAP_INCLUDE_EVT_NAME
+            if (strncmp(s, "NAME", 4) == 0 && length > 7 && s[7] == ':') return IWRAP_EVENT_NAME;
+          #endif
+          #ifdef IWRAP_INCLUDE_EVT_NAME_ERROR
+            if (strncmp(s, "NAME ER", 7) == 0) return IWRAP_EVENT_NAME_ERROR;
+          #endif
+          #ifdef IWRAP_INCLUDE_EVT_NO_CARRIER
+            if (strncmp(s, "NO CA", 5) == 0) return IWRAP_EVENT_NO_CARRIER;
+          #endif
+            break;
+        case 'P':
+          #if defined(IWRAP_INCLUDE_RSP_PAIR) || defined(IWRAP_INCLUDE_EVT_PAIR)
+            if (strncmp(s, "PAIR", 4) == 0) return length < 32 ? IWRAP_EVENT_RSP_PAIR : IWRAP_EVENT_PAIR;
+          #endif
+            break;
+        case 'R':
+          #ifdef IWRAP_INCLUDE_EVT_READY
+            if (strncmp(s, "READY", 5) == 0) return IWRAP_EVENT_READY;
+          #endif
+          #ifdef IWRAP_INCLUDE_EVT_RING
+            if (strncmp(s, "RING", 4) == 0) return IWRAP_EVENT_RING;
+          #endif
+          #ifdef IWRAP_INCLUDE_RSP_RSSI
+            if (strncmp(s, "RSSI ", 5) == 0) return IWRAP_EVENT_RSP_RSSI;
+          #endif
+            break;
+        case 'S':
+          #ifdef IWRAP_INCLUDE_RSP_SET
+            if (strncmp(s, "SET ", 4) == 0) return IWRAP_EVENT_RSP_SET;
+          #endif
+            if (strncmp(s, "SYN", 3) == 0) return IWRAP_EVENT_RSP_SYNTAX_ERROR;
+            break;
+        case 'T':
+          #ifdef IWRAP_INCLUDE_RSP_TEMP
+            if (strncmp(s, "TEMP ", 5) == 0) return IWRAP_EVENT_RSP_TEMP;
+          #endif
+          #ifdef IWRAP_INCLUDE_RSP_TXPOWER
+            if (strncmp(s, "TXPOWER ", 8) == 0) return IWRAP_EVENT_RSP_TXPOWER;
+          #endif
+            break;
+    }
+    return IWRAP_EVENT_NONE;
+}
+
+/**
+ * @brief Update pending command state for a classified command channel line
+ * @param type Response/event type from iwrap_classify_line()
+ * @param line Raw line received from iWRAP (not modified)
+ * @param length Length of raw line in bytes
+ * @return Response/event type to dispatch (unmatched lines become INFO output while INFO is pending)
+ */
+uint8_t iwrap_track_line(uint8_t type, const uint8_t *line, uint16_t length) {
+    uint8_t slot, known_info, j;
+    #ifdef IWRAP_INCLUDE_LATENCY
+        uint8_t i, kind;
+    #endif
+    #ifdef IWRAP_TRACK_LINKS
+        uint8_t link_id;
+        uint16_t pos;
+        uint32_t value;
+    #endif
+    #if defined(IWRAP_INCLUDE_LATENCY) || defined(IWRAP_INCLUDE_LINK_STATS)
+        iwrap_time_t now = iwrap_timestamp ? iwrap_timestamp() : 0;
+    #endif
+    #ifdef IWRAP_INCLUDE_LINK_QUALITY
+        iwrap_rsp_rssi_t rssi;
+        iwrap_rsp_txpower_t txpower;
+        iwrap_rsp_ber_t ber;
+    #endif
+
+    switch (type) {
+        case IWRAP_EVENT_OK:
+            if (iwrap_pending_commands) {
+                #ifdef IWRAP_INCLUDE_LATENCY
+                    // record round trip of completed command, if its kind and send time are known
+                    kind = iwrap_command_fifo[iwrap_command_fifo_tail];
+                    if (!(kind & IWRAP_COMMAND_FLAG_UNKNOWN)) {
+                        if (iwrap_last_command_result) iwrap_latency.syntax_errors[kind & IWRAP_COMMAND_KIND_MASK]++;
+                        // a clock assigned after sending leaves no send time to measure from
+                        if (iwrap_timestamp && (kind & IWRAP_COMMAND_FLAG_TIMED)) iwrap_histogram_record(&iwrap_latency.commands[kind & IWRAP_COMMAND_KIND_MASK], now - iwrap_command_sent[iwrap_command_fifo_tail]);
+                    }
+                #endif
+                // only the OK for the INFO command itself ends its free-form output
+                slot = iwrap_command_fifo[iwrap_command_fifo_tail];
+                if (iwrap_pending_info && (slot & IWRAP_COMMAND_FLAG_UNKNOWN)) {
+                    // INFO sent while the FIFO was full has no slot of its own, so this may
+                    // be it unless every pending INFO has a known slot further back
+                    for (known_info = 0, j = 1; j < iwrap_pending_commands && j < IWRAP_COMMAND_FIFO_SIZE; j++) {
+                        slot = iwrap_command_fifo[(iwrap_command_fifo_tail + j) & (IWRAP_COMMAND_FIFO_SIZE - 1)];
+                        if (!(slot & IWRAP_COMMAND_FLAG_UNKNOWN) && (slot & IWRAP_COMMAND_KIND_MASK) == IWRAP_COMMAND_INFO) known_info++;
+                    }
+                    if (iwrap_pending_info > known_info) iwrap_pending_info--;
+                } else if (iwrap_pending_info && (slot & IWRAP_COMMAND_KIND_MASK) == IWRAP_COMMAND_INFO) {
+                    iwrap_pending_info--;
+                }
+                iwrap_command_fifo_tail = (iwrap_command_fifo_tail + 1) & (IWRAP_COMMAND_FIFO_SIZE - 1);
+                // first command which did not fit into the FIFO now has a slot, but unknown kind
+                if (iwrap_pending_commands > IWRAP_COMMAND_FIFO_SIZE) {
+                    iwrap_command_fifo[(iwrap_command_fifo_tail + IWRAP_COMMAND_FIFO_SIZE - 1) & (IWRAP_COMMAND_FIFO_SIZE - 1)] = IWRAP_COMMAND_OTHER | IWRAP_COMMAND_FLAG_UNKNOWN;
+                }
+                iwrap_pending_commands--;
+                if (!iwrap_pending_commands) iwrap_pending_info = 0;
+            }
+            break;
+      #ifdef IWRAP_INCLUDE_LATENCY
+        case IWRAP_EVENT_RSP_CALL:
+            // CALL {link_id}: attach send time of oldest unanswered CALL to the new link
+            // a missing or out-of-range link ID still answers the CALL, but attaches no time
+            pos = 5;
+            link_id = (iwrap_scan_uint(line, length, &pos, 10, &value) || value >= IWRAP_MAX_LINKS) ? IWRAP_MAX_LINKS : value;
+            for (i = 0; i < iwrap_pending_commands && i < IWRAP_COMMAND_FIFO_SIZE; i++) {
+                kind = iwrap_command_fifo[(iwrap_command_fifo_tail + i) & (IWRAP_COMMAND_FIFO_SIZE - 1)];
+                if ((kind & ~IWRAP_COMMAND_FLAG_TIMED) == IWRAP_COMMAND_CALL) {
+                    iwrap_command_fifo[(iwrap_command_fifo_tail + i) & (IWRAP_COMMAND_FIFO_SIZE - 1)] |= IWRAP_COMMAND_FLAG_ANSWERED;
+                    if (link_id < IWRAP_MAX_LINKS && (kind & IWRAP_COMMAND_FLAG_TIMED)) {
+                        iwrap_call_sent[link_id] = iwrap_command_sent[(iwrap_command_fifo_tail + i) & (IWRAP_COMMAND_FIFO_SIZE - 1)];
+                        iwrap_call_pending[link_id] = 1;
+                    }
+                    break;
+                }
+            }
+            break;
+      #endif
+      #ifdef IWRAP_TRACK_LINKS
+        case IWRAP_EVENT_CONNECT:
+        case IWRAP_EVENT_NO_CARRIER:
+        case IWRAP_EVENT_RING:
+            // CONNECT {link_id} ... / NO CARRIER {link_id} ERROR {error_code} ... / RING {link_id} ...
+            pos = type == IWRAP_EVENT_CONNECT ? 8 : (type == IWRAP_EVENT_NO_CARRIER ? 11 : 5);
+            if (iwrap_scan_uint(line, length, &pos, 10, &value) || value >= IWRAP_MAX_LINKS) break;
+            link_id = value;
+            #ifdef IWRAP_INCLUDE_LATENCY
+                // outcome of an outgoing CALL
+                if (type != IWRAP_EVENT_RING && iwrap_call_pending[link_id]) {
+                    iwrap_call_pending[link_id] = 0;
+                    if (iwrap_timestamp) iwrap_histogram_record(type == IWRAP_EVENT_CONNECT ? &iwrap_latency.call_connect : &iwrap_latency.call_failed, now - iwrap_call_sent[link_id]);
+                }
+            #endif
+            #ifdef IWRAP_INCLUDE_LINK_STATS
+                if (type != IWRAP_EVENT_NO_CARRIER) {
+                    iwrap_link_stats_open(link_id, now);
+                } else {
+                    // error code follows the link ID directly, 0 if the line is cut short
+                    if (iwrap_scan_skip(line, length, &pos, " ERROR ") || iwrap_scan_uint(line, length, &pos, 16, &value)) value = 0;
+                    iwrap_link_stats_close(link_id, value, now);
+                }
+            #endif
+            #ifdef IWRAP_INCLUDE_REASSEMBLY
+                // partial message never continues on a new connection
+                iwrap_framers[link_id].length = 0;
+                iwrap_framers[link_id].discard = 0;
+            #endif
+            #ifdef IWRAP_INCLUDE_TX_SCHEDULER
+                // data still queued for a closed link has nowhere to go
+                if (type == IWRAP_EVENT_NO_CARRIER) iwrap_tx_sched_flush(link_id);
+            #endif
+            #ifdef IWRAP_INCLUDE_LINK_CREDITS
+                // new link starts with an empty module buffer, closed link needs no credit
+                iwrap_link_credits_reset(link_id, type == IWRAP_EVENT_NO_CARRIER ? 0 : iwrap_link_credit_window);
+            #endif
+            #ifdef IWRAP_INCLUDE_COALESCE
+                // small writes still waiting for a closed link are dropped
+                if (type == IWRAP_EVENT_NO_CARRIER) iwrap_coalescers[link_id].length = 0;
+            #endif
+            #ifdef IWRAP_INCLUDE_POWER
+                iwrap_power_link_event(link_id, type != IWRAP_EVENT_NO_CARRIER);
+            #endif
+            #ifdef IWRAP_INCLUDE_LINK_QUALITY
+                iwrap_quality_link_event(link_id, type != IWRAP_EVENT_NO_CARRIER);
+            #endif
+            break;
+      #endif
+      #ifdef IWRAP_INCLUDE_DISCOVERY
+        case IWRAP_EVENT_RSP_INQUIRY_RESULT:
+        case IWRAP_EVENT_INQUIRY_PARTIAL:
+        case IWRAP_EVENT_INQUIRY_EXTENDED:
+        case IWRAP_EVENT_NAME:
+        case IWRAP_EVENT_NAME_ERROR:
+            iwrap_discovery_line(type, line, length);
+            break;
+      #endif
+      #ifdef IWRAP_INCLUDE_LINK_QUALITY
+        // these decoders do not modify the line
+        case IWRAP_EVENT_RSP_RSSI:
+            // RSSI {bd_addr} {rssi}
+            if (!iwrap_decode_rsp_rssi((uint8_t *)line, length, &rssi)) iwrap_quality_sample(IWRAP_QUALITY_RSSI, &rssi.bd_addr, rssi.rssi);
+            break;
+        case IWRAP_EVENT_RSP_TXPOWER:
+            // TXPOWER {bd_addr} {txpower}
+            if (!iwrap_decode_rsp_txpower((uint8_t *)line, length, &txpower)) iwrap_quality_sample(IWRAP_QUALITY_TXPOWER, &txpower.bd_addr, txpower.txpower);
+            break;
+        case IWRAP_EVENT_RSP_BER:
+            // BER {bd_addr} {ber}
+            if (!iwrap_decode_rsp_ber((uint8_t *)line, length, &ber)) iwrap_quality_sample(IWRAP_QUALITY_BER, &ber.bd_addr, ber.ber);
+            break;
+      #endif
+      #if defined(IWRAP_INCLUDE_LINK_CREDITS) || defined(IWRAP_INCLUDE_POWER)
+        case IWRAP_EVENT_RSP_LIST_RESULT:
+            // LIST {link_id} CONNECTED ... {powermode} {role} {crypt} {buffer} [ERETX]
+            pos = 5;
+            if (iwrap_scan_uint(line, length, &pos, 10, &value) || value >= IWRAP_MAX_LINKS) break;
+            link_id = value;
+            #ifdef IWRAP_INCLUDE_LINK_CREDITS
+                iwrap_link_credits_list(link_id, line, length);
+            #endif
+            #ifdef IWRAP_INCLUDE_POWER
+                iwrap_power_list(link_id, line, length);
+            #endif
+            break;
+      #endif
+        case IWRAP_EVENT_READY:
+            if (iwrap_pending_boot) {
+                iwrap_pending_boot = 0;
+                iwrap_pending_commands = 0;
+                iwrap_pending_info = 0;
+            }
+            break;
+        case IWRAP_EVENT_RSP_SYNTAX_ERROR:
+            iwrap_last_command_result = 1;
+            break;
+      #ifdef IWRAP_INCLUDE_RSP_INFO
+        case IWRAP_EVENT_NONE:
+            // INFO command produces lines with various output formats
+            if (iwrap_pending_info) type = IWRAP_EVENT_RSP_INFO;
+            break;
+      #endif
+    }
+    return type;
+}
+
+/**
+ * @brief Get histogram bucket index for a value
+ * @param value Value to look up
+ * @return Bucket index (clamped to IWRAP_HISTOGRAM_BUCKETS - 1)
+ */
+uint8_t iwrap_histogram_bucket(iwrap_time_t value) {
+    uint8_t exponent = 0;
+    uint16_t index;
+    if (value < 4) return value;
+    while (value >= 8) {
+        value >>= 1;
+        exponent++;
+    }
+    index = ((exponent + 1) << 2) + (value & 3);
+    return index < IWRAP_HISTOGRAM_BUCKETS ? index : IWRAP_HISTOGRAM_BUCKETS - 1;
+}
+
+/**
+ * @brief Get smallest value counted in a histogram bucket
+ * @param index Bucket index
+ * @return Lower bound of bucket
+ */
+iwrap_time_t iwrap_histogram_bucket_floor(uint8_t index) {
+    if (index < 4) return index;
+    return (iwrap_time_t)(4 + (index & 3)) << ((index >> 2) - 1);
+}
+
+/**
+ * @brief Add one value to a histogram
+ * @param histogram Histogram to update
+ * @param value Value to record
+ */
+void iwrap_histogram_record(iwrap_histogram_t *histogram, iwrap_time_t value) {
+    if (!histogram -> count || value < histogram -> min) histogram -> min = value;
+    if (value > histogram -> max) histogram -> max = value;
+    histogram -> count++;
+    histogram -> sum += value;
+    histogram -> buckets[iwrap_histogram_bucket(value)]++;
+}
+
+/**
+ * @brief Estimate a percentile from a histogram
+ * @param histogram Histogram to read
+ * @param percent Percentile to find (0-100)
+ * @return Lower bound of the bucket containing the percentile (clamped to recorded min/max)
+ */
+iwrap_time_t iwrap_histogram_percentile(const iwrap_histogram_t *histogram, uint8_t percent) {
+    uint32_t target, seen = 0;
+    iwrap_time_t floor;
+    uint8_t i;
+    if (!histogram -> count) return 0;
+    target = (uint32_t)(((uint64_t)histogram -> count * percent + 99) / 100);
+    if (!target) target = 1;
+    for (i = 0; i < IWRAP_HISTOGRAM_BUCKETS - 1; i++) {
+        seen += histogram -> buckets[i];
+        if (seen >= target) break;
+    }
+    floor = iwrap_histogram_bucket_floor(i);
+    if (floor < histogram -> min) return histogram -> min;
+    if (floor > histogram -> max) return histogram -> max;
+    return floor;
+}
+
+/**
+ * @brief Write histogram summary and non-empty buckets as text
+ * @param histogram Histogram to dump
+ * @param name Label for the summary line
+ * @param write Text output function (e.g. same one assigned to iwrap_debug)
+ *
+ * Output format, one line per non-empty bucket after the summary:
+ *      {name} count={n} min={v} p50={v} p90={v} p99={v} max={v}
+ *          >={bucket floor} {n}
+ */
+void iwrap_histogram_dump(const iwrap_histogram_t *histogram, const char *name, int (*write)(const char *text)) {
+    static const uint8_t percents[] = { 50, 90, 99 };
+    char s[11];
+    uint8_t i;
+    write(name);
+    write(" count=");
+    iwrap_utoa(histogram -> count, s);
+    write(s);
+    write(" min=");
+    iwrap_utoa(histogram -> min, s);
+    write(s);
+    for (i = 0; i < sizeof(percents); i++) {
+        write(" p");
+        iwrap_utoa(percents[i], s);
+        write(s);
+        write("=");
+        iwrap_utoa(iwrap_histogram_percentile(histogram, percents[i]), s);
+        write(s);
+    }
+    write(" max=");
+    iwrap_utoa(histogram -> max, s);
+    write(s);
+    write("\n");
+    for (i = 0; i < IWRAP_HISTOGRAM_BUCKETS; i++) {
+        if (!histogram -> buckets[i]) continue;
+        write("    >=");
+        iwrap_utoa(iwrap_histogram_bucket_floor(i), s);
+        write(s);
+        write(" ");
+        iwrap_utoa(histogram -> buckets[i], s);
+        write(s);
+        write("\n");
+    }
+}
+
+#ifdef IWRAP_INCLUDE_LATENCY
+    /**
+     * @brief Write all non-empty command latency histograms as text (microseconds)
+     * @param write Text output function (e.g. same one assigned to iwrap_debug)
+     */
+    void iwrap_latency_dump(int (*write)(const char *text)) {
+        char s[11];
+        uint8_t kind;
+        for (kind = 0; kind < IWRAP_COMMAND_COUNT; kind++) {
+            if (!iwrap_latency.commands[kind].count && !iwrap_latency.syntax_errors[kind]) continue;
+            iwrap_histogram_dump(&iwrap_latency.commands[kind], kind ? iwrap_command_names[kind] : "OTHER", write);
+            if (iwrap_latency.syntax_errors[kind]) {
+                write("    syntax_errors ");
+                iwrap_utoa(iwrap_latency.syntax_errors[kind], s);
+                write(s);
+                write("\n");
+            }
+        }
+        if (iwrap_latency.call_connect.count) iwrap_histogram_dump(&iwrap_latency.call_connect, "CALL->CONNECT", write);
+        if (iwrap_latency.call_failed.count) iwrap_histogram_dump(&iwrap_latency.call_failed, "CALL->NO_CARRIER", write);
+    }
+
+    /**
+     * @brief Clear all command latency histograms
+     */
+    void iwrap_latency_reset() {
+        memset(&iwrap_latency, 0, sizeof(iwrap_latency_t));
+    }
+#endif /* IWRAP_INCLUDE_LATENCY */
+
+#ifdef IWRAP_INCLUDE_PROFILE
+    /**
+     * @brief Write callback dispatch time histograms as text (only event types seen so far)
+     * @param write Output function for each text fragment
+     */
+    void iwrap_profile_dump(int (*write)(const char *text)) {
+        char s[11];
+        uint8_t i;
+        for (i = 0; i < IWRAP_EVENT_COUNT; i++) {
+            if (iwrap_profile.events[i].count) iwrap_histogram_dump(&iwrap_profile.events[i], iwrap_event_names[i], write);
+        }
+        if (iwrap_profile.rxdata.count) iwrap_histogram_dump(&iwrap_profile.rxdata, "RXDATA", write);
+        write("slow ");
+        iwrap_utoa(iwrap_profile.slow, s);
+        write(s);
+        write("\n");
+    }
+
+    /**
+     * @brief Clear callback dispatch time histograms (call from same context as iwrap_parse())
+     */
+    void iwrap_profile_reset() {
+        memset(&iwrap_profile, 0, sizeof(iwrap_profile_t));
+    }
+#endif /* IWRAP_INCLUDE_PROFILE */
+
+#ifdef IWRAP_INCLUDE_REASSEMBLY
+    /**
+     * @brief Configure message reassembly for a link
+     * @param link_id Link ID
+     * @param type Framer type (IWRAP_FRAMER_*)
+     * @param size Length prefix size in bytes (1-4, LENGTH) or message size (FIXED)
+     * @param delimiter End of message byte (DELIMITER)
+     * @param buffer Storage for messages split across frames (may be 0 if messages never span frames)
+     * @param capacity Size of buffer in bytes
+     * @return Result code (non-zero indicates error)
+     */
+    uint8_t iwrap_framer_setup(uint8_t link_id, uint8_t type, uint16_t size, uint8_t delimiter, uint8_t *buffer, uint16_t capacity) {
+        iwrap_framer_t *framer;
+        if (link_id >= IWRAP_MAX_LINKS || type > IWRAP_FRAMER_FIXED) return 1;
+        if ((type == IWRAP_FRAMER_LENGTH && (size < 1 || size > 4)) || (type == IWRAP_FRAMER_FIXED && !size)) return 1;
+        framer = &iwrap_framers[link_id];
+        memset(framer, 0, sizeof(iwrap_framer_t));
+        framer -> type = type;
+        framer -> size = size;
+        framer -> delimiter = delimiter;
+        framer -> buffer = buffer;
+        framer -> capacity = buffer ? capacity : 0;
+        return 0;
+    }
+
+    /**
+     * @brief Get full length of the message starting at data (incl. prefix/delimiter)
+     * @param framer Framer configuration
+     * @param data Start of message
+     * @param length Bytes available
+     * @return Message length (may be more than available), or 0 if not known yet
+     */
+    uint32_t iwrap_framer_measure(const iwrap_framer_t *framer, const uint8_t *data, uint16_t length) {
+        const uint8_t *end;
+        uint32_t total = 0;
+        uint8_t i;
+        switch (framer -> type) {
+            case IWRAP_FRAMER_LENGTH:
+                if (length < framer -> size) return 0;
+                for (i = 0; i < framer -> size; i++) total = (total << 8) | data[i];
+                return total + framer -> size;
+            case IWRAP_FRAMER_DELIMITER:
+                end = (const uint8_t *)memchr(data, framer -> delimiter, length);
+                return end ? (end - data) + 1 : 0;
+            case IWRAP_FRAMER_FIXED:
+                return framer -> size;
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Deliver complete message to iwrap_callback_rxmessage without its length prefix or delimiter
+     * @param link_id Link ID
+     * @param framer Framer configuration
+     * @param message Complete message incl. prefix/delimiter
+     * @param length Full message length
+     */
+    void iwrap_framer_deliver(uint8_t link_id, const iwrap_framer_t *framer, const uint8_t *message, uint16_t length) {
+        if (!iwrap_callback_rxmessage) return;
+        if (framer -> type == IWRAP_FRAMER_LENGTH) {
+            message += framer -> size;
+            length -= framer -> size;
+        } else if (framer -> type == IWRAP_FRAMER_DELIMITER) {
+            length--;
+        }
+        iwrap_callback_rxmessage(link_id, length, message);
+    }
+
+    /**
+     * @brief Feed received link data into its framer, delivering each complete message to iwrap_callback_rxmessage
+     * @param link_id Link ID
+     * @param length Length of received data
+     * @param data Received data
+     *
+     * Messages entirely inside data are delivered in place; only messages
+     * split across frames are copied into the framer's buffer. Messages
+     * larger than the buffer which span frames are dropped and counted.
+     */
+    void iwrap_framer_input(uint8_t link_id, uint16_t length, const uint8_t *data) {
+        iwrap_framer_t *framer = &iwrap_framers[link_id];
+        const uint8_t *end;
+        uint32_t total;
+        uint16_t take;
+
+        if (framer -> type == IWRAP_FRAMER_NONE) return;
+
+        while (length) {
+            // drop rest of oversized message
+            if (framer -> discard) {
+                if (framer -> discard == 0xFFFFFFFF) {
+                    end = (const uint8_t *)memchr(data, framer -> delimiter, length);
+                    take = end ? (end - data) + 1 : length;
+                    if (end) framer -> discard = 0;
+                } else {
+                    take = framer -> discard < length ? framer -> discard : length;
+                    framer -> discard -= take;
+                }
+                data += take;
+                length -= take;
+                continue;
+            }
+
+            // zero-copy fast path: whole message available in this frame
+            if (!framer -> length) {
+                total = iwrap_framer_measure(framer, data, length);
+                if (total && total <= length) {
+                    iwrap_framer_deliver(link_id, framer, data, total);
+                    data += total;
+                    length -= total;
+                    continue;
+                }
+            }
+
+            // work out how much of this frame belongs to the buffered message
+            if (framer -> type == IWRAP_FRAMER_DELIMITER) {
+                end = (const uint8_t *)memchr(data, framer -> delimiter, length);
+                total = end ? framer -> length + (end - data) + 1 : 0;
+                take = end ? (end - data) + 1 : length;
+            } else {
+                total = iwrap_framer_measure(framer, framer -> buffer, framer -> length);
+                if (!total) {
+                    // only complete length prefix for now
+                    take = framer -> size - framer -> length;
+                    if (take > length) take = length;
+                } else {
+                    take = total - framer -> length < length ? total - framer -> length : length;
+                }
+            }
+
+            if ((uint32_t)framer -> length + take > framer -> capacity || total > framer -> capacity) {
+                // message does not fit, drop it
+                framer -> overflows++;
+                if (framer -> type == IWRAP_FRAMER_DELIMITER) {
+                    framer -> discard = end ? 0 : 0xFFFFFFFF;
+                    take = end ? take : length;
+                } else if (total) {
+                    framer -> discard = total - framer -> length - take;
+                } else {
+                    // prefix itself does not fit (tiny buffer), nothing sensible to do but drop frame
+                    take = length;
+                }
+                framer -> length = 0;
+                data += take;
+                length -= take;
+                continue;
+            }
+
+            memcpy(framer -> buffer + framer -> length, data, take);
+            framer -> length += take;
+            data += take;
+            length -= take;
+
+            if (total && framer -> length == total) {
+                iwrap_framer_deliver(link_id, framer, framer -> buffer, framer -> length);
+                framer -> length = 0;
+            }
+        }
+    }
+#endif /* IWRAP_INCLUDE_REASSEMBLY */
+
+#ifdef IWRAP_INCLUDE_TX_SCHEDULER
+    /**
+     * @brief Attach TX queue to a link or the command channel, with its scheduling parameters
+     * @param channel Link ID, or 0xFF for the command channel
+     * @param buffer Queue storage
+     * @param size Size of storage in bytes (at most 65535), 0 to detach
+     * @param weight Share of bandwidth relative to other links (ignored for command channel)
+     * @param rate Maximum link throughput in bytes/s, 0 for no cap (ignored for command channel, needs iwrap_timestamp)
+     * @return Result code (non-zero indicates error)
+     *
+     * Call while nothing is queued for the channel; the queue is emptied.
+     */
+    uint8_t iwrap_tx_sched_setup(uint8_t channel, uint8_t *buffer, uint16_t size, uint8_t weight, uint32_t rate) {
+        iwrap_tx_flow_t *flow;
+        if ((channel >= IWRAP_MAX_LINKS && channel != 0xFF) || (size && !buffer)) return 1;
+        flow = &iwrap_tx_scheduler.flows[channel == 0xFF ? IWRAP_MAX_LINKS : channel];
+        memset(flow, 0, sizeof(iwrap_tx_flow_t));
+        flow -> buffer = buffer;
+        flow -> size = size;
+        if (channel != 0xFF) {
+            flow -> weight = weight;
+            flow -> rate = rate;
+            flow -> tokens = IWRAP_TX_SCHED_BURST;
+            if (iwrap_timestamp) flow -> refilled = iwrap_timestamp();
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Reserve room for one frame at the end of a TX flow
+     * @param flow Flow to append to
+     * @param length Payload length
+     * @param mode Sending mode stored with the frame
+     * @return Pointer to payload storage, or 0 if frame does not fit
+     *
+     * Frames are stored contiguously; if one does not fit before the end of
+     * the buffer, the rest of the buffer is skipped and it goes to the start.
+     */
+    uint8_t *iwrap_tx_flow_reserve(iwrap_tx_flow_t *flow, uint16_t length, uint8_t mode) {
+        uint16_t need = length + IWRAP_TX_FLOW_HEADER, position;
+        if (!flow -> used) flow -> head = flow -> tail = 0;
+        if (flow -> tail > flow -> head || !flow -> used) {
+            if (flow -> size - flow -> tail >= need) {
+                position = flow -> tail;
+            } else if (flow -> head >= need) {
+                // skip to start, marking the gap if a header fits there
+                if (flow -> size - flow -> tail >= IWRAP_TX_FLOW_HEADER) flow -> buffer[flow -> tail] = flow -> buffer[flow -> tail + 1] = 0xFF;
+                flow -> used += flow -> size - flow -> tail;
+                position = 0;
+            } else {
+                return 0;
+            }
+        } else if (flow -> head - flow -> tail >= need) {
+            position = flow -> tail;
+        } else {
+            return 0;
+        }
+        flow -> buffer[position] = length & 0xFF;
+        flow -> buffer[position + 1] = length >> 8;
+        flow -> buffer[position + 2] = mode;
+        flow -> tail = position + need;
+        flow -> used += need;
+        return flow -> buffer + position + IWRAP_TX_FLOW_HEADER;
+    }
+
+    /**
+     * @brief Get oldest frame queued in a TX flow
+     * @param flow Flow to look at
+     * @return Pointer to frame header (length, mode, payload), or 0 if flow is empty
+     */
+    uint8_t *iwrap_tx_flow_head(iwrap_tx_flow_t *flow) {
+        if (!flow -> used) return 0;
+        if (flow -> size - flow -> head < IWRAP_TX_FLOW_HEADER || (flow -> buffer[flow -> head] == 0xFF && flow -> buffer[flow -> head + 1] == 0xFF)) {
+            // skipped end of buffer
+            flow -> used -= flow -> size - flow -> head;
+            flow -> head = 0;
+        }
+        return flow -> buffer + flow -> head;
+    }
+
+    /**
+     * @brief Queue command; it is sent by iwrap_tx_sched_run() before any queued data
+     * @param cmd Command to send, in ASCII format (no line endings)
+     * @param mode Sending mode (MUX or non-MUX)
+     * @return Result code (non-zero indicates error, 1 = queue full or not set up)
+     */
+    uint8_t iwrap_tx_sched_command(const char *cmd, uint8_t mode) {
+        iwrap_tx_flow_t *flow = &iwrap_tx_scheduler.flows[IWRAP_MAX_LINKS];
+        uint16_t length = strlen(cmd) + 1;
+        uint8_t *payload;
+        if (length > IWRAP_MUX_MAX_PAYLOAD + 1) return 2;
+        if (!(payload = iwrap_tx_flow_reserve(flow, length, mode))) {
+            flow -> rejected++;
+            return 1;
+        }
+        memcpy(payload, cmd, length);
+        return 0;
+    }
+
+    /**
+     * @brief Queue data for a link; it is sent by iwrap_tx_sched_run() in the link's fair share
+     * @param channel Link ID to which to send data
+     * @param data_len Length of data (any size that fits the link's queue)
+     * @param data Data to send (copied, may be reused on return)
+     * @param mode Sending mode (MUX or non-MUX)
+     * @return Result code (non-zero indicates error, 1 = queue full or not set up)
+     *
+     * Data is split like iwrap_send_data() and queued entirely or not at all.
+     */
+    uint8_t iwrap_tx_sched_data(uint8_t channel, uint32_t data_len, const uint8_t *data, uint8_t mode) {
+        iwrap_tx_flow_t *flow;
+        uint16_t segment, max_segment = IWRAP_MUX_MAX_PAYLOAD, tail, used;
+        uint8_t *payload;
+
+        if (channel >= IWRAP_MAX_LINKS) return 1;
+        flow = &iwrap_tx_scheduler.flows[channel];
+        if (iwrap_link_mtu[channel] && iwrap_link_mtu[channel] < IWRAP_MUX_MAX_PAYLOAD) max_segment = iwrap_link_mtu[channel];
+        if (!flow -> used) flow -> head = flow -> tail = 0;
+        tail = flow -> tail;
+        used = flow -> used;
+        do {
+            segment = data_len > max_segment ? max_segment : data_len;
+            if (!(payload = iwrap_tx_flow_reserve(flow, segment, mode))) {
+                // undo segments queued so far
+                flow -> tail = tail;
+                flow -> used = used;
+                flow -> rejected++;
+                return 1;
+            }
+            memcpy(payload, data, segment);
+            data += segment;
+            data_len -= segment;
+        } while (data_len);
+        return 0;
+    }
+
+    /**
+     * @brief Drop everything queued for a link (called on NO CARRIER)
+     * @param channel Link ID, or 0xFF for the command channel
+     */
+    void iwrap_tx_sched_flush(uint8_t channel) {
+        iwrap_tx_flow_t *flow = &iwrap_tx_scheduler.flows[channel == 0xFF ? IWRAP_MAX_LINKS : channel];
+        flow -> head = flow -> tail = flow -> used = 0;
+        flow -> deficit = 0;
+        flow -> visiting = 0;
+    }
+
+    /**
+     * @brief Send queued frames: all commands first, then data links by deficit round robin
+     * @param budget Maximum payload bytes to send in this call (e.g. free space in UART FIFO), 0 for no limit
+     * @return Payload bytes sent
+     *
+     * Each round, a link may send up to weight * IWRAP_TX_SCHED_QUANTUM bytes
+     * and no more than its rate cap (and send credit) allows. Frames are never split, so a
+     * call stops at the first frame which exceeds the remaining budget;
+     * commands queued meanwhile go out at the start of the next call, so
+     * they never wait behind more than one budget of data.
+     */
+    uint32_t iwrap_tx_sched_run(uint32_t budget) {
+        iwrap_tx_flow_t *flow = &iwrap_tx_scheduler.flows[IWRAP_MAX_LINKS];
+        iwrap_time_t now = iwrap_timestamp ? iwrap_timestamp() : 0;
+        uint32_t sent = 0, refill;
+        uint16_t length;
+        uint8_t *frame, channel, idle = 0, waiting = 0;
+
+        // command channel is served first, strictly in order
+        while ((frame = iwrap_tx_flow_head(flow))) {
+            length = frame[0] | (frame[1] << 8);
+            if (budget && sent + length - 1 > budget) return sent;
+            iwrap_send_command((const char *)frame + IWRAP_TX_FLOW_HEADER, frame[2]);
+            flow -> head += length + IWRAP_TX_FLOW_HEADER;
+            flow -> used -= length + IWRAP_TX_FLOW_HEADER;
+            flow -> frames++;
+            flow -> bytes += length - 1;
+            sent += length - 1;
+        }
+
+        // data links, resuming where the last call stopped; give up after a whole round with nothing sendable
+        while (idle < IWRAP_MAX_LINKS) {
+            channel = iwrap_tx_scheduler.current;
+            flow = &iwrap_tx_scheduler.flows[channel];
+            if ((frame = iwrap_tx_flow_head(flow))) {
+                if (flow -> rate && iwrap_timestamp) {
+                    // token bucket; only whole bytes are taken off the elapsed time
+                    refill = (uint64_t)(now - flow -> refilled) * flow -> rate / IWRAP_TIME_RATE;
+                    if (refill) {
+                        flow -> refilled += (uint64_t)refill * IWRAP_TIME_RATE / flow -> rate;
+                        flow -> tokens = flow -> tokens + refill > IWRAP_TX_SCHED_BURST ? IWRAP_TX_SCHED_BURST : flow -> tokens + refill;
+                    }
+                }
+                if (!flow -> visiting) {
+                    flow -> deficit += (int32_t)(flow -> weight ? flow -> weight : 1) * IWRAP_TX_SCHED_QUANTUM;
+                    flow -> visiting = 1;
+                }
+                waiting = 0;
+                while (frame) {
+                    length = frame[0] | (frame[1] << 8);
+                    if (length > flow -> deficit) break;
+                    if (flow -> rate && iwrap_timestamp && length > flow -> tokens) {
+                        flow -> capped++;
+                        waiting = 1;
+                        break;
+                    }
+                    #ifdef IWRAP_INCLUDE_LINK_CREDITS
+                        if (iwrap_link_credits[channel].window && length > iwrap_link_credits[channel].credits) {
+                            iwrap_link_credits_stall(channel);
+                            waiting = 1;
+                            break;
+                        }
+                    #endif
+                    if (budget && sent + length > budget) return sent;
+                    iwrap_send_segment(channel, length, frame + IWRAP_TX_FLOW_HEADER, frame[2]);
+                    flow -> head += length + IWRAP_TX_FLOW_HEADER;
+                    flow -> used -= length + IWRAP_TX_FLOW_HEADER;
+                    flow -> deficit -= length;
+                    if (flow -> rate && iwrap_timestamp) flow -> tokens -= length;
+                    flow -> frames++;
+                    flow -> bytes += length;
+                    sent += length;
+                    frame = iwrap_tx_flow_head(flow);
+                }
+                // a link held back by its rate cap keeps its grant instead of piling up quanta
+                flow -> visiting = waiting;
+                if (!frame) flow -> deficit = 0;
+            }
+            // a frame larger than the remaining deficit goes out after enough rounds, so keep going
+            idle = frame && !waiting ? 0 : idle + 1;
+            iwrap_tx_scheduler.current = (channel + 1) % IWRAP_MAX_LINKS;
+        }
+        return sent;
+    }
+#endif /* IWRAP_INCLUDE_TX_SCHEDULER */
+
+#ifdef IWRAP_INCLUDE_POWER
+    /**
+     * @brief Record a power mode change of a link (own request or module report)
+     * @param link_id Link ID
+     * @param powermode New mode (IWRAP_CONNECTION_POWERMODE_*, 0 = unknown)
+     */
+    void iwrap_power_set_mode(uint8_t link_id, uint8_t powermode) {
+        iwrap_power_link_t *link = &iwrap_power_links[link_id];
+        iwrap_time_t now;
+        if (link -> mode == powermode) return;
+        if (iwrap_timestamp) {
+            now = iwrap_timestamp();
+            if (link -> mode) link -> time_in[link -> mode] += now - link -> accounted;
+            link -> accounted = link -> entered = now;
+        }
+        link -> mode = powermode;
+        link -> transitions[powermode]++;
+        if (iwrap_callback_power) iwrap_callback_power(link_id, powermode);
+    }
+
+    /**
+     * @brief Start or stop tracking a link's power mode (called on CONNECT/RING/NO CARRIER)
+     * @param link_id Link ID
+     * @param connected Non-zero if link came up
+     *
+     * New links are active. Time in mode and transitions add up across connections.
+     */
+    void iwrap_power_link_event(uint8_t link_id, uint8_t connected) {
+        iwrap_power_link_t *link = &iwrap_power_links[link_id];
+        iwrap_power_set_mode(link_id, connected ? IWRAP_CONNECTION_POWERMODE_ACTIVE : 0);
+        link -> connected = connected;
+        link -> managed = connected && iwrap_power_manage;
+        link -> burst = 0;
+        if (iwrap_timestamp) link -> last_traffic = link -> burst_start = iwrap_timestamp();
+    }
+
+    /**
+     * @brief Take power mode from a LIST result (corrects mode assumed after SNIFF/ACTIVE)
+     * @param link_id Link ID
+     * @param line LIST result line (not modified, need not be null terminated)
+     * @param length Length of line
+     */
+    void iwrap_power_list(uint8_t link_id, const uint8_t *line, uint16_t length) {
+        uint16_t start, end = length;
+        uint8_t field = 0;
+
+        // {powermode} is the fourth field from the end, before {role} {crypt} {buffer} [ERETX]
+        for (;;) {
+            while (end && (line[end - 1] == ' ' || line[end - 1] == '\r' || line[end - 1] == '\n')) end--;
+            for (start = end; start && line[start - 1] != ' '; start--);
+            if (start == end) return;
+            if (!field && end - start == 5 && !memcmp(line + start, "ERETX", 5)) {
+                end = start;
+                continue;
+            }
+            if (++field == 4) break;
+            end = start;
+        }
+        if (end - start == 6 && !memcmp(line + start, "ACTIVE", 6)) iwrap_power_set_mode(link_id, IWRAP_CONNECTION_POWERMODE_ACTIVE);
+        else if (end - start == 5 && !memcmp(line + start, "SNIFF", 5)) iwrap_power_set_mode(link_id, IWRAP_CONNECTION_POWERMODE_SNIFF);
+        else if (end - start == 4 && !memcmp(line + start, "HOLD", 4)) iwrap_power_set_mode(link_id, IWRAP_CONNECTION_POWERMODE_HOLD);
+        else if (end - start == 4 && !memcmp(line + start, "PARK", 4)) iwrap_power_set_mode(link_id, IWRAP_CONNECTION_POWERMODE_PARK);
+    }
+
+    /**
+     * @brief Note data moved on a link (both directions)
+     * @param link_id Link ID
+     * @param length Bytes moved
+     */
+    void iwrap_power_traffic(uint8_t link_id, uint16_t length) {
+        iwrap_power_link_t *link = &iwrap_power_links[link_id];
+        iwrap_time_t now;
+        if (!iwrap_timestamp) return;
+        now = iwrap_timestamp();
+        if (now - link -> burst_start >= iwrap_power_window) {
+            link -> burst = 0;
+            link -> burst_start = now;
+        }
+        link -> burst = (uint32_t)link -> burst + length > 0xFFFF ? 0xFFFF : link -> burst + length;
+        link -> last_traffic = now;
+    }
+
+    /**
+     * @brief Move managed links between sniff and active mode as their traffic requires (call periodically)
+     * @param mode Sending mode (MUX or non-MUX)
+     * @return Result code (non-zero if a SNIFF/ACTIVE command could not be sent)
+     *
+     * A sniffing link goes active when iwrap_power_wake_bytes move within
+     * iwrap_power_window, or data is waiting to be sent to it; an active
+     * link goes to sniff after iwrap_power_idle without traffic, with a
+     * sniff interval of iwrap_power_latency so a burst starting in sniff
+     * is delayed no more than that. Neither happens within
+     * iwrap_power_dwell of the last change, so bursty links do not flap.
+     * Needs iwrap_timestamp.
+     */
+    uint8_t iwrap_power_poll(uint8_t mode) {
+        iwrap_power_link_t *link;
+        iwrap_time_t now;
+        uint32_t slots;
+        uint8_t i, waiting, result = 0;
+
+        if (!iwrap_timestamp) return 0;
+        now = iwrap_timestamp();
+        for (i = 0; i < IWRAP_MAX_LINKS; i++) {
+            link = &iwrap_power_links[i];
+            if (!link -> connected) continue;
+            if (link -> mode) {
+                link -> time_in[link -> mode] += now - link -> accounted;
+                link -> accounted = now;
+            }
+            if (!link -> managed || now - link -> entered < iwrap_power_dwell) continue;
+
+            waiting = 0;
+            #ifdef IWRAP_INCLUDE_TX_SCHEDULER
+                if (iwrap_tx_scheduler.flows[i].used) waiting = 1;
+            #endif
+            #ifdef IWRAP_INCLUDE_COALESCE
+                if (iwrap_coalescers[i].length) waiting = 1;
+            #endif
+            if (now - link -> burst_start >= iwrap_power_window) link -> burst = 0;
+
+            if (link -> mode != IWRAP_CONNECTION_POWERMODE_ACTIVE && (waiting || link -> burst >= iwrap_power_wake_bytes)) {
+                if (iwrap_cmd_active(i, mode)) result = 1;
+                else iwrap_power_set_mode(i, IWRAP_CONNECTION_POWERMODE_ACTIVE);
+            } else if (link -> mode == IWRAP_CONNECTION_POWERMODE_ACTIVE && !waiting && now - link -> last_traffic >= iwrap_power_idle) {
+                // latency target in 0.625 ms slots, even and within 2..0xFFFE
+                slots = (uint32_t)((uint64_t)iwrap_power_latency * 1600 / IWRAP_TIME_RATE) & ~1UL;
+                if (slots < 2) slots = 2;
+                if (slots > 0xFFFE) slots = 0xFFFE;
+                if (iwrap_cmd_sniff(i, slots, slots / 2 < 2 ? 2 : (slots / 2) & ~1U, 1, 8, mode)) result = 1;
+                else iwrap_power_set_mode(i, IWRAP_CONNECTION_POWERMODE_SNIFF);
+            }
+        }
+        return result;
+    }
+
+    /**
+     * @brief Write time in each power mode and transition counts of each link as text
+     * @param write Output function for each text fragment
+     */
+    void iwrap_power_dump(int (*write)(const char *text)) {
+        static const char *names[5] = { "unknown", "active", "hold", "sniff", "park" };
+        char s[11];
+        uint8_t i, m;
+        for (i = 0; i < IWRAP_MAX_LINKS; i++) {
+            if (!iwrap_power_links[i].transitions[IWRAP_CONNECTION_POWERMODE_ACTIVE]) continue;
+            write("LINK ");
+            iwrap_utoa(i, s);
+            write(s);
+            write(iwrap_power_links[i].connected ? " " : " (closed) ");
+            write(names[iwrap_power_links[i].mode]);
+            write("\n");
+            for (m = 1; m < 5; m++) {
+                if (!iwrap_power_links[i].transitions[m]) continue;
+                write("    ");
+                write(names[m]);
+                write(" entered ");
+                iwrap_utoa(iwrap_power_links[i].transitions[m], s);
+                write(s);
+                write(" time ");
+                iwrap_utoa(iwrap_power_links[i].time_in[m], s);
+                write(s);
+                write("\n");
+            }
+        }
+    }
+#endif /* IWRAP_INCLUDE_POWER */
+
+#ifdef IWRAP_INCLUDE_LINK_QUALITY
+    /**
+     * @brief Start or stop polling a link's quality (called on CONNECT/RING/NO CARRIER)
+     * @param link_id Link ID
+     * @param connected Non-zero if link came up
+     *
+     * Samples of a closed link are kept until the link ID is used again.
+     */
+    void iwrap_quality_link_event(uint8_t link_id, uint8_t connected) {
+        iwrap_quality_link_t *link = &iwrap_quality_links[link_id];
+        if (connected) memset(link, 0, sizeof(iwrap_quality_link_t));
+        link -> connected = connected;
+    }
+
+    /**
+     * @brief Add a RSSI/TXPOWER/BER answer to the series of the link it belongs to
+     * @param metric Metric (IWRAP_QUALITY_*)
+     * @param address Remote address from the answer
+     * @param value Sample value
+     *
+     * The module answers with the remote address instead of the link ID, so
+     * the oldest unanswered poll of the same metric claims the sample (and
+     * teaches its link the address); answers to commands sent by the
+     * application are matched by address alone.
+     */
+    void iwrap_quality_sample(uint8_t metric, const iwrap_address_t *address, int32_t value) {
+        iwrap_quality_link_t *link = 0;
+        iwrap_quality_series_t *series;
+        uint8_t i, link_id = 0;
+
+        for (i = 0; i < iwrap_quality_requested; i++) {
+            if (iwrap_quality_requests[i] % IWRAP_QUALITY_METRICS != metric) continue;
+            link_id = iwrap_quality_requests[i] / IWRAP_QUALITY_METRICS;
+            link = &iwrap_quality_links[link_id];
+            if (link -> has_address && memcmp(link -> address.address, address -> address, 6)) {
+                link = 0;
+                continue;
+            }
+            iwrap_quality_requested--;
+            memmove(&iwrap_quality_requests[i], &iwrap_quality_requests[i + 1], (iwrap_quality_requested - i) * sizeof(uint16_t));
+            break;
+        }
+        for (i = 0; !link && i < IWRAP_MAX_LINKS; i++) {
+            if (iwrap_quality_links[i].has_address && !memcmp(iwrap_quality_links[i].address.address, address -> address, 6)) {
+                link_id = i;
+                link = &iwrap_quality_links[i];
+            }
+        }
+        if (!link || !link -> connected) return;
+        if (!link -> has_address) {
+            memcpy(&link -> address, address, sizeof(iwrap_address_t));
+            link -> has_address = 1;
+        }
+
+        series = &link -> series[metric];
+        series -> values[series -> head] = value;
+        series -> times[series -> head] = iwrap_timestamp ? iwrap_timestamp() : 0;
+        series -> head = (series -> head + 1) & (IWRAP_QUALITY_SAMPLES - 1);
+        if (series -> count < IWRAP_QUALITY_SAMPLES) series -> count++;
+        if (!series -> samples++) {
+            series -> min = series -> max = value;
+            series -> ewma = value * 256;
+        } else {
+            if (value < series -> min) series -> min = value;
+            if (value > series -> max) series -> max = value;
+            series -> ewma += (value * 256 - series -> ewma) / (1 << IWRAP_QUALITY_SHIFT);
+        }
+        if (iwrap_callback_quality) iwrap_callback_quality(link_id, metric, value);
+    }
+
+    /**
+     * @brief Poll RSSI/TXPOWER/BER of connected links (call periodically)
+     * @param mode Sending mode (MUX or non-MUX)
+     * @return Result code (non-zero if a command could not be sent)
+     *
+     * A round polls every metric in iwrap_quality_metrics on every
+     * connected link, and starts iwrap_quality_interval after the previous
+     * one started. Each call sends at most iwrap_quality_batch commands,
+     * and only while fewer than IWRAP_QUALITY_PENDING commands (the
+     * application's included) are unanswered and no commands are waiting
+     * in the scheduler queue, so polling never piles up on the command
+     * channel. A round that runs long just delays the next one. Needs
+     * iwrap_timestamp.
+     */
+    uint8_t iwrap_quality_poll(uint8_t mode) {
+        iwrap_time_t now;
+        uint8_t link_id, metric, sent = 0, result;
+
+        if (!iwrap_timestamp || !iwrap_quality_metrics) return 0;
+        now = iwrap_timestamp();
+        // every earlier poll has been answered or failed
+        if (!iwrap_pending_commands) iwrap_quality_requested = 0;
+        if (iwrap_quality_cursor >= IWRAP_MAX_LINKS * IWRAP_QUALITY_METRICS) {
+            if (now - iwrap_quality_round_start < iwrap_quality_interval) return 0;
+            iwrap_quality_round_start = now;
+            iwrap_quality_cursor = 0;
+        }
+
+        while (sent < iwrap_quality_batch && iwrap_quality_cursor < IWRAP_MAX_LINKS * IWRAP_QUALITY_METRICS) {
+            link_id = iwrap_quality_cursor / IWRAP_QUALITY_METRICS;
+            metric = iwrap_quality_cursor % IWRAP_QUALITY_METRICS;
+            if (!iwrap_quality_links[link_id].connected || !(iwrap_quality_metrics & (1 << metric))) {
+                iwrap_quality_cursor++;
+                continue;
+            }
+            if (iwrap_pending_commands >= IWRAP_QUALITY_PENDING || iwrap_quality_requested >= IWRAP_QUALITY_PENDING) break;
+            #ifdef IWRAP_INCLUDE_TX_SCHEDULER
+                if (iwrap_tx_scheduler.flows[IWRAP_MAX_LINKS].used) break;
+            #endif
+            if (metric == IWRAP_QUALITY_RSSI) result = iwrap_cmd_rssi(link_id, mode);
+            else if (metric == IWRAP_QUALITY_TXPOWER) result = iwrap_cmd_txpower(link_id, mode);
+            else result = iwrap_cmd_ber(link_id, mode);
+            if (result) return result;
+            iwrap_quality_requests[iwrap_quality_requested++] = iwrap_quality_cursor++;
+            sent++;
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Write latest, lowest, highest and average value of each link's metrics as text
+     * @param write Output function for each text fragment
+     */
+    void iwrap_quality_dump(int (*write)(const char *text)) {
+        static const char *names[IWRAP_QUALITY_METRICS] = { "rssi", "txpower", "ber" };
+        const iwrap_quality_series_t *series;
+        int32_t values[4];
+        char s[12];
+        uint8_t i, m, v;
+        for (i = 0; i < IWRAP_MAX_LINKS; i++) {
+            for (m = 0; m < IWRAP_QUALITY_METRICS; m++) {
+                series = &iwrap_quality_links[i].series[m];
+                if (!series -> samples) continue;
+                values[0] = series -> values[(series -> head - 1) & (IWRAP_QUALITY_SAMPLES - 1)];
+                values[1] = series -> min;
+                values[2] = series -> max;
+                values[3] = series -> ewma / 256;
+                write("LINK ");
+                iwrap_utoa(i, s);
+                write(s);
+                write(" ");
+                write(names[m]);
+                for (v = 0; v < 4; v++) {
+                    write(v == 0 ? " last " : (v == 1 ? " min " : (v == 2 ? " max " : " avg ")));
+                    if (values[v] < 0) {
+                        s[0] = '-';
+                        iwrap_utoa(-values[v], s + 1);
+                    } else {
+                        iwrap_utoa(values[v], s);
+                    }
+                    write(s);
+                }
+                write(" samples ");
+                iwrap_utoa(series -> samples, s);
+                write(s);
+                write("\n");
+            }
+        }
+    }
+#endif /* IWRAP_INCLUDE_LINK_QUALITY */
+
+#ifdef IWRAP_INCLUDE_DISCOVERY
+    /**
+     * @brief Get home slot of an address in the discovery cache
+     * @param address Device address
+     * @return Slot index (0 to IWRAP_DISCOVERY_SIZE - 1)
+     */
+    uint16_t iwrap_discovery_hash(const iwrap_address_t *address) {
+        const uint8_t *a = address -> address;
+        // low bytes differ most between devices, vendor bytes are folded in
+        uint32_t h = (((uint32_t)a[2] << 24) | ((uint32_t)a[3] << 16) | ((uint32_t)a[4] << 8) | a[5]) ^ (((uint32_t)a[0] << 8) | a[1]);
+        return (uint16_t)((uint32_t)(h * 2654435761UL) >> 16) & (IWRAP_DISCOVERY_SIZE - 1);
+    }
+
+    /**
+     * @brief Look up a device in the discovery cache
+     * @param address Device address
+     * @return Device record (valid until the cache next changes), or 0 if not cached
+     */
+    iwrap_device_t *iwrap_discovery_find(const iwrap_address_t *address) {
+        uint16_t i = iwrap_discovery_hash(address);
+        // never more than 3/4 full, so an empty slot always ends the probe
+        while (iwrap_discovery.devices[i].used) {
+            if (!memcmp(iwrap_discovery.devices[i].address.address, address -> address, 6)) return &iwrap_discovery.devices[i];
+            i = (i + 1) & (IWRAP_DISCOVERY_SIZE - 1);
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Find a device in the discovery cache, adding it if missing
+     * @param address Device address
+     * @return Device record (valid until the cache next changes)
+     *
+     * When the cache is full, the device not seen for the longest time is dropped.
+     */
+    iwrap_device_t *iwrap_discovery_upsert(const iwrap_address_t *address) {
+        iwrap_device_t *device, *oldest = 0;
+        iwrap_time_t now;
+        uint16_t i;
+
+        if ((device = iwrap_discovery_find(address))) return device;
+        now = iwrap_timestamp ? iwrap_timestamp() : 0;
+        if (iwrap_discovery.count >= IWRAP_DISCOVERY_SIZE / 4 * 3) {
+            for (i = 0; i < IWRAP_DISCOVERY_SIZE; i++) {
+                device = &iwrap_discovery.devices[i];
+                if (device -> used && (!oldest || now - device -> last_seen > now - oldest -> last_seen)) oldest = device;
+            }
+            iwrap_discovery_remove(oldest);
+            iwrap_discovery.evictions++;
+        }
+        for (i = iwrap_discovery_hash(address); iwrap_discovery.devices[i].used; i = (i + 1) & (IWRAP_DISCOVERY_SIZE - 1));
+        device = &iwrap_discovery.devices[i];
+        memset(device, 0, sizeof(iwrap_device_t));
+        memcpy(&device -> address, address, sizeof(iwrap_address_t));
+        device -> used = 1;
+        device -> first_seen = device -> last_seen = now;
+        iwrap_discovery.count++;
+        return device;
+    }
+
+    /**
+     * @brief Drop a device from the discovery cache
+     * @param device Device record from iwrap_discovery_find()/iwrap_discovery_upsert()
+     *
+     * Later devices of the same probe run move back into the gap, so no
+     * deleted markers pile up and lookups stay short.
+     */
+    void iwrap_discovery_remove(iwrap_device_t *device) {
+        uint16_t hole = device - iwrap_discovery.devices, next = hole, home;
+        for (;;) {
+            next = (next + 1) & (IWRAP_DISCOVERY_SIZE - 1);
+            if (!iwrap_discovery.devices[next].used) break;
+            home = iwrap_discovery_hash(&iwrap_discovery.devices[next].address);
+            // move only if the hole lies on the probe path from its home slot
+            if (((next - home) & (IWRAP_DISCOVERY_SIZE - 1)) >= ((next - hole) & (IWRAP_DISCOVERY_SIZE - 1))) {
+                iwrap_discovery.devices[hole] = iwrap_discovery.devices[next];
+                hole = next;
+            }
+        }
+        iwrap_discovery.devices[hole].used = 0;
+        iwrap_discovery.count--;
+    }
+
+    /**
+     * @brief Forget all cached devices (counters and any outstanding lookup too)
+     */
+    void iwrap_discovery_clear() {
+        memset(&iwrap_discovery, 0, sizeof(iwrap_discovery_t));
+    }
+
+    /**
+     * @brief Merge an INQUIRY/INQUIRY_PARTIAL/INQUIRY_EXTENDED/NAME/NAME ERROR line into the cache
+     * @param type Response/event type from iwrap_classify_line()
+     * @param line Raw line received from iWRAP (not modified)
+     * @param length Length of raw line in bytes
+     */
+    void iwrap_discovery_line(uint8_t type, const uint8_t *line, uint16_t length) {
+        iwrap_address_t address;
+        iwrap_device_t *device;
+        const char *name = 0, *end = 0;
+        uint16_t pos;
+        uint32_t class_of_device = 0, value;
+        int32_t signed_value;
+        int8_t rssi = 0;
+        uint8_t has_class = 0, has_rssi = 0, change;
+        iwrap_time_t now = iwrap_timestamp ? iwrap_timestamp() : 0;
+
+        switch (type) {
+            case IWRAP_EVENT_RSP_INQUIRY_RESULT:
+                // INQUIRY {bd_addr} {class_of_device} [rssi]
+                pos = 8;
+                if (iwrap_scan_address(line, length, &pos, &address) || iwrap_scan_skip(line, length, &pos, " ") || iwrap_scan_uint(line, length, &pos, 16, &class_of_device)) return;
+                has_class = 1;
+                if (!iwrap_scan_skip(line, length, &pos, " ") && !iwrap_scan_int(line, length, &pos, &signed_value)) {
+                    rssi = signed_value;
+                    has_rssi = 1;
+                }
+                break;
+            case IWRAP_EVENT_INQUIRY_PARTIAL:
+                // INQUIRY_PARTIAL {bd_addr} {class_of_device} ["{cached_name}" {rssi}]
+                pos = 16;
+                if (iwrap_scan_address(line, length, &pos, &address) || iwrap_scan_skip(line, length, &pos, " ") || iwrap_scan_uint(line, length, &pos, 16, &class_of_device)) return;
+                has_class = 1;
+                if (!iwrap_scan_skip(line, length, &pos, " \"")) {
+                    name = (const char *)line + pos;
+                    // names may contain quotes themselves, only the last one closes
+                    for (end = (const char *)line + length - 1; end >= name && *end != '"'; end--);
+                    if (end < name) return;
+                    pos = (const uint8_t *)end - line + 1;
+                    if (!iwrap_scan_skip(line, length, &pos, " ") && !iwrap_scan_int(line, length, &pos, &signed_value)) {
+                        rssi = signed_value;
+                        has_rssi = 1;
+                    }
+                }
+                break;
+            case IWRAP_EVENT_INQUIRY_EXTENDED:
+                // INQUIRY_EXTENDED {bd_addr} RAW {data}
+                pos = 17;
+                if (iwrap_scan_address(line, length, &pos, &address)) return;
+                break;
+            case IWRAP_EVENT_NAME:
+                // NAME {bd_addr} "{name}"
+                pos = 5;
+                if (iwrap_scan_address(line, length, &pos, &address) || iwrap_scan_skip(line, length, &pos, " \"")) return;
+                name = (const char *)line + pos;
+                for (end = (const char *)line + length - 1; end >= name && *end != '"'; end--);
+                if (end < name) return;
+                break;
+            case IWRAP_EVENT_NAME_ERROR:
+                // NAME ERROR {error_code} {bd_addr} [reason]
+                pos = 11;
+                if (iwrap_scan_uint(line, length, &pos, 16, &value) || iwrap_scan_skip(line, length, &pos, " ") || iwrap_scan_address(line, length, &pos, &address)) return;
+                break;
+            default:
+                return;
+        }
+
+        // a lookup ends with its NAME or NAME ERROR, whoever sent it
+        if ((type == IWRAP_EVENT_NAME || type == IWRAP_EVENT_NAME_ERROR) && iwrap_discovery.resolving && !memcmp(iwrap_discovery.resolve_address.address, address.address, 6)) {
+            iwrap_discovery.resolving = 0;
+        }
+
+        device = iwrap_discovery_find(&address);
+        change = device ? IWRAP_DISCOVERY_SEEN : IWRAP_DISCOVERY_NEW;
+        if (type == IWRAP_EVENT_NAME_ERROR) {
+            if (!device) return;
+            device -> flags |= IWRAP_DEVICE_NAME_FAILED;
+            device -> name_time = now;
+            return;
+        }
+        if (!device) device = iwrap_discovery_upsert(&address);
+
+        if (type != IWRAP_EVENT_NAME) {
+            device -> last_seen = now;
+            if (device -> sightings < 0xFFFF) device -> sightings++;
+        }
+        if (has_class) device -> class_of_device = class_of_device;
+        if (has_rssi) {
+            device -> rssi = rssi;
+            if (device -> flags & IWRAP_DEVICE_RSSI) device -> rssi_avg += (rssi * 16 - device -> rssi_avg) / (1 << IWRAP_DISCOVERY_SHIFT);
+            else device -> rssi_avg = rssi * 16;
+            device -> flags |= IWRAP_DEVICE_RSSI;
+        }
+        // an empty cached name only means the module has none
+        if (name && end > name) {
+            length = end - name < IWRAP_DISCOVERY_NAME_SIZE - 1 ? end - name : IWRAP_DISCOVERY_NAME_SIZE - 1;
+            if (change == IWRAP_DISCOVERY_SEEN && (!(device -> flags & IWRAP_DEVICE_NAMED) || strncmp(device -> name, name, length) || device -> name[length])) change = IWRAP_DISCOVERY_NAME;
+            memcpy(device -> name, name, length);
+            device -> name[length] = 0;
+            device -> flags = (device -> flags | IWRAP_DEVICE_NAMED) & ~IWRAP_DEVICE_NAME_FAILED;
+            device -> name_time = now;
+        }
+        if (iwrap_callback_discovery) iwrap_callback_discovery(device, change);
+    }
+
+    /**
+     * @brief Check whether a device's name should be looked up
+     * @param device Cached device
+     * @return Non-zero if the name is unknown, older than iwrap_discovery_name_ttl, or its last lookup failed more than iwrap_discovery_name_retry ago
+     *
+     * Names never expire and failed lookups are never retried without iwrap_timestamp.
+     */
+    uint8_t iwrap_discovery_needs_name(const iwrap_device_t *device) {
+        iwrap_time_t now = iwrap_timestamp ? iwrap_timestamp() : 0;
+        if (iwrap_discovery.resolving && !memcmp(iwrap_discovery.resolve_address.address, device -> address.address, 6)) return 0;
+        if (device -> flags & IWRAP_DEVICE_NAME_FAILED) return now - device -> name_time >= iwrap_discovery_name_retry;
+        if (device -> flags & IWRAP_DEVICE_NAMED) return now - device -> name_time >= iwrap_discovery_name_ttl;
+        return 1;
+    }
+
+    /**
+     * @brief Pick the device whose name should be looked up next
+     * @return Device with the strongest average RSSI among those needing a name (devices without RSSI last), or 0 if none
+     */
+    iwrap_device_t *iwrap_discovery_next_unnamed() {
+        iwrap_device_t *device, *best = 0;
+        int16_t rank, best_rank = 0;
+        uint16_t i;
+        for (i = 0; i < IWRAP_DISCOVERY_SIZE; i++) {
+            device = &iwrap_discovery.devices[i];
+            if (!device -> used || !iwrap_discovery_needs_name(device)) continue;
+            // nearby devices answer fastest and most reliably
+            rank = (device -> flags & IWRAP_DEVICE_RSSI) ? device -> rssi_avg : -32767;
+            if (!best || rank > best_rank) {
+                best = device;
+                best_rank = rank;
+            }
+        }
+        return best;
+    }
+
+    /**
+     * @brief Start the next name lookup if none is outstanding (call periodically)
+     * @param mode Sending mode (MUX or non-MUX)
+     * @return Result code (non-zero if NAME command could not be sent)
+     *
+     * Only one NAME command is outstanding at a time. A lookup with no
+     * NAME/NAME ERROR within IWRAP_DISCOVERY_NAME_TIMEOUT counts as failed
+     * (needs iwrap_timestamp). Call outside of inquiries, since the module
+     * serves name requests slowly while one is running.
+     */
+    uint8_t iwrap_discovery_resolve(uint8_t mode) {
+        iwrap_device_t *device;
+        iwrap_time_t now = iwrap_timestamp ? iwrap_timestamp() : 0;
+        uint8_t result;
+
+        if (iwrap_discovery.resolving) {
+            if (!iwrap_timestamp || now - iwrap_discovery.resolve_started < IWRAP_DISCOVERY_NAME_TIMEOUT) return 0;
+            if ((device = iwrap_discovery_find(&iwrap_discovery.resolve_address))) {
+                device -> flags |= IWRAP_DEVICE_NAME_FAILED;
+                device -> name_time = now;
+            }
+            iwrap_discovery.resolving = 0;
+        }
+        if (!(device = iwrap_discovery_next_unnamed())) return 0;
+        if ((result = iwrap_cmd_name(&device -> address, mode))) return result;
+        memcpy(&iwrap_discovery.resolve_address, &device -> address, sizeof(iwrap_address_t));
+        iwrap_discovery.resolve_started = now;
+        iwrap_discovery.resolving = 1;
+        iwrap_discovery.lookups++;
+        return 0;
+    }
+
+    /**
+     * @brief Write address, class of device, average RSSI and name of each cached device as text
+     * @param write Output function for each text fragment
+     */
+    void iwrap_discovery_dump(int (*write)(const char *text)) {
+        const iwrap_device_t *device;
+        char s[18], *dest = s;
+        uint8_t cod[3];
+        uint16_t i;
+        for (i = 0; i < IWRAP_DISCOVERY_SIZE; i++) {
+            device = &iwrap_discovery.devices[i];
+            if (!device -> used) continue;
+            iwrap_bintohexstr(device -> address.address, 6, &dest, ':', 1);
+            write(s);
+            write(" ");
+            cod[0] = device -> class_of_device >> 16;
+            cod[1] = device -> class_of_device >> 8;
+            cod[2] = device -> class_of_device;
+            iwrap_bintohexstr(cod, 3, &dest, 0, 1);
+            write(s);
+            if (device -> flags & IWRAP_DEVICE_RSSI) {
+                write(" ");
+                if (device -> rssi_avg < 0) {
+                    s[0] = '-';
+                    iwrap_utoa((-device -> rssi_avg + 8) / 16, s + 1);
+                } else {
+                    iwrap_utoa((device -> rssi_avg + 8) / 16, s);
+                }
+                write(s);
+            }
+            write(" seen ");
+            iwrap_utoa(device -> sightings, s);
+            write(s);
+            if (device -> flags & IWRAP_DEVICE_NAMED) {
+                write(" \"");
+                write(device -> name);
+                write("\"");
+            }
+            write("\n");
+        }
+    }
+#endif /* IWRAP_INCLUDE_DISCOVERY */
+
+#ifdef IWRAP_INCLUDE_EIR
+    // Bluetooth base UUID 00000000-0000-1000-8000-00805F9B34FB without its first 32 bits, little-endian
+    static const uint8_t iwrap_eir_base_uuid[12] = { 0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80, 0x00, 0x10, 0x00, 0x00 };
+
+    /**
+     * @brief Start walking the fields of decoded EIR data
+     * @param iterator Iterator to set up
+     * @param data EIR data (e.g. iwrap_evt_inquiry_extended_t.data)
+     * @param length Length of EIR data in bytes
+     */
+    void iwrap_eir_begin(iwrap_eir_iterator_t *iterator, const uint8_t *data, uint8_t length) {
+        iterator -> data = data;
+        iterator -> length = length;
+        iterator -> pos = 0;
+    }
+
+    /**
+     * @brief Get the next EIR field
+     * @param iterator Iterator from iwrap_eir_begin()
+     * @param field Field to populate (value points into the EIR data)
+     * @return Non-zero if a field was found, zero at the end of the significant part or on a truncated field
+     */
+    uint8_t iwrap_eir_next(iwrap_eir_iterator_t *iterator, iwrap_eir_field_t *field) {
+        uint8_t size;
+        if (iterator -> pos >= iterator -> length) return 0;
+        size = iterator -> data[iterator -> pos];
+        // zero size ends the significant part, the rest is padding
+        if (!size || size > iterator -> length - iterator -> pos - 1) {
+            iterator -> pos = iterator -> length;
+            return 0;
+        }
+        field -> type = iterator -> data[iterator -> pos + 1];
+        field -> length = size - 1;
+        field -> value = iterator -> data + iterator -> pos + 2;
+        iterator -> pos += size + 1;
+        return 1;
+    }
+
+    /**
+     * @brief Find the first EIR field of a type
+     * @param data EIR data
+     * @param length Length of EIR data in bytes
+     * @param type Field type (IWRAP_EIR_*)
+     * @param field Field to populate
+     * @return Result code (non-zero if no such field)
+     */
+    uint8_t iwrap_eir_find(const uint8_t *data, uint8_t length, uint8_t type, iwrap_eir_field_t *field) {
+        iwrap_eir_iterator_t iterator;
+        iwrap_eir_begin(&iterator, data, length);
+        while (iwrap_eir_next(&iterator, field)) {
+            if (field -> type == type) return 0;
+        }
+        return 1;
+    }
+
+    /**
+     * @brief Get the device name from EIR data (complete name, else shortened name)
+     * @param data EIR data
+     * @param length Length of EIR data in bytes
+     * @param name Set to the UTF-8 name inside the EIR data (not NUL terminated)
+     * @param name_length Set to the length of the name in bytes
+     * @return Result code (non-zero if EIR has no name)
+     */
+    uint8_t iwrap_eir_name(const uint8_t *data, uint8_t length, const char **name, uint8_t *name_length) {
+        iwrap_eir_field_t field;
+        if (iwrap_eir_find(data, length, IWRAP_EIR_NAME, &field) && iwrap_eir_find(data, length, IWRAP_EIR_NAME_SHORT, &field)) return 1;
+        *name = (const char *)field.value;
+        *name_length = field.length;
+        return 0;
+    }
+
+    /**
+     * @brief Get the transmit power level from EIR data
+     * @param data EIR data
+     * @param length Length of EIR data in bytes
+     * @param tx_power Set to the power level (dBm)
+     * @return Result code (non-zero if EIR has no TX power level)
+     */
+    uint8_t iwrap_eir_tx_power(const uint8_t *data, uint8_t length, int8_t *tx_power) {
+        iwrap_eir_field_t field;
+        if (iwrap_eir_find(data, length, IWRAP_EIR_TX_POWER, &field) || field.length < 1) return 1;
+        *tx_power = (int8_t)field.value[0];
+        return 0;
+    }
+
+    /**
+     * @brief Get the first manufacturer specific data field from EIR data
+     * @param data EIR data
+     * @param length Length of EIR data in bytes
+     * @param company Set to the company identifier
+     * @param payload Set to the data following the company identifier (inside the EIR data)
+     * @param payload_length Set to the length of the payload in bytes
+     * @return Result code (non-zero if EIR has no manufacturer data)
+     */
+    uint8_t iwrap_eir_manufacturer(const uint8_t *data, uint8_t length, uint16_t *company, const uint8_t **payload, uint8_t *payload_length) {
+        iwrap_eir_field_t field;
+        if (iwrap_eir_find(data, length, IWRAP_EIR_MANUFACTURER, &field) || field.length < 2) return 1;
+        *company = field.value[0] | ((uint16_t)field.value[1] << 8);
+        *payload = field.value + 2;
+        *payload_length = field.length - 2;
+        return 0;
+    }
+
+    /**
+     * @brief Get the number of UUIDs in a service class UUID list field
+     * @param field Field from iwrap_eir_next()/iwrap_eir_find()
+     * @return Number of UUIDs (0 if the field is not a UUID list)
+     */
+    uint8_t iwrap_eir_uuid_count(const iwrap_eir_field_t *field) {
+        switch (field -> type) {
+            case IWRAP_EIR_UUID16_PARTIAL:
+            case IWRAP_EIR_UUID16: return field -> length / 2;
+            case IWRAP_EIR_UUID32_PARTIAL:
+            case IWRAP_EIR_UUID32: return field -> length / 4;
+            case IWRAP_EIR_UUID128_PARTIAL:
+            case IWRAP_EIR_UUID128: return field -> length / 16;
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Get a UUID from a service class UUID list field as a 16/32-bit value
+     * @param field Field from iwrap_eir_next()/iwrap_eir_find()
+     * @param index UUID index (less than iwrap_eir_uuid_count())
+     * @return UUID, or 0 for a 128-bit UUID not derived from the Bluetooth base UUID
+     */
+    uint32_t iwrap_eir_uuid(const iwrap_eir_field_t *field, uint8_t index) {
+        const uint8_t *v;
+        switch (field -> type) {
+            case IWRAP_EIR_UUID16_PARTIAL:
+            case IWRAP_EIR_UUID16:
+                v = field -> value + index * 2;
+                return v[0] | ((uint32_t)v[1] << 8);
+            case IWRAP_EIR_UUID32_PARTIAL:
+            case IWRAP_EIR_UUID32:
+                v = field -> value + index * 4;
+                break;
+            case IWRAP_EIR_UUID128_PARTIAL:
+            case IWRAP_EIR_UUID128:
+                v = field -> value + index * 16;
+                if (memcmp(v, iwrap_eir_base_uuid, 12)) return 0;
+                v += 12;
+                break;
+            default:
+                return 0;
+        }
+        return v[0] | ((uint32_t)v[1] << 8) | ((uint32_t)v[2] << 16) | ((uint32_t)v[3] << 24);
+    }
+
+    /**
+     * @brief Get a UUID from a 128-bit service class UUID list field
+     * @param field Field from iwrap_eir_next()/iwrap_eir_find()
+     * @param index UUID index (less than iwrap_eir_uuid_count())
+     * @return 16-byte little-endian UUID inside the EIR data, or 0 if the field is not a 128-bit UUID list
+     */
+    const uint8_t *iwrap_eir_uuid128(const iwrap_eir_field_t *field, uint8_t index) {
+        if (field -> type != IWRAP_EIR_UUID128_PARTIAL && field -> type != IWRAP_EIR_UUID128) return 0;
+        return field -> value + index * 16;
+    }
+
+    /**
+     * @brief Check whether EIR data lists a 16/32-bit service UUID
+     * @param data EIR data
+     * @param length Length of EIR data in bytes
+     * @param uuid UUID to look for (also matches its 128-bit form)
+     * @return Non-zero if listed
+     */
+    uint8_t iwrap_eir_has_uuid(const uint8_t *data, uint8_t length, uint32_t uuid) {
+        iwrap_eir_iterator_t iterator;
+        iwrap_eir_field_t field;
+        uint8_t i, count;
+        if (!uuid) return 0;
+        iwrap_eir_begin(&iterator, data, length);
+        while (iwrap_eir_next(&iterator, &field)) {
+            count = iwrap_eir_uuid_count(&field);
+            for (i = 0; i < count; i++) {
+                if (iwrap_eir_uuid(&field, i) == uuid) return 1;
+            }
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Check whether EIR data lists a 128-bit service UUID
+     * @param data EIR data
+     * @param length Length of EIR data in bytes
+     * @param uuid 16-byte little-endian UUID (if derived from the Bluetooth base UUID, also matches its 16/32-bit form)
+     * @return Non-zero if listed
+     */
+    uint8_t iwrap_eir_has_uuid128(const uint8_t *data, uint8_t length, const uint8_t *uuid) {
+        iwrap_eir_iterator_t iterator;
+        iwrap_eir_field_t field;
+        uint8_t i, count;
+        if (!memcmp(uuid, iwrap_eir_base_uuid, 12)) {
+            return iwrap_eir_has_uuid(data, length, uuid[12] | ((uint32_t)uuid[13] << 8) | ((uint32_t)uuid[14] << 16) | ((uint32_t)uuid[15] << 24));
+        }
+        iwrap_eir_begin(&iterator, data, length);
+        while (iwrap_eir_next(&iterator, &field)) {
+            if (field.type != IWRAP_EIR_UUID128_PARTIAL && field.type != IWRAP_EIR_UUID128) continue;
+            count = iwrap_eir_uuid_count(&field);
+            for (i = 0; i < count; i++) {
+                if (!memcmp(field.value + i * 16, uuid, 16)) return 1;
+            }
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Check EIR data against iwrap_eir_filter
+     * @param data EIR data
+     * @param length Length of EIR data in bytes
+     * @return Non-zero if the EIR passes every criterion set in iwrap_eir_filter.flags
+     *
+     * Called by the INQUIRY_EXTENDED decoder, so rejected inquiry results
+     * cost one pass over the decoded bytes and are never delivered.
+     */
+    uint8_t iwrap_eir_accept(const uint8_t *data, uint8_t length) {
+        iwrap_eir_iterator_t iterator;
+        iwrap_eir_field_t field;
+        uint8_t accepted = 1;
+        if (!iwrap_eir_filter.flags) return 1;
+        if (iwrap_eir_filter.flags & IWRAP_EIR_FILTER_COMPANY) {
+            // a device may send several manufacturer data fields
+            accepted = 0;
+            iwrap_eir_begin(&iterator, data, length);
+            while (!accepted && iwrap_eir_next(&iterator, &field)) {
+                accepted = field.type == IWRAP_EIR_MANUFACTURER && field.length >= 2 && (field.value[0] | ((uint16_t)field.value[1] << 8)) == iwrap_eir_filter.company;
+            }
+        }
+        if (accepted && (iwrap_eir_filter.flags & IWRAP_EIR_FILTER_UUID)) accepted = iwrap_eir_has_uuid(data, length, iwrap_eir_filter.uuid);
+        if (accepted && (iwrap_eir_filter.flags & IWRAP_EIR_FILTER_UUID128)) accepted = iwrap_eir_has_uuid128(data, length, iwrap_eir_filter.uuid128);
+        if (!accepted) iwrap_eir_filtered++;
+        return accepted;
+    }
+#endif /* IWRAP_INCLUDE_EIR */
+
+#ifdef IWRAP_INCLUDE_COALESCE
+    /**
+     * @brief Turn small-write coalescing on or off for a link
+     * @param link_id Link ID
+     * @param buffer Storage for waiting data
+     * @param size Size of storage in bytes (at most 1023 so it fits one frame), 0 to turn off
+     * @param threshold Send as soon as this many bytes are waiting (at most size)
+     * @param deadline Longest time a byte may wait before iwrap_coalesce_poll() or the next write sends it (0 = no limit)
+     * @return Result code (non-zero indicates error)
+     *
+     * Waiting data is sent first when coalescing is turned off.
+     */
+    uint8_t iwrap_coalesce_setup(uint8_t link_id, uint8_t *buffer, uint16_t size, uint16_t threshold, iwrap_time_t deadline) {
+        iwrap_coalescer_t *coalescer;
+        if (link_id >= IWRAP_MAX_LINKS || size > IWRAP_MUX_MAX_PAYLOAD || (size && (!buffer || !threshold || threshold > size))) return 1;
+        coalescer = &iwrap_coalescers[link_id];
+        iwrap_coalesce_flush(link_id);
+        memset(coalescer, 0, sizeof(iwrap_coalescer_t));
+        coalescer -> buffer = buffer;
+        coalescer -> size = size;
+        coalescer -> threshold = threshold;
+        coalescer -> deadline = deadline;
+        return 0;
+    }
+
+    /**
+     * @brief Add data to a link's coalescing buffer, sending it when threshold or deadline is reached
+     * @param link_id Link ID
+     * @param data_len Length of data
+     * @param data Data to send (copied if it waits, may be reused on return)
+     * @param mode Sending mode (MUX or non-MUX)
+     * @return Result code (non-zero indicates error)
+     *
+     * Writes of at least threshold bytes skip the buffer once waiting data
+     * is sent, so bulk transfers are not copied.
+     */
+    uint8_t iwrap_coalesce_data(uint8_t link_id, uint32_t data_len, const uint8_t *data, uint8_t mode) {
+        iwrap_coalescer_t *coalescer = &iwrap_coalescers[link_id];
+        uint8_t result;
+
+        // waiting data must go first if this write does not fit with it
+        if (coalescer -> length && (mode != coalescer -> mode || coalescer -> length + data_len > coalescer -> size)) {
+            if ((result = iwrap_coalesce_flush(link_id))) return result;
+        }
+        if (!coalescer -> length && data_len >= coalescer -> threshold) return iwrap_send_segments(link_id, data_len, data, mode);
+
+        if (!coalescer -> length) {
+            coalescer -> mode = mode;
+            if (iwrap_timestamp) coalescer -> since = iwrap_timestamp();
+        }
+        memcpy(coalescer -> buffer + coalescer -> length, data, data_len);
+        coalescer -> length += data_len;
+        coalescer -> writes++;
+
+        if (coalescer -> length >= coalescer -> threshold || (coalescer -> deadline && iwrap_timestamp && iwrap_timestamp() - coalescer -> since >= coalescer -> deadline)) {
+            return iwrap_coalesce_flush(link_id);
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Send waiting small writes now
+     * @param link_id Link ID, or 0xFF for all links
+     * @return Result code (non-zero indicates error)
+     */
+    uint8_t iwrap_coalesce_flush(uint8_t link_id) {
+        iwrap_coalescer_t *coalescer;
+        uint8_t i, result = 0, error;
+        uint16_t length;
+        if (link_id == 0xFF) {
+            for (i = 0; i < IWRAP_MAX_LINKS; i++) {
+                if ((error = iwrap_coalesce_flush(i))) result = error;
+            }
+            return result;
+        }
+        coalescer = &iwrap_coalescers[link_id];
+        if (!(length = coalescer -> length)) return 0;
+        coalescer -> length = 0;
+        coalescer -> frames++;
+        return iwrap_send_segments(link_id, length, coalescer -> buffer, coalescer -> mode);
+    }
+
+    /**
+     * @brief Send waiting small writes whose deadline has passed (call periodically)
+     * @return Result code (non-zero indicates error)
+     *
+     * Without iwrap_timestamp, all waiting data is sent.
+     */
+    uint8_t iwrap_coalesce_poll() {
+        iwrap_coalescer_t *coalescer;
+        uint8_t i, result = 0, error;
+        for (i = 0; i < IWRAP_MAX_LINKS; i++) {
+            coalescer = &iwrap_coalescers[i];
+            if (!coalescer -> length || (iwrap_timestamp && (!coalescer -> deadline || iwrap_timestamp() - coalescer -> since < coalescer -> deadline))) continue;
+            if ((error = iwrap_coalesce_flush(i))) result = error;
+        }
+        return result;
+    }
+#endif /* IWRAP_INCLUDE_COALESCE */
+
+#ifdef IWRAP_INCLUDE_LINK_CREDITS
+    /**
+     * @brief Reset link's send credit to a full window (called on CONNECT/RING/NO CARRIER)
+     * @param link_id Link ID
+     * @param window Bytes the module can buffer for this link (0 = no credit control)
+     */
+    void iwrap_link_credits_reset(uint8_t link_id, uint16_t window) {
+        iwrap_link_credit_t *credit = &iwrap_link_credits[link_id];
+        if (credit -> stalled && iwrap_timestamp) credit -> stall_time += iwrap_timestamp() - credit -> stalled_since;
+        credit -> window = window;
+        credit -> credits = window;
+        credit -> buffered = 0;
+        credit -> inflight = 0;
+        credit -> stalled = 0;
+    }
+
+    /**
+     * @brief Apply buffer level from a LIST result to the link's send credit
+     * @param link_id Link ID
+     * @param line LIST result line
+     * @param length Length of line
+     *
+     * Data sent after the LIST request is not in the module's report yet, so
+     * it is still taken off the new credit.
+     */
+    void iwrap_link_credits_list(uint8_t link_id, const uint8_t *line, uint16_t length) {
+        iwrap_link_credit_t *credit = &iwrap_link_credits[link_id];
+        uint16_t end = length;
+        uint32_t buffered = 0, scale = 1;
+
+        if (!credit -> window) return;
+
+        // {buffer} is the last number on the line, before optional "ERETX"
+        while (end && (line[end - 1] < '0' || line[end - 1] > '9')) end--;
+        while (end && line[end - 1] >= '0' && line[end - 1] <= '9') {
+            buffered += (line[--end] - '0') * scale;
+            scale *= 10;
+        }
+
+        credit -> buffered = buffered > 0xFFFF ? 0xFFFF : buffered;
+        credit -> credits = (int32_t)credit -> window - credit -> buffered - credit -> inflight;
+        credit -> refreshes++;
+        if (credit -> stalled && credit -> credits > 0) {
+            credit -> stalled = 0;
+            if (iwrap_timestamp) credit -> stall_time += iwrap_timestamp() - credit -> stalled_since;
+        }
+    }
+
+    /**
+     * @brief Note that data for a link was held back for lack of credit
+     * @param link_id Link ID
+     */
+    void iwrap_link_credits_stall(uint8_t link_id) {
+        iwrap_link_credit_t *credit = &iwrap_link_credits[link_id];
+        if (credit -> stalled) return;
+        credit -> stalled = 1;
+        credit -> stalls++;
+        if (iwrap_timestamp) credit -> stalled_since = iwrap_timestamp();
+    }
+
+    /**
+     * @brief Ask module for current buffer levels of all links now (sends LIST)
+     * @param mode Sending mode (MUX or non-MUX)
+     * @return Result code (non-zero indicates error)
+     */
+    uint8_t iwrap_link_credits_refresh(uint8_t mode) {
+        uint8_t i;
+        for (i = 0; i < IWRAP_MAX_LINKS; i++) iwrap_link_credits[i].inflight = 0;
+        if (iwrap_timestamp) iwrap_link_credit_requested = iwrap_timestamp();
+        return iwrap_send_command("LIST", mode);
+    }
+
+    /**
+     * @brief Refresh credits if a link is stalled or has sent data, at most once per iwrap_link_credit_interval
+     * @param mode Sending mode (MUX or non-MUX)
+     * @return Result code (0 if nothing to do or LIST sent, otherwise error from iwrap_send_command())
+     *
+     * Call periodically, e.g. from the main loop. Without iwrap_timestamp, a
+     * refresh is only sent while no other command is pending.
+     */
+    uint8_t iwrap_link_credits_poll(uint8_t mode) {
+        uint8_t i, needed = 0;
+        for (i = 0; i < IWRAP_MAX_LINKS; i++) {
+            if (iwrap_link_credits[i].window && (iwrap_link_credits[i].stalled || iwrap_link_credits[i].inflight)) needed = 1;
+        }
+        if (!needed) return 0;
+        if (iwrap_timestamp ? iwrap_timestamp() - iwrap_link_credit_requested < iwrap_link_credit_interval : iwrap_pending_commands != 0) return 0;
+        return iwrap_link_credits_refresh(mode);
+    }
+#endif /* IWRAP_INCLUDE_LINK_CREDITS */
+
+#ifdef IWRAP_INCLUDE_TX_QUEUE
+    /**
+     * @brief Prepare TX queue (call once before any thread submits)
+     */
+    void iwrap_tx_queue_init() {
+        uint16_t i;
+        memset(&iwrap_tx_queue, 0, sizeof(iwrap_tx_queue_t));
+        for (i = 0; i < IWRAP_TX_QUEUE_SIZE; i++) iwrap_tx_queue.slots[i].sequence = i;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+
+    /**
+     * @brief Claim consecutive TX queue slots for one producer (lock-free)
+     * @param count Number of slots needed
+     * @param position Set to position of first claimed slot
+     * @return Result code (non-zero if queue does not have room for all slots)
+     *
+     * All slots are claimed with a single compare-and-swap, so a submission
+     * split over several slots is never interleaved with other producers.
+     */
+    uint8_t iwrap_tx_claim(uint16_t count, uint32_t *position) {
+        uint32_t pos = __atomic_load_n(&iwrap_tx_queue.enqueue_position, __ATOMIC_RELAXED);
+        uint16_t i;
+        if (count > IWRAP_TX_QUEUE_SIZE) return 1;
+        while (1) {
+            // all slots must already be released by the writer for this lap
+            for (i = 0; i < count; i++) {
+                if (__atomic_load_n(&iwrap_tx_queue.slots[(pos + i) & (IWRAP_TX_QUEUE_SIZE - 1)].sequence, __ATOMIC_ACQUIRE) != pos + i) break;
+            }
+            if (i < count) {
+                if ((int32_t)(__atomic_load_n(&iwrap_tx_queue.slots[(pos + i) & (IWRAP_TX_QUEUE_SIZE - 1)].sequence, __ATOMIC_ACQUIRE) - (pos + i)) < 0) {
+                    __atomic_fetch_add(&iwrap_tx_queue.rejected, 1, __ATOMIC_RELAXED);
+                    return 1; // full
+                }
+                // another producer got there first
+                pos = __atomic_load_n(&iwrap_tx_queue.enqueue_position, __ATOMIC_RELAXED);
+                continue;
+            }
+            if (__atomic_compare_exchange_n(&iwrap_tx_queue.enqueue_position, &pos, pos + count, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        }
+        *position = pos;
+        return 0;
+    }
+
+    /**
+     * @brief Queue command for sending by iwrap_tx_process() (any thread)
+     * @param cmd Command to send, in ASCII format (no line endings)
+     * @param mode Sending mode (MUX or non-MUX)
+     * @return Result code (non-zero indicates error, 1 = queue full, 2 = command too long)
+     */
+    uint8_t iwrap_tx_submit_command(const char *cmd, uint8_t mode) {
+        iwrap_tx_slot_t *slot;
+        uint32_t pos;
+        uint16_t length = strlen(cmd);
+        if (length > IWRAP_TX_SLOT_SIZE) return 2;
+        if (iwrap_tx_claim(1, &pos)) return 1;
+        slot = &iwrap_tx_queue.slots[pos & (IWRAP_TX_QUEUE_SIZE - 1)];
+        slot -> command = 1;
+        slot -> channel = 0xFF;
+        slot -> mode = mode;
+        slot -> length = length;
+        memcpy(slot -> data, cmd, length + 1);
+        __atomic_store_n(&slot -> sequence, pos + 1, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    /**
+     * @brief Queue data for sending by iwrap_tx_process() (any thread)
+     * @param channel Link ID to which to send data
+     * @param data_len Length of data (at most IWRAP_TX_QUEUE_SIZE * IWRAP_TX_SLOT_SIZE)
+     * @param data Data to send (copied, may be reused on return)
+     * @param mode Sending mode (MUX or non-MUX)
+     * @return Result code (non-zero indicates error, 1 = queue full)
+     *
+     * Data is queued entirely or not at all; submissions from one thread are
+     * sent in order, so data for a link served by one thread stays in order.
+     */
+    uint8_t iwrap_tx_submit_data(uint8_t channel, uint32_t data_len, const uint8_t *data, uint8_t mode) {
+        iwrap_tx_slot_t *slot;
+        uint32_t pos, count = data_len ? (data_len + IWRAP_TX_SLOT_SIZE - 1) / IWRAP_TX_SLOT_SIZE : 1;
+        uint16_t segment;
+        if (count > IWRAP_TX_QUEUE_SIZE || iwrap_tx_claim(count, &pos)) return 1;
+        do {
+            segment = data_len > IWRAP_TX_SLOT_SIZE ? IWRAP_TX_SLOT_SIZE : data_len;
+            slot = &iwrap_tx_queue.slots[pos & (IWRAP_TX_QUEUE_SIZE - 1)];
+            slot -> command = 0;
+            slot -> channel = channel;
+            slot -> mode = mode;
+            slot -> length = segment;
+            memcpy(slot -> data, data, segment);
+            __atomic_store_n(&slot -> sequence, pos + 1, __ATOMIC_RELEASE);
+            data += segment;
+            data_len -= segment;
+            pos++;
+        } while (data_len);
+        return 0;
+    }
+
+    /**
+     * @brief Send queued commands/data in submission order (single writer thread only)
+     * @param max_slots Maximum number of slots to send (0 = until queue is empty)
+     * @return Number of slots sent
+     *
+     * Stops at a slot which is claimed but not yet filled by its producer.
+     * With IWRAP_INCLUDE_TX_SCHEDULER, slots for channels which have a
+     * scheduler queue are moved there instead (send with iwrap_tx_sched_run()).
+     */
+    uint16_t iwrap_tx_process(uint16_t max_slots) {
+        iwrap_tx_slot_t *slot;
+        uint32_t pos = iwrap_tx_queue.dequeue_position;
+        uint16_t sent = 0;
+        while (!max_slots || sent < max_slots) {
+            slot = &iwrap_tx_queue.slots[pos & (IWRAP_TX_QUEUE_SIZE - 1)];
+            if (__atomic_load_n(&slot -> sequence, __ATOMIC_ACQUIRE) != pos + 1) break;
+            #ifdef IWRAP_INCLUDE_TX_SCHEDULER
+                // hand over to scheduler queue if set up; a full scheduler queue holds the slot back
+                if (slot -> command ? iwrap_tx_scheduler.flows[IWRAP_MAX_LINKS].size : (slot -> channel < IWRAP_MAX_LINKS && iwrap_tx_scheduler.flows[slot -> channel].size)) {
+                    if (slot -> command ? iwrap_tx_sched_command((const char *)slot -> data, slot -> mode) : iwrap_tx_sched_data(slot -> channel, slot -> length, slot -> data, slot -> mode)) break;
+                } else
+            #endif
+            if (slot -> command) iwrap_send_command((const char *)slot -> data, slot -> mode);
+            else iwrap_send_segment(slot -> channel, slot -> length, slot -> data, slot -> mode);
+            __atomic_store_n(&slot -> sequence, pos + IWRAP_TX_QUEUE_SIZE, __ATOMIC_RELEASE);
+            pos++;
+            sent++;
+        }
+        iwrap_tx_queue.dequeue_position = pos;
+        return sent;
+    }
+#endif /* IWRAP_INCLUDE_TX_QUEUE */
+
+#ifdef IWRAP_INCLUDE_RX_RINGS
+    /**
+     * @brief Attach RX ring to a link (received data is then queued there for a consumer)
+     * @param link_id Link ID
+     * @param buffer Ring storage
+     * @param size Size of storage in bytes (power of 2, at most 32768), 0 to detach
+     * @param high_water Depth at which iwrap_callback_rx_throttle(link_id, 1) is called
+     * @param low_water Depth at which iwrap_callback_rx_throttle(link_id, 0) is called after throttling
+     * @return Result code (non-zero indicates error)
+     *
+     * Call while the link is idle; the ring is emptied.
+     */
+    uint8_t iwrap_rx_ring_setup(uint8_t link_id, uint8_t *buffer, uint16_t size, uint16_t high_water, uint16_t low_water) {
+        iwrap_rx_ring_t *ring;
+        if (link_id >= IWRAP_MAX_LINKS || (size & (size - 1)) || size > 32768 || (size && !buffer) || low_water > high_water) return 1;
+        ring = &iwrap_rx_rings[link_id];
+        memset(ring, 0, sizeof(iwrap_rx_ring_t));
+        ring -> buffer = buffer;
+        ring -> size = size;
+        ring -> high_water = high_water;
+        ring -> low_water = low_water;
+        return 0;
+    }
+
+    /**
+     * @brief Queue received frame in link's RX ring (producer side, called by parser)
+     * @param link_id Link ID
+     * @param length Length of data
+     * @param data Received data
+     * @return Result code (non-zero if ring not used or frame dropped because it did not fit)
+     *
+     * Frames are kept whole: a frame which does not fit is dropped entirely
+     * and counted, so a slow consumer only loses its own link's data.
+     */
+    uint8_t iwrap_rx_ring_push(uint8_t link_id, uint16_t length, const uint8_t *data) {
+        iwrap_rx_ring_t *ring = &iwrap_rx_rings[link_id];
+        uint16_t head = ring -> head, depth, first;
+
+        if (!ring -> size) return 1;
+        depth = (uint16_t)(head - ring -> tail);
+        if (length > ring -> size - depth) {
+            ring -> dropped_frames++;
+            ring -> dropped_bytes += length;
+            return 2;
+        }
+
+        // copy in up to two pieces around the end of the buffer
+        first = ring -> size - (head & (ring -> size - 1));
+        if (first > length) first = length;
+        memcpy(ring -> buffer + (head & (ring -> size - 1)), data, first);
+        memcpy(ring -> buffer, data + first, length - first);
+
+        // publish data before moving head
+        IWRAP_MEMORY_BARRIER();
+        ring -> head = head + length;
+
+        depth += length;
+        if (depth > ring -> peak) ring -> peak = depth;
+        if (!ring -> throttled && ring -> high_water && depth >= ring -> high_water) {
+            ring -> throttled = 1;
+            if (iwrap_callback_rx_throttle) iwrap_callback_rx_throttle(link_id, 1);
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Get number of bytes waiting in link's RX ring
+     * @param link_id Link ID
+     * @return Bytes queued
+     */
+    uint16_t iwrap_rx_ring_depth(uint8_t link_id) {
+        return (uint16_t)(iwrap_rx_rings[link_id].head - iwrap_rx_rings[link_id].tail);
+    }
+
+    /**
+     * @brief Get oldest contiguous span of queued data without removing it (consumer side)
+     * @param link_id Link ID
+     * @param data Set to start of span
+     * @return Length of span (may be less than depth when data wraps around), 0 if empty
+     */
+    uint16_t iwrap_rx_ring_peek(uint8_t link_id, const uint8_t **data) {
+        iwrap_rx_ring_t *ring = &iwrap_rx_rings[link_id];
+        uint16_t tail = ring -> tail, depth = (uint16_t)(ring -> head - tail), first;
+        if (!depth) return 0;
+        IWRAP_MEMORY_BARRIER(); // read data only after seeing new head
+        first = ring -> size - (tail & (ring -> size - 1));
+        *data = ring -> buffer + (tail & (ring -> size - 1));
+        return depth < first ? depth : first;
+    }
+
+    /**
+     * @brief Release queued data after it has been handled (consumer side)
+     * @param link_id Link ID
+     * @param length Bytes to release (at most depth)
+     *
+     * Ends backpressure (calls iwrap_callback_rx_throttle(link_id, 0)) once
+     * depth falls to the low water mark.
+     */
+    void iwrap_rx_ring_consume(uint8_t link_id, uint16_t length) {
+        iwrap_rx_ring_t *ring = &iwrap_rx_rings[link_id];
+        uint16_t depth = (uint16_t)(ring -> head - ring -> tail);
+        if (length > depth) length = depth;
+        IWRAP_MEMORY_BARRIER(); // finish reading data before handing it back to producer
+        ring -> tail += length;
+        if (ring -> throttled && depth - length <= ring -> low_water) {
+            ring -> throttled = 0;
+            if (iwrap_callback_rx_throttle) iwrap_callback_rx_throttle(link_id, 0);
+        }
+    }
+
+    /**
+     * @brief Copy queued data out of link's RX ring and release it (consumer side)
+     * @param link_id Link ID
+     * @param dest Destination buffer
+     * @param length Size of destination buffer
+     * @return Bytes copied
+     */
+    uint16_t iwrap_rx_ring_read(uint8_t link_id, uint8_t *dest, uint16_t length) {
+        const uint8_t *span;
+        uint16_t copied = 0, available;
+        while (copied < length && (available = iwrap_rx_ring_peek(link_id, &span))) {
+            if (available > length - copied) available = length - copied;
+            memcpy(dest + copied, span, available);
+            iwrap_rx_ring_consume(link_id, available);
+            copied += available;
+        }
+        return copied;
+    }
+
+    /**
+     * @brief Count links currently above their RX ring high water mark
+     * @return Number of throttled links (e.g. stop reading UART while non-zero)
+     */
+    uint8_t iwrap_rx_rings_throttled() {
+        uint8_t i, count = 0;
+        for (i = 0; i < IWRAP_MAX_LINKS; i++) count += iwrap_rx_rings[i].throttled;
+        return count;
+    }
+#endif /* IWRAP_INCLUDE_RX_RINGS */
+
+#ifdef IWRAP_INCLUDE_LINK_STATS
+    /**
+     * @brief Start accounting for a new connection on a link (CONNECT or RING)
+     * @param link_id Link ID
+     * @param now Current time
+     */
+    void iwrap_link_stats_open(uint8_t link_id, iwrap_time_t now) {
+        iwrap_link_stats_t *link = &iwrap_link_stats[link_id];
+        memset(link, 0, sizeof(iwrap_link_stats_t));
+        link -> opened = link -> sampled = now;
+        link -> active = 1;
+    }
+
+    /**
+     * @brief Finalize accounting for a link (NO CARRIER) and report it to iwrap_callback_link_closed
+     * @param link_id Link ID
+     * @param error_code Error code from NO CARRIER event
+     * @param now Current time
+     *
+     * Counters stay readable in iwrap_link_stats[] until the link ID is reused.
+     * NO CARRIER for a CALL which never connected is not reported.
+     */
+    void iwrap_link_stats_close(uint8_t link_id, uint16_t error_code, iwrap_time_t now) {
+        iwrap_link_stats_t *link = &iwrap_link_stats[link_id];
+        if (!link -> active) return;
+        if (iwrap_timestamp) iwrap_link_stats_sample(link, now);
+        link -> closed = now;
+        link -> active = 0;
+        if (iwrap_callback_link_closed) iwrap_callback_link_closed(link_id, error_code, link);
+    }
+
+    /**
+     * @brief Count one data frame on a link
+     * @param link_id Link ID (less than IWRAP_MAX_LINKS)
+     * @param tx 1 for sent data, 0 for received data
+     * @param length Payload length in bytes
+     */
+    void iwrap_link_stats_account(uint8_t link_id, uint8_t tx, uint16_t length) {
+        iwrap_link_stats_t *link = &iwrap_link_stats[link_id];
+        if (tx) {
+            link -> tx_frames++;
+            link -> tx_bytes += length;
+            link -> tx_window += length;
+        } else {
+            link -> rx_frames++;
+            link -> rx_bytes += length;
+            link -> rx_window += length;
+        }
+        if (iwrap_timestamp) iwrap_link_stats_sample(link, iwrap_timestamp());
+    }
+
+    /**
+     * @brief Fold bytes moved since last sample into EWMA throughput, once per IWRAP_LINK_RATE_INTERVAL
+     * @param link Link to update
+     * @param now Current time
+     */
+    void iwrap_link_stats_sample(iwrap_link_stats_t *link, iwrap_time_t now) {
+        iwrap_time_t elapsed = now - link -> sampled;
+        if (elapsed < IWRAP_LINK_RATE_INTERVAL) return;
+        link -> rx_rate += (int32_t)((uint64_t)link -> rx_window * IWRAP_TIME_RATE / elapsed - link -> rx_rate) >> IWRAP_LINK_RATE_SHIFT;
+        link -> tx_rate += (int32_t)((uint64_t)link -> tx_window * IWRAP_TIME_RATE / elapsed - link -> tx_rate) >> IWRAP_LINK_RATE_SHIFT;
+        link -> rx_window = 0;
+        link -> tx_window = 0;
+        link -> sampled = now;
+    }
+
+    /**
+     * @brief Update throughput of all active links (call periodically so idle links decay to zero)
+     */
+    void iwrap_link_stats_update() {
+        uint8_t i;
+        if (!iwrap_timestamp) return;
+        for (i = 0; i < IWRAP_MAX_LINKS; i++) {
+            if (iwrap_link_stats[i].active) iwrap_link_stats_sample(&iwrap_link_stats[i], iwrap_timestamp());
+        }
+    }
+#endif /* IWRAP_INCLUDE_LINK_STATS */
+
+#ifdef IWRAP_INCLUDE_RX_TIMING
+    /**
+     * @brief Parse one received byte, using arrival time supplied by the transport
+     * @param b Byte to parse
+     * @param mode Receiving mode (MUX or non-MUX)
+     * @param timestamp Monotonic arrival time of the byte (e.g. captured in the UART RX interrupt)
+     * @return Result code (non-zero indicates error)
+     * @see iwrap_parse()
+     */
+    uint8_t iwrap_parse_at(uint8_t b, uint8_t mode, iwrap_time_t timestamp) {
+        iwrap_rx_time_supplied = timestamp;
+        iwrap_rx_time_flags |= 2;
+        return iwrap_parse(b, mode);
+    }
+
+    /**
+     * @brief Write UART receive timing histograms as text
+     * @param write Output function for each text fragment
+     */
+    void iwrap_rx_timing_dump(int (*write)(const char *text)) {
+        iwrap_histogram_dump(&iwrap_rx_timing.gap, "RX_GAP", write);
+        iwrap_histogram_dump(&iwrap_rx_timing.burst, "RX_BURST_BYTES", write);
+        iwrap_histogram_dump(&iwrap_rx_timing.frame, "RX_FRAME", write);
+    }
+
+    /**
+     * @brief Clear UART receive timing histograms (call from same context as iwrap_parse())
+     */
+    void iwrap_rx_timing_reset() {
+        memset(&iwrap_rx_timing, 0, sizeof(iwrap_rx_timing_t));
+        iwrap_rx_time_flags &= ~1;
+        iwrap_rx_burst_length = 0;
+    }
+#endif /* IWRAP_INCLUDE_RX_TIMING */
+
+/**
+ * @brief Decode "CALL {link_id}" response
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_rsp_call(uint8_t *line, uint16_t length, iwrap_rsp_call_t *out) {
+    uint16_t pos = 5;
+    uint32_t value;
+    if (iwrap_scan_uint(line, length, &pos, 10, &value)) return 1;
+    out -> link_id = value;
+    return 0;
+}
+
+/**
+ * @brief Decode "HID GET {length} {descriptor}" response (descriptor is decoded in place)
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_rsp_hid_get(uint8_t *line, uint16_t length, iwrap_rsp_hid_get_t *out) {
+    uint16_t pos = 8;
+    uint32_t value;
+    if (iwrap_scan_uint(line, length, &pos, 16, &value) || iwrap_scan_skip(line, length, &pos, " ")) return 1;
+    out -> length = value;
+    out -> descriptor = line + pos; // hex string is twice as long as binary, so decode over itself
+    if (iwrap_scan_hex(line, length, &pos, line + pos, out -> length) != out -> length) return 1;
+    return 0;
+}
+
+/**
+ * @brief Decode one line of INFO output
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_rsp_info(uint8_t *line, uint16_t length, iwrap_rsp_info_t *out) {
+    uint16_t end = iwrap_scan_end(line, length);
+    if (end == length) return 1; // no line ending to null terminate at
+    line[end] = 0;
+    out -> length = end;
+    out -> info = (char *)line;
+    return 0;
+}
+
+/**
+ * @brief Decode "INQUIRY {num_of_devices}" response
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_rsp_inquiry_count(uint8_t *line, uint16_t length, iwrap_rsp_inquiry_count_t *out) {
+    uint16_t pos = 8;
+    uint32_t value;
+    if (iwrap_scan_uint(line, length, &pos, 10, &value)) return 1;
+    out -> num_of_devices = value;
+    return 0;
+}
+
+/**
+ * @brief Decode "INQUIRY {addr} {class_of_device} [rssi]" response
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_rsp_inquiry_result(uint8_t *line, uint16_t length, iwrap_rsp_inquiry_result_t *out) {
+    uint16_t pos = 8;
+    uint32_t value;
+    int32_t rssi;
+    if (iwrap_scan_address(line, length, &pos, &out -> bd_addr) || iwrap_scan_skip(line, length, &pos, " ") || iwrap_scan_uint(line, length, &pos, 16, &value)) return 1;
+    out -> class_of_device = value;
+    out -> rssi = 0;
+    if (!iwrap_scan_skip(line, length, &pos, " ") && !iwrap_scan_int(line, length, &pos, &rssi)) {
+        out -> rssi = rssi;
+    }
+    return 0;
+}
+
+/**
+ * @brief Decode "LIST {num_of_connections}" response
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_rsp_list_count(uint8_t *line, uint16_t length, iwrap_rsp_list_count_t *out) {
+    uint16_t pos = 5;
+    uint32_t value;
+    if (iwrap_scan_uint(line, length, &pos, 10, &value)) return 1;
+    out -> num_of_connections = value;
+    return 0;
+}
+
+/**
+ * @brief Decode "LIST {link_id} CONNECTED ..." response
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_rsp_list_result(uint8_t *line, uint16_t length, iwrap_rsp_list_result_t *out) {
+    // LIST {link_id} CONNECTED {mode} {blocksize} 0 0 {elapsed_time} {local_msc} {remote_msc} {addr} {channel} {direction} {powermode} {role} {crypt} {buffer} [ERETX]
+    uint16_t pos = 5;
+    uint32_t value;
+    if (iwrap_scan_uint(line, length, &pos, 10, &value) || iwrap_scan_skip(line, length, &pos, " CONNECTED ")) return 1;
+    out -> link_id = value;
+    out -> mode = (char *)line + pos;
+    if (iwrap_scan_find(line, length, &pos, ' ')) return 1;
+    line[pos++] = 0; // null terminate for in-place string access to "mode" w/o reallocation
+    if (iwrap_scan_uint(line, length, &pos, 10, &value) || iwrap_scan_skip(line, length, &pos, " ")) return 1;
+    out -> blocksize = value;
+    // ...two fixed "0" arguments...
+    if (iwrap_scan_uint(line, length, &pos, 10, &value) || iwrap_scan_skip(line, length, &pos, " ")) return 1;
+    if (iwrap_scan_uint(line, length, &pos, 10, &value) || iwrap_scan_skip(line, length, &pos, " ")) return 1;
+    if (iwrap_scan_uint(line, length, &pos, 10, &value) || iwrap_scan_skip(line, length, &pos, " ")) return 1;
+    out -> elapsed_time = value;
+    if (iwrap_scan_uint(line, length, &pos, 16, &value) || iwrap_scan_skip(line, length, &pos, " ")) return 1;
+    out -> local_msc = value;
+    if (iwrap_scan_uint(line, length, &pos, 16, &value) || iwrap_scan_skip(line, length, &pos, " ")) return 1;
+    out -> remote_msc = value;
+    if (iwrap_scan_address(line, length, &pos, &out -> bd_addr) || iwrap_scan_skip(line, length, &pos, " ")) return 1;
+    if (iwrap_scan_uint(line, length, &pos, 16, &value) || iwrap_scan_skip(line, length, &pos, " ")) return 1;
+    out -> channel = value;
+    // remaining words are matched on first letter, offsets past the end are caught by the buffer parse
+    out -> direction = 0;
+    if (pos < length && line[pos] == 'O') { out -> direction = IWRAP_CONNECTION_DIRECTION_OUTGOING; pos += 9; }
+    else if (pos < length && line[pos] == 'I') { out -> direction = IWRAP_CONNECTION_DIRECTION_INCOMING; pos += 9; }
+    out -> powermode = 0;
+    if (pos < length && line[pos] == 'A') { out -> powermode = IWRAP_CONNECTION_POWERMODE_ACTIVE; pos += 7; }
+    else if (pos < length && line[pos] == 'S') { out -> powermode = IWRAP_CONNECTION_POWERMODE_SNIFF; pos += 6; }
+    else if (pos < length && line[pos] == 'H') { out -> powermode = IWRAP_CONNECTION_POWERMODE_HOLD; pos += 5; }
+    else if (pos < length && line[pos] == 'P') { out -> powermode = IWRAP_CONNECTION_POWERMODE_PARK; pos += 5; }
+    out -> role = 0;
+    if (pos < length && line[pos] == 'M') { out -> role = IWRAP_CONNECTION_ROLE_MASTER; pos += 7; }
+    else if (pos < length && line[pos] == 'S') { out -> role = IWRAP_CONNECTION_ROLE_SLAVE; pos += 6; }
+    out -> crypt = 0;
+    if (pos < length && line[pos] == 'P') { out -> crypt = IWRAP_CONNECTION_CRYPT_PLAIN; pos += 6; }
+    else if (pos < length && line[pos] == 'E') { out -> crypt = IWRAP_CONNECTION_CRYPT_ENCRYPTED; pos += 10; }
+    if (iwrap_scan_uint(line, length, &pos, 10, &value)) return 1;
+    out -> buffer = value;
+    out -> eretx = !iwrap_scan_skip(line, length, &pos, " E");
+    return 0;
+}
+
+/**
+ * @brief Decode "PAIR {bd_addr} {result}" response
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_rsp_pair(uint8_t *line, uint16_t length, iwrap_rsp_pair_t *out) {
+    uint16_t pos = 5;
+    if (iwrap_scan_address(line, length, &pos, &out -> bd_addr) || iwrap_scan_skip(line, length, &pos, " ") || pos >= length) return 1;
+    out -> result = line[pos] == 'O' ? 0 : 1;
+    return 0;
+}
+
+/**
+ * @brief Decode "SET {category} {option} {value}" response line
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_rsp_set(uint8_t *line, uint16_t length, iwrap_rsp_set_t *out) {
+    uint16_t pos = 0, end = iwrap_scan_end(line, length);
+    out -> category = 0;
+    if (end > 4 && line[4] == 'B') {           // SET BT ...
+        out -> category = IWRAP_SET_CATEGORY_BT;
+        pos = 7;
+    } else if (end > 4 && line[4] == 'C') {    // SET CONTROL ...
+        out -> category = IWRAP_SET_CATEGORY_CONTROL;
+        pos = 12;
+    } else if (end > 4 && line[4] == 'P') {    // SET PROFILE ...
+        out -> category = IWRAP_SET_CATEGORY_PROFILE;
+        pos = 12;
+    }
+
+    // ensure we have detected a valid category, and the line ending can be null terminated
+    if (!out -> category || pos > end || end == length) return 1;
+    line[end] = 0; // null terminate
+    out -> option = (char *)line + pos;
+    if (iwrap_scan_find(line, end, &pos, ' ')) pos = end; // option without value
+    else line[pos++] = 0;
+    out -> value = (char *)line + pos;
+    return 0;
+}
+
+/**
+ * @brief Decode "A2DP STREAMING START {link_id}" event
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_evt_a2dp_streaming_start(uint8_t *line, uint16_t length, iwrap_evt_a2dp_streaming_start_t *out) {
+    uint16_t pos = 20;
+    uint32_t value;
+    if (iwrap_scan_uint(line, length, &pos, 10, &value)) return 1;
+    out -> link_id = value;
+    return 0;
+}
+
+/**
+ * @brief Decode "A2DP STREAMING STOP {link_id}" event
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_evt_a2dp_streaming_stop(uint8_t *line, uint16_t length, iwrap_evt_a2dp_streaming_stop_t *out) {
+    uint16_t pos = 19;
+    uint32_t value;
+    if (iwrap_scan_uint(line, length, &pos, 10, &value)) return 1;
+    out -> link_id = value;
+    return 0;
+}
+
+/**
+ * @brief Decode "CONNECT {link_id} {profile} {target} [address]" event
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_evt_connect(uint8_t *line, uint16_t length, iwrap_evt_connect_t *out) {
+    uint16_t pos = 8;
+    uint32_t value;
+    if (iwrap_scan_uint(line, length, &pos, 10, &value) || iwrap_scan_skip(line, length, &pos, " ")) return 1;
+    out -> link_id = value;
+    out -> profile = (char *)line + pos;
+    if (iwrap_scan_find(line, length, &pos, ' ')) return 1;
+    line[pos++] = 0; // null terminate profile
+    if (iwrap_scan_uint(line, length, &pos, 16, &value)) return 1;
+    out -> target = value;
+    // optional [address] parameter present
+    out -> has_address = !iwrap_scan_skip(line, length, &pos, " ") && !iwrap_scan_address(line, length, &pos, &out -> address);
+    return 0;
+}
+
+/**
+ * @brief Decode "HID {link_id} OUTPUT {data_length} {data}" event (data is decoded in place)
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_evt_hid_output(uint8_t *line, uint16_t length, iwrap_evt_hid_output_t *out) {
+    uint16_t pos = 4;
+    uint32_t value;
+    if (iwrap_scan_uint(line, length, &pos, 10, &value) || iwrap_scan_skip(line, length, &pos, " OUTPUT ")) return 1;
+    out -> link_id = value;
+    if (iwrap_scan_uint(line, length, &pos, 16, &value) || iwrap_scan_skip(line, length, &pos, " ")) return 1;
+    out -> data_length = value;
+    out -> data = line + pos; // hex string is twice as long as binary, so decode over itself
+    if (iwrap_scan_hex(line, length, &pos, line + pos, out -> data_length) != out -> data_length) return 1;
+    return 0;
+}
+
+/**
+ * @brief Decode "HID {link_id} SUSPEND" event
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_evt_hid_suspend(uint8_t *line, uint16_t length, iwrap_evt_hid_suspend_t *out) {
+    uint16_t pos = 4;
+    uint32_t value;
+    if (iwrap_scan_uint(line, length, &pos, 10, &value)) return 1;
+    out -> link_id = value;
+    return 0;
+}
+
+/**
+ * @brief Decode "HFP {link_id} {type} [detail]" event
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_evt_hfp(uint8_t *line, uint16_t length, iwrap_evt_hfp_t *out) {
+    uint16_t pos = 4, end = iwrap_scan_end(line, length);
+    uint32_t value;
+    if (end == length || iwrap_scan_uint(line, end, &pos, 10, &value) || iwrap_scan_skip(line, end, &pos, " ")) return 1;
+    out -> link_id = value;
+    line[end] = 0; // null terminate
+    out -> type = (char *)line + pos;
+    if (iwrap_scan_find(line, end, &pos, ' ')) pos = end; // no detail
+    else line[pos++] = 0; // null terminate type
+    out -> detail = (char *)line + pos;
+    return 0;
+}
+
+/**
+ * @brief Decode "HFP-AG {link_id} {type} [detail]" event
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_evt_hfp_ag(uint8_t *line, uint16_t length, iwrap_evt_hfp_ag_t *out) {
+    uint16_t pos = 7, end = iwrap_scan_end(line, length);
+    uint32_t value;
+    if (end == length || iwrap_scan_uint(line, end, &pos, 10, &value) || iwrap_scan_skip(line, end, &pos, " ")) return 1;
+    out -> link_id = value;
+    line[end] = 0; // null terminate
+    out -> type = (char *)line + pos;
+    if (iwrap_scan_find(line, end, &pos, ' ')) pos = end; // no detail
+    else line[pos++] = 0; // null terminate type
+    out -> detail = (char *)line + pos;
+    return 0;
+}
+
+/**
+ * @brief Decode "IDENT {src}:{vendor_id} {product_id} {version} "[descr]"" event
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_evt_ident(uint8_t *line, uint16_t length, iwrap_evt_ident_t *out) {
+    uint16_t pos = 6;
+    uint32_t value;
+    out -> src = (char *)line + pos;
+    if (iwrap_scan_find(line, length, &pos, ':')) return 1;
+    line[pos++] = 0; // null terminate "src" string
+    if (iwrap_scan_uint(line, length, &pos, 16, &value) || iwrap_scan_skip(line, length, &pos, " ")) return 1;
+    out -> vendor_id = value;
+    if (iwrap_scan_uint(line, length, &pos, 16, &value) || iwrap_scan_skip(line, length, &pos, " ")) return 1;
+    out -> product_id = value;
+    out -> version = (char *)line + pos;
+    if (iwrap_scan_find(line, length, &pos, ' ')) return 1;
+    line[pos++] = 0; // null terminate "version" string
+    if (iwrap_scan_skip(line, length, &pos, "\"")) return 1;
+    out -> descr = (char *)line + pos;
+    if (iwrap_scan_find(line, length, &pos, '"')) return 1;
+    line[pos] = 0; // null terminate "descr" string
+    return 0;
+}
+
+/**
+ * @brief Decode "IDENT ERROR {error_code} {address} [message]" event
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_evt_ident_error(uint8_t *line, uint16_t length, iwrap_evt_ident_error_t *out) {
+    uint16_t pos = 12, end = iwrap_scan_end(line, length);
+    uint32_t value;
+    if (iwrap_scan_uint(line, end, &pos, 16, &value) || iwrap_scan_skip(line, end, &pos, " ") || iwrap_scan_address(line, end, &pos, &out -> address)) return 1;
+    out -> error_code = value;
+    out -> message = 0;
+    if (pos + 1 < end && end < length && !iwrap_scan_skip(line, end, &pos, " ")) {
+        // optional [message] parameter present
+        line[end] = 0; // null terminate
+        out -> message = (char *)line + pos;
+    }
+    return 0;
 }
 
-#ifdef IWRAP_INCLUDE_MUX
-    
+/**
+ * @brief Decode "INQUIRY_EXTENDED {addr} RAW {data}" event (data is decoded in place)
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error, or EIR rejected by iwrap_eir_filter)
+ */
+uint8_t iwrap_decode_evt_inquiry_extended(uint8_t *line, uint16_t length, iwrap_evt_inquiry_extended_t *out) {
+    uint16_t pos = 17;
+    if (iwrap_scan_address(line, length, &pos, &out -> address) || iwrap_scan_skip(line, length, &pos, " RAW ")) return 1;
+    out -> data = line + pos; // hex string is twice as long as binary, so decode over itself
+    out -> length = iwrap_scan_hex(line, length, &pos, line + pos, 255);
+    #ifdef IWRAP_INCLUDE_EIR
+        // rejected here, nothing is delivered to callback, sinks or C++ handler
+        if (!iwrap_eir_accept(out -> data, out -> length)) return 1;
+    #endif
+    return 0;
+}
+
+/**
+ * @brief Decode "INQUIRY_PARTIAL {address} {class_of_device} [{cached_name} {rssi}]" event
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_evt_inquiry_partial(uint8_t *line, uint16_t length, iwrap_evt_inquiry_partial_t *out) {
+    uint16_t pos = 16;
+    uint32_t value;
+    int32_t rssi;
+    if (iwrap_scan_address(line, length, &pos, &out -> address) || iwrap_scan_skip(line, length, &pos, " ") || iwrap_scan_uint(line, length, &pos, 16, &value)) return 1;
+    out -> class_of_device = value;
+    out -> cached_name = 0;
+    out -> rssi = 0;
+    if (!iwrap_scan_skip(line, length, &pos, " \"")) {
+        // optional [{cached_name} {rssi}] values present
+        out -> cached_name = (char *)line + pos;
+        if (iwrap_scan_find(line, length, &pos, '"')) return 1;
+        line[pos++] = 0; // null terminate name string
+        if (iwrap_scan_skip(line, length, &pos, " ") || iwrap_scan_int(line, length, &pos, &rssi)) return 1;
+        out -> rssi = rssi;
+    }
+    return 0;
+}
+
+/**
+ * @brief Decode "NAME {bd_addr} "{name}"" event
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_evt_name(uint8_t *line, uint16_t length, iwrap_evt_name_t *out) {
+    uint16_t pos = 5;
+    if (iwrap_scan_address(line, length, &pos, &out -> address) || iwrap_scan_skip(line, length, &pos, " \"")) return 1;
+    out -> friendly_name = (char *)line + pos;
+    if (iwrap_scan_find(line, length, &pos, '"')) return 1;
+    line[pos] = 0; // null terminate name string
+    return 0;
+}
+
+/**
+ * @brief Decode "NAME ERROR {error_code} {bd_addr} [reason]" event
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_evt_name_error(uint8_t *line, uint16_t length, iwrap_evt_name_error_t *out) {
+    uint16_t pos = 11, end = iwrap_scan_end(line, length);
+    uint32_t value;
+    if (iwrap_scan_uint(line, end, &pos, 16, &value) || iwrap_scan_skip(line, end, &pos, " ") || iwrap_scan_address(line, end, &pos, &out -> address)) return 1;
+    out -> error_code = value;
+    out -> message = 0;
+    if (pos + 1 < end && end < length && !iwrap_scan_skip(line, end, &pos, " ")) {
+        // optional [message] parameter present
+        line[end] = 0; // null terminate
+        out -> message = (char *)line + pos;
+    }
+    return 0;
+}
+
+/**
+ * @brief Decode "NO CARRIER {link_id} ERROR {error_code} [message]" event
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_evt_no_carrier(uint8_t *line, uint16_t length, iwrap_evt_no_carrier_t *out) {
+    uint16_t pos = 11, end = iwrap_scan_end(line, length);
+    uint32_t value;
+    if (end == length || iwrap_scan_uint(line, end, &pos, 10, &value) || iwrap_scan_skip(line, end, &pos, " ERROR ")) return 1;
+    out -> link_id = value;
+    if (iwrap_scan_uint(line, end, &pos, 16, &value)) return 1;
+    out -> error_code = value;
+    iwrap_scan_skip(line, end, &pos, " ");
+    line[end] = 0; // null terminate
+    out -> message = (char *)line + pos; // empty if no message
+    return 0;
+}
+
+/**
+ * @brief Decode "PAIR {address} {key_type} {link_key}" event (link key is decoded in place)
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_evt_pair(uint8_t *line, uint16_t length, iwrap_evt_pair_t *out) {
+    uint16_t pos = 5;
+    uint32_t value;
+    if (iwrap_scan_address(line, length, &pos, &out -> address) || iwrap_scan_skip(line, length, &pos, " ")) return 1;
+    if (iwrap_scan_uint(line, length, &pos, 16, &value) || iwrap_scan_skip(line, length, &pos, " ")) return 1;
+    out -> key_type = value;
+    out -> link_key = line + pos; // hex string is twice as long as binary, so decode over itself
+    if (iwrap_scan_hex(line, length, &pos, line + pos, 16) != 16) return 1;
+    return 0;
+}
+
+/**
+ * @brief Decode "RING {link_id} {address} {SCO | {channel} {profile}}" event
+ * @param line Raw line received from iWRAP (modified in place)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_evt_ring(uint8_t *line, uint16_t length, iwrap_evt_ring_t *out) {
+    uint16_t pos = 5, end = iwrap_scan_end(line, length);
+    uint32_t value;
+    if (end == length || iwrap_scan_uint(line, end, &pos, 10, &value) || iwrap_scan_skip(line, end, &pos, " ")) return 1;
+    out -> link_id = value;
+    if (iwrap_scan_address(line, end, &pos, &out -> address) || iwrap_scan_skip(line, end, &pos, " ") || pos >= end) return 1;
+    line[end] = 0; // null terminate
+    out -> channel = 0;
+    if (line[pos] != 'S') {
+        // not SCO, so "channel" parameter is present
+        if (iwrap_scan_uint(line, end, &pos, 16, &value) || iwrap_scan_skip(line, end, &pos, " ")) return 1;
+        out -> channel = value;
+    }
+    out -> profile = (char *)line + pos;
+    if (!iwrap_scan_find(line, end, &pos, ' ')) line[pos] = 0; // null terminate profile if anything follows it
+    return 0;
+}
+
+/**
+ * @brief Decode "BER {bd_addr} {ber}" response
+ * @param line Raw line received from iWRAP (not modified)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate (ber in parts per million)
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_rsp_ber(uint8_t *line, uint16_t length, iwrap_rsp_ber_t *out) {
+    uint16_t pos = 4, scale;
+    uint32_t value;
+    if (iwrap_scan_address(line, length, &pos, &out -> bd_addr) || iwrap_scan_skip(line, length, &pos, " ") || iwrap_scan_uint(line, length, &pos, 10, &value)) return 1;
+    // percentage with up to four decimals, so 0.0001 % is one part per million
+    out -> ber = value * 10000;
+    if (!iwrap_scan_skip(line, length, &pos, ".")) {
+        for (scale = 1000; scale && pos < length && line[pos] >= '0' && line[pos] <= '9'; scale /= 10, pos++) out -> ber += (line[pos] - '0') * scale;
+    }
+    return 0;
+}
+
+/**
+ * @brief Decode "RSSI {bd_addr} {rssi}" response
+ * @param line Raw line received from iWRAP (not modified)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_rsp_rssi(uint8_t *line, uint16_t length, iwrap_rsp_rssi_t *out) {
+    uint16_t pos = 5;
+    int32_t value;
+    if (iwrap_scan_address(line, length, &pos, &out -> bd_addr) || iwrap_scan_skip(line, length, &pos, " ") || iwrap_scan_int(line, length, &pos, &value)) return 1;
+    out -> rssi = value;
+    return 0;
+}
+
+/**
+ * @brief Decode "TEMP {temp}" response
+ * @param line Raw line received from iWRAP (not modified)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_rsp_temp(uint8_t *line, uint16_t length, iwrap_rsp_temp_t *out) {
+    uint16_t pos = 5;
+    int32_t value;
+    if (iwrap_scan_int(line, length, &pos, &value)) return 1;
+    out -> temp = value;
+    return 0;
+}
+
+/**
+ * @brief Decode "TXPOWER {bd_addr} {txpower}" response
+ * @param line Raw line received from iWRAP (not modified)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_rsp_txpower(uint8_t *line, uint16_t length, iwrap_rsp_txpower_t *out) {
+    uint16_t pos = 8;
+    int32_t value;
+    if (iwrap_scan_address(line, length, &pos, &out -> bd_addr) || iwrap_scan_skip(line, length, &pos, " ") || iwrap_scan_int(line, length, &pos, &value)) return 1;
+    out -> txpower = value;
+    return 0;
+}
+
+/**
+ * @brief Decode "BATTERY {mv}" response
+ * @param line Raw line received from iWRAP (not modified)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_evt_battery(uint8_t *line, uint16_t length, iwrap_evt_battery_t *out) {
+    uint16_t pos = 8;
+    uint32_t value;
+    if (iwrap_scan_uint(line, length, &pos, 10, &value)) return 1;
+    out -> mv = value;
+    return 0;
+}
+
+/**
+ * @brief Decode "BATTERY FULL [mv]" event
+ * @param line Raw line received from iWRAP (not modified)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate (mv is 0 if not reported)
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_evt_battery_full(uint8_t *line, uint16_t length, iwrap_evt_battery_full_t *out) {
+    uint16_t pos = 13;
+    uint32_t value;
+    out -> mv = iwrap_scan_uint(line, length, &pos, 10, &value) ? 0 : value;
+    return 0;
+}
+
+/**
+ * @brief Decode "BATTERY LOW [mv]" event
+ * @param line Raw line received from iWRAP (not modified)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate (mv is 0 if not reported)
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_evt_battery_low(uint8_t *line, uint16_t length, iwrap_evt_battery_low_t *out) {
+    uint16_t pos = 12;
+    uint32_t value;
+    out -> mv = iwrap_scan_uint(line, length, &pos, 10, &value) ? 0 : value;
+    return 0;
+}
+
+/**
+ * @brief Decode "BATTERY SHUTDOWN [mv]" event
+ * @param line Raw line received from iWRAP (not modified)
+ * @param length Length of raw line in bytes
+ * @param out Record to populate (mv is 0 if not reported)
+ * @return Result code (non-zero indicates error)
+ */
+uint8_t iwrap_decode_evt_battery_shutdown(uint8_t *line, uint16_t length, iwrap_evt_battery_shutdown_t *out) {
+    uint16_t pos = 17;
+    uint32_t value;
+    out -> mv = iwrap_scan_uint(line, length, &pos, 10, &value) ? 0 : value;
+    return 0;
+}
+
+#ifdef IWRAP_INCLUDE_EVENTS
     /**
-     * @brief Build MUX frame from given raw data and channel
-     * @param channel Link ID or iWRAP command channel (0xFF)
-     * @param in_len Full length of raw data byte array to pack into MUX frame
-     * @param in Raw data byte array
-     * @param out_len Full length of populated MUX frame byte array
-     * @param out Byte array to populate with new data (must be pre-allocated)
-     * @return Result code (non-zero indicates error)
+     * @brief Translate pointer from one copy of a raw line into another copy
+     * @param ptr Pointer into original line (may be null)
+     * @param from Start of original line
+     * @param to Start of new line
+     * @return Equivalent pointer into new line
      */
-    uint8_t iwrap_pack_mux_frame(uint8_t channel, uint16_t in_len, uint8_t *in, uint16_t *out_len, uint8_t **out) {
-        // allocate enough memory for the whole MUX frame
-        *out = (uint8_t *)malloc(in_len + 5);
-        
-        // make sure allocation completed successfully
-        if (out == 0) { return 1; }
-        
-        // build frame
-        *out_len = in_len + 5;
-        (*out)[0] = 0xBF;
-        (*out)[1] = channel;
-        (*out)[2] = 0x00 | ((in_len >> 8) & 0x03); // flags = 0 always in latest iWRAP (2014-05-05)
-        (*out)[3] = in_len;
-        memcpy((*out) + 4, in, in_len);
-        (*out)[in_len + 4] = channel ^ 0xFF;
-        return 0;
+    const void *iwrap_event_rebase(const void *ptr, const uint8_t *from, const uint8_t *to) {
+        if (!ptr) return 0;
+        return to + ((const uint8_t *)ptr - from);
     }
 
     /**
-     * @brief Disassemble MUX frame into components
-     * @param in_len Full length of MUX frame
-     * @param in MUX frame byte array
-     * @param channel MUX frame channel
-     * @param flags MUX frame flags byte
-     * @param length Payload data length
-     * @param out Payload data byte array
-     * @param copy Flag to enable copying to new memory (non-zero), or just pointers to existing memory
-     * @return Result code (non-zero indicates error)
+     * @brief Add copy of decoded event to queue (producer side)
+     * @param queue Event queue (zero-initialized before first use)
+     * @param event Decoded event record to copy
+     * @return Result code (non-zero indicates event was dropped)
      */
-    uint8_t iwrap_unpack_mux_frame(uint16_t in_len, uint8_t *in, uint8_t *channel, uint8_t *flags, uint16_t *length, uint8_t **out, uint8_t copy) {
-        if (in_len < 5 || in[0] != 0xBF) { return 2; }          // invalid MUX frame size/format
-        if ((in[1] ^ 0xFF) != in[in_len - 1]) { return 3; }     // checksum failure
-        
-        *channel = in[1];
-        *flags = in[2] >> 2;
-        *length = in[3] | ((in[2] & 0x03) << 8);
-        
-        if (copy) {
-            // allocate enough memory for the payload data
-            *out = (uint8_t *)malloc(*length);
-            
-            // make sure allocation completed successfully
-            if (out == 0) { return 1; }
-            
-            // copy payload into new allocated block
-            memcpy(*out, in + 4, *length);
-        } else {
-            // just create a pointer
-            *out = in + 4;
+    uint8_t iwrap_event_queue_push(iwrap_event_queue_t *queue, const iwrap_event_t *event) {
+        uint8_t head = queue -> head, next = (head + 1) % IWRAP_EVENT_QUEUE_SIZE;
+        iwrap_event_slot_t *slot;
+        const uint8_t *from;
+
+        // make sure there is room for the event and its raw line
+        if (next == queue -> tail || event -> length > IWRAP_EVENT_LINE_SIZE) {
+            queue -> dropped++;
+            return 1;
+        }
+
+        // copy record and line, then point all string/byte members at the copy
+        slot = &queue -> slots[head];
+        from = event -> line;
+        if (event -> length) memcpy(slot -> line, from, event -> length);
+        memcpy(&slot -> event, event, sizeof(iwrap_event_t));
+        slot -> event.line = slot -> line;
+        #define IWRAP_REBASE(member, type) slot -> event.data.member = (type)iwrap_event_rebase(slot -> event.data.member, from, slot -> line)
+        switch (event -> type) {
+            case IWRAP_EVENT_RSP_HID_GET: IWRAP_REBASE(rsp_hid_get.descriptor, const uint8_t *); break;
+            case IWRAP_EVENT_RSP_INFO: IWRAP_REBASE(rsp_info.info, const char *); break;
+            case IWRAP_EVENT_RSP_LIST_RESULT: IWRAP_REBASE(rsp_list_result.mode, const char *); break;
+            case IWRAP_EVENT_RSP_SET:
+                IWRAP_REBASE(rsp_set.option, const char *);
+                IWRAP_REBASE(rsp_set.value, const char *);
+                break;
+            case IWRAP_EVENT_CONNECT: IWRAP_REBASE(evt_connect.profile, const char *); break;
+            case IWRAP_EVENT_HID_OUTPUT: IWRAP_REBASE(evt_hid_output.data, const uint8_t *); break;
+            case IWRAP_EVENT_HFP:
+                IWRAP_REBASE(evt_hfp.type, const char *);
+                IWRAP_REBASE(evt_hfp.detail, const char *);
+                break;
+            case IWRAP_EVENT_HFP_AG:
+                IWRAP_REBASE(evt_hfp_ag.type, const char *);
+                IWRAP_REBASE(evt_hfp_ag.detail, const char *);
+                break;
+            case IWRAP_EVENT_IDENT:
+                IWRAP_REBASE(evt_ident.src, const char *);
+                IWRAP_REBASE(evt_ident.version, const char *);
+                IWRAP_REBASE(evt_ident.descr, const char *);
+                break;
+            case IWRAP_EVENT_IDENT_ERROR: IWRAP_REBASE(evt_ident_error.message, const char *); break;
+            case IWRAP_EVENT_INQUIRY_EXTENDED: IWRAP_REBASE(evt_inquiry_extended.data, const uint8_t *); break;
+            case IWRAP_EVENT_INQUIRY_PARTIAL: IWRAP_REBASE(evt_inquiry_partial.cached_name, const char *); break;
+            case IWRAP_EVENT_NAME: IWRAP_REBASE(evt_name.friendly_name, const char *); break;
+            case IWRAP_EVENT_NAME_ERROR: IWRAP_REBASE(evt_name_error.message, const char *); break;
+            case IWRAP_EVENT_NO_CARRIER: IWRAP_REBASE(evt_no_carrier.message, const char *); break;
+            case IWRAP_EVENT_PAIR: IWRAP_REBASE(evt_pair.link_key, const uint8_t *); break;
+            case IWRAP_EVENT_RING: IWRAP_REBASE(evt_ring.profile, const char *); break;
         }
+        #undef IWRAP_REBASE
+
+        // publish slot contents before moving head
+        IWRAP_MEMORY_BARRIER();
+        queue -> head = next;
         return 0;
     }
-#endif /* IWRAP_INCLUDE_MUX */
+
+    /**
+     * @brief Get oldest queued event without removing it (consumer side)
+     * @param queue Event queue
+     * @return Pointer to event record (valid until iwrap_event_queue_pop), or 0 if queue is empty
+     */
+    const iwrap_event_t *iwrap_event_queue_peek(iwrap_event_queue_t *queue) {
+        if (queue -> tail == queue -> head) return 0;
+        IWRAP_MEMORY_BARRIER(); // read slot contents only after seeing new head
+        return &queue -> slots[queue -> tail].event;
+    }
+
+    /**
+     * @brief Release oldest queued event after it has been handled (consumer side)
+     * @param queue Event queue
+     */
+    void iwrap_event_queue_pop(iwrap_event_queue_t *queue) {
+        if (queue -> tail == queue -> head) return;
+        IWRAP_MEMORY_BARRIER(); // finish reading slot before handing it back to producer
+        queue -> tail = (queue -> tail + 1) % IWRAP_EVENT_QUEUE_SIZE;
+    }
+
+    /**
+     * @brief Pass decoded event to record callback and/or event queue
+     * @param event Decoded event record
+     */
+    void iwrap_emit_event(const iwrap_event_t *event) {
+        if (iwrap_callback_event) iwrap_callback_event(event);
+        if (iwrap_event_queue) iwrap_event_queue_push(iwrap_event_queue, event);
+    }
+#endif /* IWRAP_INCLUDE_EVENTS */
+
+/**
+ * @brief Find end of line content, before any trailing CR/LF characters
+ * @param line Raw line received from iWRAP
+ * @param length Length of raw line in bytes
+ * @return Length of line content without line ending
+ */
+uint16_t iwrap_scan_end(const uint8_t *line, uint16_t length) {
+    while (length && (line[length - 1] == '\r' || line[length - 1] == '\n')) length--;
+    return length;
+}
+
+/**
+ * @brief Parse unsigned decimal or hexadecimal number, never reading past line length
+ * @param line Raw line received from iWRAP
+ * @param length Length of raw line in bytes
+ * @param pos Offset to start parsing at, advanced past parsed digits
+ * @param base Number base (10 or 16, hexadecimal also accepts "0x" prefix)
+ * @param value Parsed number
+ * @return Result code (non-zero indicates no digits found)
+ */
+uint8_t iwrap_scan_uint(const uint8_t *line, uint16_t length, uint16_t *pos, uint8_t base, uint32_t *value) {
+    uint16_t i = *pos, start;
+    uint8_t b;
+    if (base == 16 && i + 2 < length && line[i] == '0' && (line[i + 1] == 'x' || line[i + 1] == 'X')) i += 2;
+    for (*value = 0, start = i; i < length; i++) {
+        b = line[i];
+        if (b > 0x2F && b < 0x3A) b -= 0x30;
+        else if (base == 16 && b > 0x40 && b < 0x47) b -= 0x37;
+        else if (base == 16 && b > 0x60 && b < 0x67) b -= 0x57;
+        else break; // no more digits
+        *value = (*value * base) + b;
+    }
+    if (i == start) return 1;
+    *pos = i;
+    return 0;
+}
+
+/**
+ * @brief Parse signed decimal number, never reading past line length
+ * @param line Raw line received from iWRAP
+ * @param length Length of raw line in bytes
+ * @param pos Offset to start parsing at, advanced past parsed digits
+ * @param value Parsed number
+ * @return Result code (non-zero indicates no digits found)
+ */
+uint8_t iwrap_scan_int(const uint8_t *line, uint16_t length, uint16_t *pos, int32_t *value) {
+    uint16_t i = *pos;
+    uint32_t magnitude;
+    uint8_t negative = i < length && line[i] == '-';
+    if (negative) i++;
+    if (iwrap_scan_uint(line, length, &i, 10, &magnitude)) return 1;
+    *value = negative ? -(int32_t)magnitude : (int32_t)magnitude;
+    *pos = i;
+    return 0;
+}
+
+/**
+ * @brief Parse "00:07:80:..." Bluetooth address, never reading past line length
+ * @param line Raw line received from iWRAP
+ * @param length Length of raw line in bytes
+ * @param pos Offset to start parsing at, advanced past address
+ * @param address Parsed address
+ * @return Result code (non-zero indicates short or malformed address)
+ */
+uint8_t iwrap_scan_address(const uint8_t *line, uint16_t length, uint16_t *pos, iwrap_address_t *address) {
+    uint8_t i;
+    if (*pos + 17 > length) return 1;
+    for (i = 2; i < 17; i += 3) if (line[*pos + i] != ':') return 1;
+    if (iwrap_hexstrtobin((const char *)line + *pos, 0, address -> address, 17) != 17) return 1;
+    *pos += 17;
+    return 0;
+}
+
+/**
+ * @brief Skip literal text, never reading past line length
+ * @param line Raw line received from iWRAP
+ * @param length Length of raw line in bytes
+ * @param pos Offset to compare at, advanced past text if it matches
+ * @param text Expected text
+ * @return Result code (non-zero indicates text does not match)
+ */
+uint8_t iwrap_scan_skip(const uint8_t *line, uint16_t length, uint16_t *pos, const char *text) {
+    uint16_t len = strlen(text);
+    if (*pos + len > length || memcmp(line + *pos, text, len)) return 1;
+    *pos += len;
+    return 0;
+}
+
+/**
+ * @brief Find next occurrence of character, never reading past line length
+ * @param line Raw line received from iWRAP
+ * @param length Length of raw line in bytes
+ * @param pos Offset to start searching at, moved to matching character
+ * @param c Character to find
+ * @return Result code (non-zero indicates character not found)
+ */
+uint8_t iwrap_scan_find(const uint8_t *line, uint16_t length, uint16_t *pos, uint8_t c) {
+    const uint8_t *found;
+    if (*pos >= length) return 1;
+    found = (const uint8_t *)memchr(line + *pos, c, length - *pos);
+    if (!found) return 1;
+    *pos = found - line;
+    return 0;
+}
+
+/**
+ * @brief Parse %02X... hexadecimal string into binary byte array, never reading past line length
+ * @param line Raw line received from iWRAP
+ * @param length Length of raw line in bytes
+ * @param pos Offset to start parsing at, advanced past parsed characters
+ * @param dest Container for parsed binary data (may be line + pos to decode in place)
+ * @param maxlen Maximum number of bytes to parse
+ * @return Number of bytes actually parsed
+ */
+uint16_t iwrap_scan_hex(const uint8_t *line, uint16_t length, uint16_t *pos, uint8_t *dest, uint16_t maxlen) {
+    uint16_t i;
+    uint8_t j, b, n;
+    for (i = 0; i < maxlen && *pos + 2 <= length; i++) {
+        for (b = 0, j = 0; j < 2; j++) {
+            n = line[*pos + j];
+            if (n > 0x2F && n < 0x3A) n -= 0x30;
+            else if (n > 0x40 && n < 0x47) n -= 0x37;
+            else if (n > 0x60 && n < 0x67) n -= 0x57;
+            else return i; // no more hexadecimal characters
+            b = (b << 4) | n;
+        }
+        dest[i] = b; // written behind the two characters it came from, so decoding in place is safe
+        *pos += 2;
+    }
+    return i;
+}
 
 /**
  * @brief Parse %02X... hexadecimal string into binary byte array
@@ -850,46 +5018,148 @@ uint8_t iwrap_bintohexstr(const uint8_t *bin, uint16_t len, char **dest, uint8_t
     return delin ? (mult * len) - 1 : (mult * len) - 1;
 }
 
+/**
+ * @brief Convert unsigned integer to null-terminated decimal string
+ * @param value Value to convert
+ * @param dest Destination buffer (at least 11 bytes)
+ * @return Number of characters written, not including the null terminator
+ */
+uint8_t iwrap_utoa(uint32_t value, char *dest) {
+    char s[10];
+    uint8_t i = 0, length;
+    do {
+        s[i++] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    length = i;
+    while (i) *dest++ = s[--i];
+    *dest = 0;
+    return length;
+}
+
 #ifdef IWRAP_DEBUG
-    /**
-     * @brief Output single character using debug transport function
-     * @param b
-     * @return Value from user-supplied debug output function
-     */
-    int iwrap_debug_char(char b) {
-        char s[2];
-        s[0] = b;
-        s[1] = 0;
-        return iwrap_debug(s);
-    }
-    
-    /**
-     * @brief Output %02X hex byte in ASCII format using debug transport function
-     * @param b
-     * @return Value from user-supplied debug output function
-     */
-    int iwrap_debug_hex(uint8_t b) {
-        char s[3];
-        s[0] = (b >> 4) + 48 + ((b >> 4) / 10 * 7);
-        s[1] = (b & 0x0f) + 48 + ((b & 0x0f) / 10 * 7);
-        s[2] = 0;
-        return iwrap_debug(s);
-    }
+    // escape letters for control characters, 0 means "\xHH" instead
+    const char iwrap_debug_escapes[32] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 't', 'n', 0, 0, 'r', 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+    };
+    const char iwrap_debug_hex_digits[] = "0123456789ABCDEF";
 
     /**
-     * @brief Output integer in ASCII format using debug transport function
-     * @param i Integer to display
-     * @return Value from user-supplied debug output function
+     * @brief Render one RX/TX frame into the debug line buffer and output it with a single call
+     * @param prefix Line prefix (at most 8 characters), e.g. "<= RX "
+     * @param channel MUX channel or link ID (0xFF for command channel)
+     * @param length Payload length in bytes
+     * @param data Payload data
+     *
+     * Output is "{prefix}{channel:02X}, {length}:\t{escaped payload}\n", truncated
+     * with "..." to fit IWRAP_DEBUG_LINE_SIZE. Frames are skipped according to
+     * iwrap_debug_sample and iwrap_debug_rate_limit; the next line written after
+     * any were skipped starts with "[+{count}] ".
      */
-    int iwrap_debug_int(int32_t i) {
-        char s[12];
-        itoa(i, s, 10); // smaller flash usage than sprintf(), but itoa() isn't ANSI C
-        //sprintf(s, "%ld", i); // larger flash usage for some MCUs than itoa()
-        return iwrap_debug(s);
+    void iwrap_debug_frame(const char *prefix, uint8_t channel, uint16_t length, const uint8_t *data) {
+        char *p = iwrap_debug_line, *end = iwrap_debug_line + IWRAP_DEBUG_LINE_SIZE - 5; // room for "...\n"
+        uint16_t i;
+        uint8_t b;
+        iwrap_time_t now;
+
+        if (!iwrap_debug || !iwrap_debug_sample) return;
+
+        // sampling: only every Nth frame
+        if (++iwrap_debug_sample_count < iwrap_debug_sample) {
+            iwrap_debug_suppressed++;
+            iwrap_debug_unreported++;
+            return;
+        }
+        iwrap_debug_sample_count = 0;
+
+        // rate limit: at most N frames per one-second window
+        if (iwrap_debug_rate_limit && iwrap_timestamp) {
+            now = iwrap_timestamp();
+            if (now - iwrap_debug_window_start >= IWRAP_TIME_RATE) {
+                iwrap_debug_window_start = now;
+                iwrap_debug_window_count = 0;
+            }
+            if (iwrap_debug_window_count >= iwrap_debug_rate_limit) {
+                iwrap_debug_suppressed++;
+                iwrap_debug_unreported++;
+                return;
+            }
+            iwrap_debug_window_count++;
+        }
+
+        if (iwrap_debug_unreported) {
+            *p++ = '[';
+            *p++ = '+';
+            p += iwrap_utoa(iwrap_debug_unreported, p);
+            *p++ = ']';
+            *p++ = ' ';
+            iwrap_debug_unreported = 0;
+        }
+        for (i = 0; prefix[i] && i < 8; i++) *p++ = prefix[i];
+        *p++ = iwrap_debug_hex_digits[channel >> 4];
+        *p++ = iwrap_debug_hex_digits[channel & 0x0f];
+        *p++ = ',';
+        *p++ = ' ';
+        p += iwrap_utoa(length, p);
+        *p++ = ':';
+        *p++ = '\t';
+        for (i = 0; i < length && p + 4 <= end; i++) {
+            b = data[i];
+            if (b > 31 && b < 127) {
+                *p++ = b;
+            } else if (b < 32 && iwrap_debug_escapes[b]) {
+                *p++ = '\\';
+                *p++ = iwrap_debug_escapes[b];
+            } else {
+                *p++ = '\\';
+                *p++ = 'x';
+                *p++ = iwrap_debug_hex_digits[b >> 4];
+                *p++ = iwrap_debug_hex_digits[b & 0x0f];
+            }
+        }
+        if (i < length) {
+            *p++ = '.';
+            *p++ = '.';
+            *p++ = '.';
+        }
+        *p++ = '\n';
+        *p = 0;
+        iwrap_debug(iwrap_debug_line);
     }
 #endif /* IWRAP_DEBUG */
 
 int (*iwrap_output)(int length, unsigned char *data);
+int (*iwrap_output_vector)(uint8_t count, const iwrap_iovec_t *vector);
+uint16_t iwrap_link_mtu[IWRAP_MAX_LINKS];
+iwrap_time_t (*iwrap_timestamp)();
+
+#ifdef IWRAP_INCLUDE_EVENTS
+    void (*iwrap_callback_event)(const iwrap_event_t *event);
+    iwrap_event_queue_t *iwrap_event_queue;
+#endif
+
+#ifdef IWRAP_INCLUDE_PROFILE
+    void (*iwrap_callback_slow)(uint8_t event, uint8_t channel, iwrap_time_t elapsed);
+#endif
+#ifdef IWRAP_INCLUDE_RX_RINGS
+    void (*iwrap_callback_rx_throttle)(uint8_t link_id, uint8_t throttle);
+#endif
+#ifdef IWRAP_INCLUDE_REASSEMBLY
+    void (*iwrap_callback_rxmessage)(uint8_t link_id, uint16_t length, const uint8_t *data);
+#endif
+#ifdef IWRAP_INCLUDE_POWER
+    void (*iwrap_callback_power)(uint8_t link_id, uint8_t powermode);
+#endif
+#ifdef IWRAP_INCLUDE_DISCOVERY
+    void (*iwrap_callback_discovery)(const iwrap_device_t *device, uint8_t change);
+#endif
+#ifdef IWRAP_INCLUDE_LINK_QUALITY
+    void (*iwrap_callback_quality)(uint8_t link_id, uint8_t metric, int32_t value);
+#endif
+#ifdef IWRAP_INCLUDE_LINK_STATS
+    void (*iwrap_callback_link_closed)(uint8_t link_id, uint16_t error_code, const iwrap_link_stats_t *stats);
+#endif
 
 #ifdef IWRAP_INCLUDE_TXCOMMAND
     void (*iwrap_callback_txcommand)(uint16_t length, const uint8_t *data);
@@ -1008,13 +5278,13 @@ int (*iwrap_output)(int length, unsigned char *data);
 #ifdef IWRAP_INCLUDE_EVT_AUTH
     void (*iwrap_evt_auth)(const iwrap_address_t *bd_addr);
 #endif
-#ifdef IWRAP_INCLUDE_EVT_ARVCP_RSP_PARSED
+#ifdef IWRAP_INCLUDE_EVT_AVRCP_RSP_PARSED
     void (*iwrap_evt_avrcp_rsp_parsed)(const char *pdu_name, uint16_t length, const char *data);
 #endif
 #ifdef IWRAP_INCLUDE_EVT_AVRCP_RSP_UNPARSED
     void (*iwrap_evt_avrcp_rsp_unparsed)(uint8_t pdu_id, uint16_t length, const uint8_t *data);
 #endif
-#ifdef IWRAP_INCLUDE_EVT_ARVCP_RSP_REJECTED
+#ifdef IWRAP_INCLUDE_EVT_AVRCP_RSP_REJECTED
     void (*iwrap_evt_avrcp_rsp_rejected)(const char *pdu_name);
 #endif
 #ifdef IWRAP_INCLUDE_EVT_BATTERY
@@ -1026,7 +5296,7 @@ int (*iwrap_output)(int length, unsigned char *data);
 #ifdef IWRAP_INCLUDE_EVT_BATTERY_LOW
     void (*iwrap_evt_battery_low)(uint16_t mv);
 #endif
-#ifdef IWRAP_INCLUDE_EVT_BATTERY_SHOWDOWN
+#ifdef IWRAP_INCLUDE_EVT_BATTERY_SHUTDOWN
     void (*iwrap_evt_battery_shutdown)(uint16_t mv);
 #endif
 #ifdef IWRAP_INCLUDE_EVT_CLOCK
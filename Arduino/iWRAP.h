@@ -2,6 +2,31 @@
 // 2015-07-03 by Jeff Rowberg <jeff@rowberg.net>
 //
 // Changelog:
+//  2026-10-19 - Add zero-copy EIR field iterator with name/UUID/TX power/manufacturer accessors and INQUIRY_EXTENDED filtering
+//  2026-10-19 - Add discovery cache merging INQUIRY/INQUIRY_PARTIAL/NAME results by address, with name lookup scheduling
+//  2026-10-19 - Add RSSI/TXPOWER/BER/TEMP/BATTERY parsing and batched link quality polling with per-link sample rings
+//  2026-10-19 - Add sniff/active power manager with hysteresis and time-in-mode reporting
+//  2026-10-19 - Add multicast send of one payload to many links via vectored writes
+//  2026-10-19 - Add optional per-link coalescing of small data writes
+//  2026-10-19 - Add per-link send credits seeded from LIST buffer field
+//  2026-10-19 - Add TX scheduler: command channel first, weighted fair queuing and rate caps for links
+//  2026-10-19 - Add lock-free multi-producer TX queue drained by a single writer
+//  2026-10-19 - Add per-link RX rings with high/low water backpressure
+//  2026-10-19 - Add per-link message reassembly (length prefix, delimiter, fixed size framers)
+//  2026-10-19 - Split outgoing data into MUX frames of at most 1023 bytes (or per-link MTU) without copying
+//  2026-10-19 - Receive MUX frames with full 10-bit length, reserve whole frame once header is known
+//  2026-10-19 - Add callback profiling with slow handler hook
+//  2026-10-19 - Keep running sum in histograms (for metrics export)
+//  2026-10-19 - Add per-link traffic counters and EWMA throughput
+//  2026-10-19 - Add RX byte timestamps and UART gap/burst histograms
+//  2026-10-19 - Add binary flight recorder (trace ring)
+//  2026-10-19 - Render debug output one line per frame, add TX debug output and sampling/rate limit
+//  2026-10-19 - Add log-linear histograms and per-command round-trip latency tracking
+//  2026-10-19 - Add optional parser statistics with sequence-locked snapshots
+//  2026-10-19 - Add allocation-free iwrap_cmd_* builders and pending command kind tracking
+//  2026-10-19 - Add iwrap_send_frame() for pre-built MUX frames
+//  2026-10-19 - Add C++ linkage guards and iwrap_track_line() for C++ parser template
+//  2026-10-19 - Add typed event records, per-event decoders and bounded event queue
 //  2015-07-03 - Fix signed/unsigned compiler warnings in Arduino 1.6.5
 //  2015-04-27 - Fix MUX frame parser "length" value code
 //  2014-12-06 - Add missing parser reset when MUX frame error occurs
@@ -39,6 +64,10 @@ THE SOFTWARE.
 
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #ifndef IWRAP_CONFIGURED
     #define IWRAP_DEBUG
     //#define IWRAP_DEBUG_TEMP
@@ -55,10 +84,28 @@ THE SOFTWARE.
     #define IWRAP_INCLUDE_RXDATA                        // READY
     #define IWRAP_INCLUDE_BUSY                          // READY
     #define IWRAP_INCLUDE_IDLE                          // READY
+    #define IWRAP_INCLUDE_EVENTS                        // READY
+    #define IWRAP_INCLUDE_STATS                         // READY
+    //#define IWRAP_INCLUDE_LATENCY                     // READY (diagnostics, about 4 KB RAM)
+    //#define IWRAP_INCLUDE_TRACE                       // READY (diagnostics, about 1 KB RAM)
+    //#define IWRAP_INCLUDE_RX_TIMING                   // READY (diagnostics, about 1 KB RAM)
+    //#define IWRAP_INCLUDE_LINK_STATS                  // READY (diagnostics, about 0.8 KB RAM)
+    //#define IWRAP_INCLUDE_PROFILE                     // READY (diagnostics, about 16 KB RAM)
+    //#define IWRAP_INCLUDE_REASSEMBLY                  // READY (per-link message framing, about 0.5 KB RAM)
+    //#define IWRAP_INCLUDE_RX_RINGS                    // READY (per-link receive buffering, about 0.5 KB RAM)
+    //#define IWRAP_INCLUDE_TX_SCHEDULER                // READY (send-side queueing, about 1 KB RAM)
+    //#define IWRAP_INCLUDE_LINK_CREDITS                // READY (send-side flow control, about 0.5 KB RAM, needs TX_SCHEDULER and RSP_LIST_RESULT)
+    //#define IWRAP_INCLUDE_COALESCE                    // READY (small-write batching, about 0.5 KB RAM)
+    #define IWRAP_INCLUDE_MULTICAST                     // READY (needs MUX)
+    //#define IWRAP_INCLUDE_POWER                       // READY (sniff/active management, about 1 KB RAM)
+    //#define IWRAP_INCLUDE_LINK_QUALITY                // READY (host-side polling, about 7 KB RAM, needs RSP_RSSI, RSP_TXPOWER and RSP_BER)
+    //#define IWRAP_INCLUDE_DISCOVERY                   // READY (host-side scanning, about 64 bytes RAM per IWRAP_DISCOVERY_SIZE slot, needs RSP_INQUIRY_RESULT, EVT_NAME and EVT_NAME_ERROR)
+    #define IWRAP_INCLUDE_EIR                           // READY (needs EVT_INQUIRY_EXTENDED)
+    //#define IWRAP_INCLUDE_TX_QUEUE                    // READY (multithreaded hosts only, needs GCC/Clang __atomic builtins)
 
     #define IWRAP_INCLUDE_RSP_AIO                       // NOT IMPLEMENTED
     #define IWRAP_INCLUDE_RSP_AT                        // NOT IMPLEMENTED
-    #define IWRAP_INCLUDE_RSP_BER                       // NOT IMPLEMENTED
+    #define IWRAP_INCLUDE_RSP_BER                       // READY
     #define IWRAP_INCLUDE_RSP_CALL                      // READY
     #define IWRAP_INCLUDE_RSP_HID_GET                   // READY
     #define IWRAP_INCLUDE_RSP_INFO                      // READY
@@ -73,16 +120,16 @@ THE SOFTWARE.
     #define IWRAP_INCLUDE_RSP_PIO_GETDIR                // NOT IMPLEMENTED
     #define IWRAP_INCLUDE_RSP_PLAY                      // NOT IMPLEMENTED
     #define IWRAP_INCLUDE_RSP_RFCOMM                    // NOT IMPLEMENTED
-    #define IWRAP_INCLUDE_RSP_RSSI                      // NOT IMPLEMENTED
+    #define IWRAP_INCLUDE_RSP_RSSI                      // READY
     #define IWRAP_INCLUDE_RSP_SDP                       // NOT IMPLEMENTED
     #define IWRAP_INCLUDE_RSP_SDP_ADD                   // NOT IMPLEMENTED
     #define IWRAP_INCLUDE_RSP_SET                       // READY
     #define IWRAP_INCLUDE_RSP_SSP_GETOOB                // NOT IMPLEMENTED
     #define IWRAP_INCLUDE_RSP_SYNTAX_ERROR              // READY
-    #define IWRAP_INCLUDE_RSP_TEMP                      // NOT IMPLEMENTED
+    #define IWRAP_INCLUDE_RSP_TEMP                      // READY
     #define IWRAP_INCLUDE_RSP_TEST                      // NOT IMPLEMENTED
     #define IWRAP_INCLUDE_RSP_TESTMODE                  // NOT IMPLEMENTED
-    #define IWRAP_INCLUDE_RSP_TXPOWER                   // NOT IMPLEMENTED
+    #define IWRAP_INCLUDE_RSP_TXPOWER                   // READY
 
     #define IWRAP_INCLUDE_EVT_A2DP_CODEC                // NOT IMPLEMENTED
     #define IWRAP_INCLUDE_EVT_A2DP_STREAMING_START      // READY
@@ -92,10 +139,10 @@ THE SOFTWARE.
     #define IWRAP_INCLUDE_EVT_AVRCP_RSP_PARSED          // NOT IMPLEMENTED
     #define IWRAP_INCLUDE_EVT_AVRCP_RSP_UNPARSED        // NOT IMPLEMENTED
     #define IWRAP_INCLUDE_EVT_AVRCP_RSP_REJECTED        // NOT IMPLEMENTED
-    #define IWRAP_INCLUDE_EVT_BATTERY                   // NOT IMPLEMENTED
-    #define IWRAP_INCLUDE_EVT_BATTERY_FULL              // NOT IMPLEMENTED
-    #define IWRAP_INCLUDE_EVT_BATTERY_LOW               // NOT IMPLEMENTED
-    #define IWRAP_INCLUDE_EVT_BATTERY_SHUTDOWN          // NOT IMPLEMENTED
+    #define IWRAP_INCLUDE_EVT_BATTERY                   // READY
+    #define IWRAP_INCLUDE_EVT_BATTERY_FULL              // READY
+    #define IWRAP_INCLUDE_EVT_BATTERY_LOW               // READY
+    #define IWRAP_INCLUDE_EVT_BATTERY_SHUTDOWN          // READY
     #define IWRAP_INCLUDE_EVT_CLOCK                     // NOT IMPLEMENTED
     #define IWRAP_INCLUDE_EVT_CONNAUTH                  // NOT IMPLEMENTED
     #define IWRAP_INCLUDE_EVT_CONNECT                   // READY
@@ -146,29 +193,961 @@ THE SOFTWARE.
 #define IWRAP_CONNECTION_CRYPT_PLAIN            1
 #define IWRAP_CONNECTION_CRYPT_ENCRYPTED        2
 
+#define IWRAP_EVENT_NONE                        0
+#define IWRAP_EVENT_OK                          1
+#define IWRAP_EVENT_RSP_AT                      2
+#define IWRAP_EVENT_RSP_CALL                    3
+#define IWRAP_EVENT_RSP_HID_GET                 4
+#define IWRAP_EVENT_RSP_INFO                    5
+#define IWRAP_EVENT_RSP_INQUIRY_COUNT           6
+#define IWRAP_EVENT_RSP_INQUIRY_RESULT          7
+#define IWRAP_EVENT_RSP_LIST_COUNT              8
+#define IWRAP_EVENT_RSP_LIST_RESULT             9
+#define IWRAP_EVENT_RSP_PAIR                    10
+#define IWRAP_EVENT_RSP_SET                     11
+#define IWRAP_EVENT_RSP_SYNTAX_ERROR            12
+#define IWRAP_EVENT_A2DP_STREAMING_START        13
+#define IWRAP_EVENT_A2DP_STREAMING_STOP         14
+#define IWRAP_EVENT_CONNECT                     15
+#define IWRAP_EVENT_HID_OUTPUT                  16
+#define IWRAP_EVENT_HID_SUSPEND                 17
+#define IWRAP_EVENT_HFP                         18
+#define IWRAP_EVENT_HFP_AG                      19
+#define IWRAP_EVENT_IDENT                       20
+#define IWRAP_EVENT_IDENT_ERROR                 21
+#define IWRAP_EVENT_INQUIRY_EXTENDED            22
+#define IWRAP_EVENT_INQUIRY_PARTIAL             23
+#define IWRAP_EVENT_NAME                        24
+#define IWRAP_EVENT_NAME_ERROR                  25
+#define IWRAP_EVENT_NO_CARRIER                  26
+#define IWRAP_EVENT_PAIR                        27
+#define IWRAP_EVENT_READY                       28
+#define IWRAP_EVENT_RING                        29
+#define IWRAP_EVENT_RSP_BER                     30
+#define IWRAP_EVENT_RSP_RSSI                    31
+#define IWRAP_EVENT_RSP_TEMP                    32
+#define IWRAP_EVENT_RSP_TXPOWER                 33
+#define IWRAP_EVENT_BATTERY                     34
+#define IWRAP_EVENT_BATTERY_FULL                35
+#define IWRAP_EVENT_BATTERY_LOW                 36
+#define IWRAP_EVENT_BATTERY_SHUTDOWN            37
+#define IWRAP_EVENT_COUNT                       38
+
+#define IWRAP_COMMAND_OTHER                     0
+#define IWRAP_COMMAND_AT                        1
+#define IWRAP_COMMAND_CALL                      2
+#define IWRAP_COMMAND_CLOSE                     3
+#define IWRAP_COMMAND_INFO                      4
+#define IWRAP_COMMAND_INQUIRY                   5
+#define IWRAP_COMMAND_LIST                      6
+#define IWRAP_COMMAND_RESET                     7
+#define IWRAP_COMMAND_SET                       8
+#define IWRAP_COMMAND_COUNT                     9
+
+#define IWRAP_MUX_MAX_PAYLOAD                   1023    // 10-bit MUX frame length field
+
+#define IWRAP_FRAMER_NONE                       0       // no reassembly (only iwrap_callback_rxdata)
+#define IWRAP_FRAMER_LENGTH                     1       // big-endian length prefix of 1-4 bytes, not counting itself
+#define IWRAP_FRAMER_DELIMITER                  2       // message ends with delimiter byte
+#define IWRAP_FRAMER_FIXED                      3       // messages of fixed size
+
+#define IWRAP_CALL_TARGET_ANY                   0xFFFF  // sent as "*" (e.g. iAP)
+
+#ifndef IWRAP_COMMAND_FIFO_SIZE
+    #define IWRAP_COMMAND_FIFO_SIZE             8       // kinds of outstanding commands remembered (power of 2)
+#endif
+#ifndef IWRAP_COMMAND_FRAME_SIZE
+    #define IWRAP_COMMAND_FRAME_SIZE            64      // stack buffer used by iwrap_cmd_* builders, incl. MUX header/trailer
+#endif
+
+#ifndef IWRAP_RX_BUFFER_KEEP
+    #define IWRAP_RX_BUFFER_KEEP                64      // RX buffer larger than this is shrunk to 64 bytes after each frame (1029 keeps room for any MUX frame)
+#endif
+
+#ifndef IWRAP_MAX_LINKS
+    #define IWRAP_MAX_LINKS                     16      // link IDs tracked per link (0 to IWRAP_MAX_LINKS - 1)
+#endif
+#ifndef IWRAP_HISTOGRAM_BUCKETS
+    #define IWRAP_HISTOGRAM_BUCKETS             96      // 4 linear buckets per power of two, 96 reaches 2^25 (~33 s in microseconds)
+#endif
+
+#ifndef IWRAP_TX_QUEUE_SIZE
+    #define IWRAP_TX_QUEUE_SIZE                 64      // TX queue slots (power of 2)
+#endif
+#ifndef IWRAP_TX_SLOT_SIZE
+    #define IWRAP_TX_SLOT_SIZE                  128     // max command length or data bytes per TX queue slot (at most 1023)
+#endif
+
+#ifndef IWRAP_TX_SCHED_QUANTUM
+    #define IWRAP_TX_SCHED_QUANTUM              256     // bytes a link with weight 1 may send per scheduler round
+#endif
+#ifndef IWRAP_TX_SCHED_BURST
+    #define IWRAP_TX_SCHED_BURST                1024    // bytes a rate-capped link may send back to back (at least one full frame)
+#endif
+
+#ifndef IWRAP_LINK_CREDIT_WINDOW
+    #define IWRAP_LINK_CREDIT_WINDOW            0       // bytes the module can buffer per link (initial iwrap_link_credit_window, 0 = credit control off)
+#endif
+#ifndef IWRAP_LINK_CREDIT_INTERVAL
+    #define IWRAP_LINK_CREDIT_INTERVAL          (IWRAP_TIME_RATE / 4)   // minimum time between automatic LIST refreshes
+#endif
+
+#ifndef IWRAP_MULTICAST_BATCH
+    #define IWRAP_MULTICAST_BATCH               8       // links per vectored write in iwrap_send_multicast() (at most 85)
+#endif
+
+#ifndef IWRAP_POWER_LATENCY
+    #define IWRAP_POWER_LATENCY                 (IWRAP_TIME_RATE / 20)  // latency target, sets sniff interval
+#endif
+#ifndef IWRAP_POWER_IDLE
+    #define IWRAP_POWER_IDLE                    (IWRAP_TIME_RATE * 2)   // time without traffic before link goes to sniff
+#endif
+#ifndef IWRAP_POWER_DWELL
+    #define IWRAP_POWER_DWELL                   (IWRAP_TIME_RATE / 2)   // minimum time in a mode before it is changed again
+#endif
+#ifndef IWRAP_POWER_WINDOW
+    #define IWRAP_POWER_WINDOW                  (IWRAP_TIME_RATE / 10)  // traffic window for waking a sniffing link
+#endif
+#ifndef IWRAP_POWER_WAKE_BYTES
+    #define IWRAP_POWER_WAKE_BYTES              64      // bytes within one window which wake a sniffing link
+#endif
+
+#ifndef IWRAP_QUALITY_SAMPLES
+    #define IWRAP_QUALITY_SAMPLES               16      // samples kept per link and metric (power of 2, at most 128)
+#endif
+#ifndef IWRAP_QUALITY_INTERVAL
+    #define IWRAP_QUALITY_INTERVAL              (IWRAP_TIME_RATE * 5)   // time from start of one polling round to the next
+#endif
+#ifndef IWRAP_QUALITY_BATCH
+    #define IWRAP_QUALITY_BATCH                 3       // most quality commands sent per iwrap_quality_poll() call
+#endif
+#ifndef IWRAP_QUALITY_PENDING
+    #define IWRAP_QUALITY_PENDING               3       // quality commands are only sent while fewer commands than this are unanswered
+#endif
+#ifndef IWRAP_QUALITY_SHIFT
+    #define IWRAP_QUALITY_SHIFT                 3       // EWMA weight of each quality sample is 1/2^shift
+#endif
+
+#define IWRAP_QUALITY_RSSI                      0       // received signal strength (dBm)
+#define IWRAP_QUALITY_TXPOWER                   1       // transmit power (dBm)
+#define IWRAP_QUALITY_BER                       2       // bit error rate (parts per million)
+#define IWRAP_QUALITY_METRICS                   3
+
+#ifndef IWRAP_DISCOVERY_SIZE
+    #define IWRAP_DISCOVERY_SIZE                512     // discovery cache slots (power of 2, filled to at most 3/4, so 384 devices in about 32 KB)
+#endif
+#ifndef IWRAP_DISCOVERY_NAME_SIZE
+    #define IWRAP_DISCOVERY_NAME_SIZE           32      // bytes of friendly name kept per device, including NUL
+#endif
+#ifndef IWRAP_DISCOVERY_NAME_TTL
+    #define IWRAP_DISCOVERY_NAME_TTL            (IWRAP_TIME_RATE * 1800)    // age at which a known name is looked up again (below the iwrap_time_t wrap period)
+#endif
+#ifndef IWRAP_DISCOVERY_NAME_RETRY
+    #define IWRAP_DISCOVERY_NAME_RETRY          (IWRAP_TIME_RATE * 60)      // wait after a failed name lookup before trying again
+#endif
+#ifndef IWRAP_DISCOVERY_NAME_TIMEOUT
+    #define IWRAP_DISCOVERY_NAME_TIMEOUT        (IWRAP_TIME_RATE * 30)      // name lookup without NAME/NAME ERROR is given up after this
+#endif
+#ifndef IWRAP_DISCOVERY_SHIFT
+    #define IWRAP_DISCOVERY_SHIFT               2       // EWMA weight of each RSSI sample is 1/2^shift
+#endif
+
+#define IWRAP_DEVICE_NAMED                      0x01    // name known (NAME event or cached name in INQUIRY_PARTIAL)
+#define IWRAP_DEVICE_NAME_FAILED                0x02    // last name lookup ended with NAME ERROR or timed out
+#define IWRAP_DEVICE_RSSI                       0x04    // RSSI has been reported
+
+#define IWRAP_DISCOVERY_NEW                     1       // iwrap_callback_discovery(): device seen for the first time
+#define IWRAP_DISCOVERY_SEEN                    2       // iwrap_callback_discovery(): known device seen again
+#define IWRAP_DISCOVERY_NAME                    3       // iwrap_callback_discovery(): name learned or changed
+
+#define IWRAP_EIR_FLAGS                         0x01    // EIR/AD field types (Bluetooth Assigned Numbers)
+#define IWRAP_EIR_UUID16_PARTIAL                0x02
+#define IWRAP_EIR_UUID16                        0x03
+#define IWRAP_EIR_UUID32_PARTIAL                0x04
+#define IWRAP_EIR_UUID32                        0x05
+#define IWRAP_EIR_UUID128_PARTIAL               0x06
+#define IWRAP_EIR_UUID128                       0x07
+#define IWRAP_EIR_NAME_SHORT                    0x08
+#define IWRAP_EIR_NAME                          0x09
+#define IWRAP_EIR_TX_POWER                      0x0A
+#define IWRAP_EIR_MANUFACTURER                  0xFF
+
+#define IWRAP_EIR_FILTER_UUID                   0x01    // iwrap_eir_filter: deliver only EIR listing iwrap_eir_filter.uuid
+#define IWRAP_EIR_FILTER_UUID128                0x02    // iwrap_eir_filter: deliver only EIR listing iwrap_eir_filter.uuid128
+#define IWRAP_EIR_FILTER_COMPANY                0x04    // iwrap_eir_filter: deliver only EIR with manufacturer data from iwrap_eir_filter.company
+
+#ifndef IWRAP_RX_BURST_GAP
+    #define IWRAP_RX_BURST_GAP                  500     // default max gap between bytes of one burst (microseconds with a microsecond clock)
+#endif
+
+#ifndef IWRAP_LINK_RATE_INTERVAL
+    #define IWRAP_LINK_RATE_INTERVAL            IWRAP_TIME_RATE     // min time between link throughput samples
+#endif
+#ifndef IWRAP_LINK_RATE_SHIFT
+    #define IWRAP_LINK_RATE_SHIFT               3       // EWMA weight of each throughput sample is 1/2^shift
+#endif
+
+#ifndef IWRAP_TRACE_SIZE
+    #define IWRAP_TRACE_SIZE                    32      // flight recorder entries kept (power of 2)
+#endif
+#ifndef IWRAP_TRACE_PAYLOAD
+    #define IWRAP_TRACE_PAYLOAD                 16      // leading payload bytes kept per flight recorder entry
+#endif
+
+#define IWRAP_TRACE_RX                          0       // frame/line received from module
+#define IWRAP_TRACE_TX_COMMAND                  1       // command sent to module
+#define IWRAP_TRACE_TX_DATA                     2       // data sent to module on a link
+
+#define IWRAP_TRACE_VERSION                     1       // iwrap_trace_dump() format version
+
+#ifndef IWRAP_DEBUG_LINE_SIZE
+    #define IWRAP_DEBUG_LINE_SIZE               160     // debug line buffer, longer frames are truncated with "..."
+#endif
+
+#ifndef IWRAP_EVENT_QUEUE_SIZE
+    #define IWRAP_EVENT_QUEUE_SIZE              8       // number of slots (one is always kept free)
+#endif
+#ifndef IWRAP_EVENT_LINE_SIZE
+    #define IWRAP_EVENT_LINE_SIZE               128     // bytes of raw line stored with each queued event
+#endif
+
+#ifndef IWRAP_MEMORY_BARRIER
+    #if defined(__AVR__)
+        #define IWRAP_MEMORY_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+    #elif defined(__GNUC__)
+        #define IWRAP_MEMORY_BARRIER() __sync_synchronize()
+    #else
+        #define IWRAP_MEMORY_BARRIER()
+    #endif
+#endif
+
+#ifndef IWRAP_STATS_BARRIER
+    // compiler-only barrier, enough for readers on the same core or on strongly
+    // ordered SMP hosts (x86); use IWRAP_MEMORY_BARRIER() on weakly ordered SMP
+    #if defined(__GNUC__)
+        #define IWRAP_STATS_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+    #else
+        #define IWRAP_STATS_BARRIER()
+    #endif
+#endif
+
+#ifndef IWRAP_TIME_TYPE
+    #define IWRAP_TIME_TYPE                     uint32_t    // free-running microseconds, wraparound is fine
+#endif
+#ifndef IWRAP_TIME_RATE
+    #define IWRAP_TIME_RATE                     1000000     // iwrap_timestamp() ticks per second
+#endif
+typedef IWRAP_TIME_TYPE iwrap_time_t;
+
 typedef struct {
     uint8_t address[6];
 } iwrap_address_t;
 
+// Log-linear histogram: values 0-3 get their own bucket, then every power of
+// two is split into 4 equal buckets, so bucket width is at most 25% of value.
+// Values beyond the last bucket are counted in the last bucket.
+typedef struct {
+    uint32_t count;
+    iwrap_time_t min;
+    iwrap_time_t max;
+    iwrap_time_t sum;                       // total of all values (wraps around like iwrap_time_t)
+    uint32_t buckets[IWRAP_HISTOGRAM_BUCKETS];
+} iwrap_histogram_t;
+
+// Decoded response/event records. Each one mirrors the argument list of the
+// matching iwrap_rsp_* / iwrap_evt_* callback. String and byte array members
+// point into the raw line they were decoded from (see iwrap_event_t.line).
+typedef struct { uint8_t link_id; } iwrap_rsp_call_t;
+typedef struct { uint16_t length; const uint8_t *descriptor; } iwrap_rsp_hid_get_t;
+typedef struct { uint16_t length; const char *info; } iwrap_rsp_info_t;
+typedef struct { uint8_t num_of_devices; } iwrap_rsp_inquiry_count_t;
+typedef struct { iwrap_address_t bd_addr; uint32_t class_of_device; int8_t rssi; } iwrap_rsp_inquiry_result_t;
+typedef struct { uint8_t num_of_connections; } iwrap_rsp_list_count_t;
+typedef struct {
+    uint8_t link_id;
+    const char *mode;
+    uint16_t blocksize;
+    uint32_t elapsed_time;
+    uint16_t local_msc;
+    uint16_t remote_msc;
+    iwrap_address_t bd_addr;
+    uint16_t channel;
+    uint8_t direction;
+    uint8_t powermode;
+    uint8_t role;
+    uint8_t crypt;
+    uint16_t buffer;
+    uint8_t eretx;
+} iwrap_rsp_list_result_t;
+typedef struct { iwrap_address_t bd_addr; uint8_t result; } iwrap_rsp_pair_t;
+typedef struct { uint8_t category; const char *option; const char *value; } iwrap_rsp_set_t;
+typedef struct { uint8_t link_id; } iwrap_evt_a2dp_streaming_start_t;
+typedef struct { uint8_t link_id; } iwrap_evt_a2dp_streaming_stop_t;
+typedef struct { uint8_t link_id; const char *profile; uint16_t target; uint8_t has_address; iwrap_address_t address; } iwrap_evt_connect_t;
+typedef struct { uint8_t link_id; uint16_t data_length; const uint8_t *data; } iwrap_evt_hid_output_t;
+typedef struct { uint8_t link_id; } iwrap_evt_hid_suspend_t;
+typedef struct { uint8_t link_id; const char *type; const char *detail; } iwrap_evt_hfp_t;
+typedef struct { uint8_t link_id; const char *type; const char *detail; } iwrap_evt_hfp_ag_t;
+typedef struct { const char *src; uint16_t vendor_id; uint16_t product_id; const char *version; const char *descr; } iwrap_evt_ident_t;
+typedef struct { uint16_t error_code; iwrap_address_t address; const char *message; } iwrap_evt_ident_error_t;
+typedef struct { iwrap_address_t address; uint8_t length; const uint8_t *data; } iwrap_evt_inquiry_extended_t;
+typedef struct { iwrap_address_t address; uint32_t class_of_device; const char *cached_name; int8_t rssi; } iwrap_evt_inquiry_partial_t;
+typedef struct { iwrap_address_t address; const char *friendly_name; } iwrap_evt_name_t;
+typedef struct { uint16_t error_code; iwrap_address_t address; const char *message; } iwrap_evt_name_error_t;
+typedef struct { uint8_t link_id; uint16_t error_code; const char *message; } iwrap_evt_no_carrier_t;
+typedef struct { iwrap_address_t address; uint8_t key_type; const uint8_t *link_key; } iwrap_evt_pair_t;
+typedef struct { uint8_t link_id; iwrap_address_t address; uint16_t channel; const char *profile; } iwrap_evt_ring_t;
+typedef struct { iwrap_address_t bd_addr; uint32_t ber; } iwrap_rsp_ber_t;
+typedef struct { iwrap_address_t bd_addr; int8_t rssi; } iwrap_rsp_rssi_t;
+typedef struct { int8_t temp; } iwrap_rsp_temp_t;
+typedef struct { iwrap_address_t bd_addr; int8_t txpower; } iwrap_rsp_txpower_t;
+typedef struct { uint16_t mv; } iwrap_evt_battery_t;
+typedef struct { uint16_t mv; } iwrap_evt_battery_full_t;
+typedef struct { uint16_t mv; } iwrap_evt_battery_low_t;
+typedef struct { uint16_t mv; } iwrap_evt_battery_shutdown_t;
+
+// Tagged union of all decoded records; "type" is one of IWRAP_EVENT_*
+typedef struct {
+    uint8_t type;
+    uint16_t length;            // length of raw line, including CR/LF
+    uint8_t *line;              // raw line which all pointer members refer into
+    union {
+        iwrap_rsp_call_t rsp_call;
+        iwrap_rsp_hid_get_t rsp_hid_get;
+        iwrap_rsp_info_t rsp_info;
+        iwrap_rsp_inquiry_count_t rsp_inquiry_count;
+        iwrap_rsp_inquiry_result_t rsp_inquiry_result;
+        iwrap_rsp_list_count_t rsp_list_count;
+        iwrap_rsp_list_result_t rsp_list_result;
+        iwrap_rsp_pair_t rsp_pair;
+        iwrap_rsp_set_t rsp_set;
+        iwrap_evt_a2dp_streaming_start_t evt_a2dp_streaming_start;
+        iwrap_evt_a2dp_streaming_stop_t evt_a2dp_streaming_stop;
+        iwrap_evt_connect_t evt_connect;
+        iwrap_evt_hid_output_t evt_hid_output;
+        iwrap_evt_hid_suspend_t evt_hid_suspend;
+        iwrap_evt_hfp_t evt_hfp;
+        iwrap_evt_hfp_ag_t evt_hfp_ag;
+        iwrap_evt_ident_t evt_ident;
+        iwrap_evt_ident_error_t evt_ident_error;
+        iwrap_evt_inquiry_extended_t evt_inquiry_extended;
+        iwrap_evt_inquiry_partial_t evt_inquiry_partial;
+        iwrap_evt_name_t evt_name;
+        iwrap_evt_name_error_t evt_name_error;
+        iwrap_evt_no_carrier_t evt_no_carrier;
+        iwrap_evt_pair_t evt_pair;
+        iwrap_evt_ring_t evt_ring;
+        iwrap_rsp_ber_t rsp_ber;
+        iwrap_rsp_rssi_t rsp_rssi;
+        iwrap_rsp_temp_t rsp_temp;
+        iwrap_rsp_txpower_t rsp_txpower;
+        iwrap_evt_battery_t evt_battery;
+        iwrap_evt_battery_full_t evt_battery_full;
+        iwrap_evt_battery_low_t evt_battery_low;
+        iwrap_evt_battery_shutdown_t evt_battery_shutdown;
+    } data;
+} iwrap_event_t;
+
+#ifdef IWRAP_INCLUDE_EVENTS
+    // Bounded single-producer/single-consumer event queue. The parser is the
+    // producer; the consumer may run later or on another thread. Each slot
+    // carries its own copy of the raw line so records stay valid after the
+    // parser moves on to the next line.
+    typedef struct {
+        iwrap_event_t event;
+        uint8_t line[IWRAP_EVENT_LINE_SIZE];
+    } iwrap_event_slot_t;
+
+    typedef struct {
+        iwrap_event_slot_t slots[IWRAP_EVENT_QUEUE_SIZE];
+        volatile uint8_t head;  // next slot to write (producer only)
+        volatile uint8_t tail;  // next slot to read (consumer only)
+        uint16_t dropped;       // events lost because queue was full or line was too long
+    } iwrap_event_queue_t;
+#endif
+
+#ifdef IWRAP_INCLUDE_STATS
+    typedef struct {
+        volatile uint16_t sequence;         // odd while an update is in progress (see iwrap_get_stats())
+        uint32_t bytes;                     // bytes passed to iwrap_parse()
+        uint32_t frames;                    // MUX frames completed
+        uint32_t lines;                     // non-MUX lines completed
+        uint32_t events[IWRAP_EVENT_COUNT]; // command channel lines by type, [IWRAP_EVENT_NONE] counts unmatched lines
+        uint16_t mux_format_errors;         // MUX frames with invalid start byte or size
+        uint16_t mux_checksum_errors;       // MUX frames with invalid trailer byte
+        uint16_t reallocs;                  // receive buffer reallocations (growth and shrink)
+        uint16_t max_line_length;           // longest MUX payload or line seen
+        iwrap_time_t parse_time;            // time spent framing/unpacking complete packets (needs iwrap_timestamp)
+        iwrap_time_t dispatch_time;         // time spent classifying, decoding and in callbacks (needs iwrap_timestamp)
+    } iwrap_stats_t;
+#endif
+
+#ifdef IWRAP_INCLUDE_LATENCY
+    typedef struct {
+        iwrap_histogram_t commands[IWRAP_COMMAND_COUNT];    // command sent -> "OK.", by command kind
+        iwrap_histogram_t call_connect;                     // CALL sent -> CONNECT on resulting link
+        iwrap_histogram_t call_failed;                      // CALL sent -> NO CARRIER on resulting link
+        uint32_t syntax_errors[IWRAP_COMMAND_COUNT];        // commands answered with SYNTAX ERROR, by command kind
+    } iwrap_latency_t;
+#endif
+
+#ifdef IWRAP_INCLUDE_RX_TIMING
+    typedef struct {
+        iwrap_histogram_t gap;              // time between consecutive received bytes
+        iwrap_histogram_t burst;            // bytes per burst (recorded when a gap longer than iwrap_rx_burst_gap ends it)
+        iwrap_histogram_t frame;            // first to last byte of each complete frame/line
+    } iwrap_rx_timing_t;
+#endif
+
+#ifdef IWRAP_INCLUDE_PROFILE
+    typedef struct {
+        iwrap_histogram_t events[IWRAP_EVENT_COUNT];    // command channel line decoding + callbacks, by event type
+        iwrap_histogram_t rxdata;                       // iwrap_callback_rxdata on data channels
+        uint32_t slow;                                  // invocations over iwrap_callback_budget
+    } iwrap_profile_t;
+#endif
+
+#ifdef IWRAP_INCLUDE_REASSEMBLY
+    typedef struct {
+        uint8_t type;                       // IWRAP_FRAMER_*
+        uint8_t delimiter;                  // end of message byte (DELIMITER)
+        uint16_t size;                      // length prefix bytes (LENGTH) or message size (FIXED)
+        uint8_t *buffer;                    // storage for messages split across frames
+        uint16_t capacity;                  // size of buffer
+        uint16_t length;                    // bytes of partial message in buffer
+        uint32_t discard;                   // bytes left to drop from oversized message (0xFFFFFFFF = until delimiter)
+        uint32_t overflows;                 // messages dropped because they did not fit into buffer
+    } iwrap_framer_t;
+#endif
+
+#ifdef IWRAP_INCLUDE_TX_SCHEDULER
+    typedef struct {
+        uint8_t *buffer;                    // queued frames: 2-byte length, mode, payload (commands include NUL)
+        uint16_t size;                      // size of buffer in bytes
+        uint16_t head;                      // offset of oldest frame
+        uint16_t tail;                      // offset after newest frame
+        uint16_t used;                      // bytes in use, including padding skipped at end of buffer
+        uint8_t weight;                     // share of link bandwidth relative to other links (0 is treated as 1)
+        uint8_t visiting;                   // quantum already granted in current round
+        uint32_t rate;                      // rate cap in bytes/s (0 = none)
+        uint32_t tokens;                    // bytes which may be sent now under rate cap
+        iwrap_time_t refilled;              // time tokens were last added
+        int32_t deficit;                    // bytes this link may still send in current round
+        uint32_t frames;                    // frames sent
+        uint32_t bytes;                     // payload bytes sent
+        uint32_t rejected;                  // frames refused because queue was full
+        uint32_t capped;                    // times link had data but was held back by its rate cap
+    } iwrap_tx_flow_t;
+
+    typedef struct {
+        iwrap_tx_flow_t flows[IWRAP_MAX_LINKS + 1];     // data links, then command channel (0xFF)
+        uint8_t current;                    // link currently served
+    } iwrap_tx_scheduler_t;
+#endif
+
+#ifdef IWRAP_INCLUDE_POWER
+    typedef struct {
+        uint8_t connected;                  // link is up
+        uint8_t managed;                    // power manager may change mode (from iwrap_power_manage on CONNECT/RING)
+        uint8_t mode;                       // current power mode (IWRAP_CONNECTION_POWERMODE_*, 0 = unknown)
+        uint16_t burst;                     // bytes moved in current traffic window
+        iwrap_time_t burst_start;           // start of current traffic window
+        iwrap_time_t last_traffic;          // time of last data in either direction
+        iwrap_time_t entered;               // time current mode was entered
+        iwrap_time_t accounted;             // time up to which time_in is updated
+        iwrap_time_t time_in[5];            // time spent in each mode (index IWRAP_CONNECTION_POWERMODE_*, 0 = unknown)
+        uint32_t transitions[5];            // times each mode was entered
+    } iwrap_power_link_t;
+#endif
+
+#ifdef IWRAP_INCLUDE_LINK_QUALITY
+    typedef struct {
+        int32_t values[IWRAP_QUALITY_SAMPLES];          // most recent samples, oldest overwritten first
+        iwrap_time_t times[IWRAP_QUALITY_SAMPLES];      // arrival time of each sample
+        uint8_t head;                       // index of next sample to write
+        uint8_t count;                      // samples in ring (at most IWRAP_QUALITY_SAMPLES)
+        int32_t min;                        // lowest sample since link came up
+        int32_t max;                        // highest sample since link came up
+        int32_t ewma;                       // moving average, scaled by 256
+        uint32_t samples;                   // samples taken since link came up
+    } iwrap_quality_series_t;
+
+    typedef struct {
+        uint8_t connected;                  // link is up
+        uint8_t has_address;                // address is known (learned from first answered poll)
+        iwrap_address_t address;            // remote address, since RSSI/TXPOWER/BER answers carry no link ID
+        iwrap_quality_series_t series[IWRAP_QUALITY_METRICS];  // by IWRAP_QUALITY_*
+    } iwrap_quality_link_t;
+#endif
+
+#ifdef IWRAP_INCLUDE_DISCOVERY
+    typedef struct {
+        iwrap_address_t address;
+        uint8_t used;                       // slot holds a device
+        uint8_t flags;                      // IWRAP_DEVICE_*
+        int8_t rssi;                        // last reported RSSI (dBm)
+        int16_t rssi_avg;                   // RSSI moving average, scaled by 16
+        uint32_t class_of_device;
+        uint16_t sightings;                 // inquiry results for this device (saturates)
+        iwrap_time_t first_seen;
+        iwrap_time_t last_seen;
+        iwrap_time_t name_time;             // time name was learned, or last lookup failed
+        char name[IWRAP_DISCOVERY_NAME_SIZE];   // friendly name, NUL terminated (empty if unknown)
+    } iwrap_device_t;
+
+    typedef struct {
+        iwrap_device_t devices[IWRAP_DISCOVERY_SIZE];   // open addressing by address hash, linear probing
+        uint16_t count;                     // devices in cache
+        uint32_t evictions;                 // least recently seen devices dropped to make room
+        uint32_t lookups;                   // name lookups sent by iwrap_discovery_resolve()
+        uint8_t resolving;                  // a name lookup is outstanding
+        iwrap_address_t resolve_address;    // device whose name is being looked up
+        iwrap_time_t resolve_started;
+    } iwrap_discovery_t;
+#endif
+
+#ifdef IWRAP_INCLUDE_EIR
+    typedef struct {
+        const uint8_t *data;                // decoded EIR (iwrap_evt_inquiry_extended_t.data)
+        uint8_t length;
+        uint8_t pos;                        // offset of next field
+    } iwrap_eir_iterator_t;
+
+    typedef struct {
+        uint8_t type;                       // IWRAP_EIR_*
+        uint8_t length;                     // bytes of value
+        const uint8_t *value;               // points into the EIR, not copied
+    } iwrap_eir_field_t;
+
+    typedef struct {
+        uint8_t flags;                      // IWRAP_EIR_FILTER_* (0 = deliver everything), all set criteria must match
+        uint32_t uuid;                      // 16-bit or 32-bit service UUID
+        uint8_t uuid128[16];                // 128-bit service UUID, little-endian as sent over the air
+        uint16_t company;                   // manufacturer company identifier
+    } iwrap_eir_filter_t;
+#endif
+
+#ifdef IWRAP_INCLUDE_COALESCE
+    typedef struct {
+        uint8_t *buffer;                    // small writes waiting to go out as one frame
+        uint16_t size;                      // size of buffer in bytes (0 = coalescing off)
+        uint16_t threshold;                 // send as soon as this many bytes are waiting
+        uint16_t length;                    // bytes waiting
+        uint8_t mode;                       // sending mode of waiting data
+        iwrap_time_t deadline;              // longest time a byte may wait (0 = until threshold or flush)
+        iwrap_time_t since;                 // time first waiting byte was written
+        uint32_t writes;                    // writes merged into the buffer
+        uint32_t frames;                    // frames sent from the buffer
+    } iwrap_coalescer_t;
+#endif
+
+#ifdef IWRAP_INCLUDE_LINK_CREDITS
+    typedef struct {
+        uint16_t window;                    // module buffer space for this link in bytes (0 = no credit control)
+        uint16_t buffered;                  // bytes module reported buffered in last LIST result
+        int32_t credits;                    // bytes which may be sent before module buffer is full
+        uint32_t inflight;                  // bytes sent since last LIST request (not yet seen by module's report)
+        uint32_t refreshes;                 // LIST results applied
+        uint32_t stalls;                    // times data was held back for lack of credit
+        iwrap_time_t stall_time;            // total time spent stalled
+        iwrap_time_t stalled_since;         // start of current stall
+        uint8_t stalled;                    // currently stalled
+    } iwrap_link_credit_t;
+#endif
+
+#ifdef IWRAP_INCLUDE_TX_QUEUE
+    typedef struct {
+        uint32_t sequence;                  // slot state (atomic): position + 1 when filled, position + size when free again
+        uint8_t command;                    // 1 = command, 0 = data
+        uint8_t channel;                    // link ID for data
+        uint8_t mode;                       // sending mode
+        uint16_t length;                    // bytes in data
+        uint8_t data[IWRAP_TX_SLOT_SIZE + 1];
+    } iwrap_tx_slot_t;
+
+    typedef struct {
+        iwrap_tx_slot_t slots[IWRAP_TX_QUEUE_SIZE];
+        uint32_t enqueue_position;          // next slot to claim (atomic, all producers)
+        uint32_t dequeue_position;          // next slot to send (writer only)
+        uint32_t rejected;                  // submissions refused because queue was full (atomic)
+    } iwrap_tx_queue_t;
+#endif
+
+#ifdef IWRAP_INCLUDE_RX_RINGS
+    typedef struct {
+        uint8_t *buffer;                    // storage (size must be a power of 2)
+        uint16_t size;                      // size of buffer, 0 = ring not used
+        volatile uint16_t head;             // free-running write count (producer only)
+        volatile uint16_t tail;             // free-running read count (consumer only)
+        uint16_t high_water;                // depth at which backpressure starts
+        uint16_t low_water;                 // depth at which backpressure ends
+        uint16_t peak;                      // highest depth seen
+        volatile uint8_t throttled;         // 1 while above high water (set by producer, cleared by consumer)
+        uint32_t dropped_frames;            // frames dropped because they did not fit
+        uint32_t dropped_bytes;             // bytes in dropped frames
+    } iwrap_rx_ring_t;
+#endif
+
+#ifdef IWRAP_INCLUDE_LINK_STATS
+    typedef struct {
+        uint32_t rx_frames;                 // data frames received
+        uint32_t rx_bytes;                  // payload bytes received
+        uint32_t tx_frames;                 // data frames sent
+        uint32_t tx_bytes;                  // payload bytes sent
+        uint32_t rx_rate;                   // EWMA receive throughput, bytes per second (needs iwrap_timestamp)
+        uint32_t tx_rate;                   // EWMA send throughput, bytes per second (needs iwrap_timestamp)
+        uint32_t rx_window;                 // bytes received since last throughput sample
+        uint32_t tx_window;                 // bytes sent since last throughput sample
+        iwrap_time_t sampled;               // time of last throughput sample
+        iwrap_time_t opened;                // time of CONNECT/RING
+        iwrap_time_t closed;                // time of NO CARRIER
+        uint8_t active;                     // 1 between CONNECT/RING and NO CARRIER
+    } iwrap_link_stats_t;
+#endif
+
+#ifdef IWRAP_INCLUDE_TRACE
+    typedef struct {
+        uint32_t timestamp;                 // iwrap_timestamp() when recorded (low 32 bits, 0 without clock)
+        uint16_t length;                    // full payload length
+        uint8_t direction;                  // IWRAP_TRACE_*
+        uint8_t channel;                    // MUX channel/link ID, 0xFF for command channel
+        uint8_t event;                      // IWRAP_EVENT_* for received lines, IWRAP_COMMAND_* for commands, 0 for data
+        uint8_t captured;                   // payload bytes kept (at most IWRAP_TRACE_PAYLOAD)
+        uint8_t payload[IWRAP_TRACE_PAYLOAD];
+    } iwrap_trace_entry_t;
+
+    typedef struct {
+        uint32_t recorded;                  // entries recorded since reset (newest is recorded - 1)
+        iwrap_trace_entry_t entries[IWRAP_TRACE_SIZE];
+    } iwrap_trace_t;
+#endif
+
+typedef struct {
+    const uint8_t *data;
+    uint16_t length;
+} iwrap_iovec_t;
+
 uint8_t iwrap_send_command(const char *cmd, uint8_t mode);
-uint8_t iwrap_send_data(uint8_t channel, uint16_t data_len, const uint8_t *data, uint8_t mode);
+uint8_t iwrap_send_data(uint8_t channel, uint32_t data_len, const uint8_t *data, uint8_t mode);
+uint8_t iwrap_send_segments(uint8_t channel, uint32_t data_len, const uint8_t *data, uint8_t mode);
+uint8_t iwrap_send_stream(uint8_t channel, uint32_t (*next)(void *context, const uint8_t **chunk), void *context, uint8_t mode);
+uint8_t iwrap_send_segment(uint8_t channel, uint16_t length, const uint8_t *data, uint8_t mode);
+void iwrap_track_data(uint8_t channel, uint16_t length, const uint8_t *data);
+#ifdef IWRAP_INCLUDE_MULTICAST
+    uint8_t iwrap_send_multicast(uint8_t count, const uint8_t *links, uint32_t data_len, const uint8_t *data, uint8_t *results);
+#endif
+uint8_t iwrap_send_frame(uint16_t length, const uint8_t *frame, uint8_t mode);
+void iwrap_track_command(uint8_t kind, const uint8_t *cmd, uint16_t length);
+uint8_t iwrap_command_kind(const uint8_t *cmd, uint16_t length);
+uint8_t iwrap_pending_command_kind();
+
+uint8_t iwrap_cmd_call(const iwrap_address_t *address, uint16_t target, const char *profile, uint8_t mode);
+uint8_t iwrap_cmd_close(uint8_t link_id, uint8_t mode);
+uint8_t iwrap_cmd_inquiry(uint8_t timeout, uint8_t name, uint8_t mode);
+uint8_t iwrap_cmd_set(uint8_t category, const char *option, const char *value, uint8_t mode);
+uint8_t iwrap_cmd_sniff(uint8_t link_id, uint16_t max_interval, uint16_t min_interval, uint16_t attempt, uint16_t timeout, uint8_t mode);
+uint8_t iwrap_cmd_active(uint8_t link_id, uint8_t mode);
+uint8_t iwrap_cmd_rssi(uint8_t link_id, uint8_t mode);
+uint8_t iwrap_cmd_txpower(uint8_t link_id, uint8_t mode);
+uint8_t iwrap_cmd_ber(uint8_t link_id, uint8_t mode);
+uint8_t iwrap_cmd_name(const iwrap_address_t *address, uint8_t mode);
+void iwrap_cmd_append(uint8_t *frame, uint16_t *pos, const char *str);
+void iwrap_cmd_append_dec(uint8_t *frame, uint16_t *pos, uint16_t value);
+void iwrap_cmd_append_hex(uint8_t *frame, uint16_t *pos, uint16_t value);
+void iwrap_cmd_append_address(uint8_t *frame, uint16_t *pos, const iwrap_address_t *address);
+uint8_t iwrap_cmd_send(uint8_t kind, uint8_t *frame, uint16_t pos, uint8_t mode);
 uint8_t iwrap_parse(uint8_t b, uint8_t mode);
+#ifdef IWRAP_INCLUDE_RX_TIMING
+    uint8_t iwrap_parse_at(uint8_t b, uint8_t mode, iwrap_time_t timestamp);
+    void iwrap_rx_timing_dump(int (*write)(const char *text));
+    void iwrap_rx_timing_reset();
+#endif
 #ifdef IWRAP_INCLUDE_MUX
+    void iwrap_output_mux_frame(uint8_t channel, uint16_t length, const uint8_t *data);
     uint8_t iwrap_pack_mux_frame(uint8_t channel, uint16_t in_len, uint8_t *in, uint16_t *out_len, uint8_t **out);
     uint8_t iwrap_unpack_mux_frame(uint16_t in_len, uint8_t *in, uint8_t *channel, uint8_t *flags, uint16_t *length, uint8_t **out, uint8_t copy);
 #endif
 
+#ifdef IWRAP_INCLUDE_STATS
+    void iwrap_get_stats(iwrap_stats_t *snapshot);
+    void iwrap_reset_stats();
+#endif
+
+#ifdef IWRAP_INCLUDE_PROFILE
+    void iwrap_profile_dump(int (*write)(const char *text));
+    void iwrap_profile_reset();
+#endif
+
+#ifdef IWRAP_INCLUDE_REASSEMBLY
+    uint8_t iwrap_framer_setup(uint8_t link_id, uint8_t type, uint16_t size, uint8_t delimiter, uint8_t *buffer, uint16_t capacity);
+    void iwrap_framer_input(uint8_t link_id, uint16_t length, const uint8_t *data);
+    uint32_t iwrap_framer_measure(const iwrap_framer_t *framer, const uint8_t *data, uint16_t length);
+    void iwrap_framer_deliver(uint8_t link_id, const iwrap_framer_t *framer, const uint8_t *message, uint16_t length);
+#endif
+
+#ifdef IWRAP_INCLUDE_TX_SCHEDULER
+    uint8_t iwrap_tx_sched_setup(uint8_t channel, uint8_t *buffer, uint16_t size, uint8_t weight, uint32_t rate);
+    uint8_t iwrap_tx_sched_command(const char *cmd, uint8_t mode);
+    uint8_t iwrap_tx_sched_data(uint8_t channel, uint32_t data_len, const uint8_t *data, uint8_t mode);
+    uint32_t iwrap_tx_sched_run(uint32_t budget);
+    void iwrap_tx_sched_flush(uint8_t channel);
+    uint8_t *iwrap_tx_flow_reserve(iwrap_tx_flow_t *flow, uint16_t length, uint8_t mode);
+    uint8_t *iwrap_tx_flow_head(iwrap_tx_flow_t *flow);
+#endif
+
+#ifdef IWRAP_INCLUDE_POWER
+    uint8_t iwrap_power_poll(uint8_t mode);
+    void iwrap_power_traffic(uint8_t link_id, uint16_t length);
+    void iwrap_power_set_mode(uint8_t link_id, uint8_t powermode);
+    void iwrap_power_link_event(uint8_t link_id, uint8_t connected);
+    void iwrap_power_list(uint8_t link_id, const uint8_t *line, uint16_t length);
+    void iwrap_power_dump(int (*write)(const char *text));
+#endif
+
+#ifdef IWRAP_INCLUDE_LINK_QUALITY
+    uint8_t iwrap_quality_poll(uint8_t mode);
+    void iwrap_quality_link_event(uint8_t link_id, uint8_t connected);
+    void iwrap_quality_sample(uint8_t metric, const iwrap_address_t *address, int32_t value);
+    void iwrap_quality_dump(int (*write)(const char *text));
+#endif
+
+#ifdef IWRAP_INCLUDE_DISCOVERY
+    uint16_t iwrap_discovery_hash(const iwrap_address_t *address);
+    iwrap_device_t *iwrap_discovery_find(const iwrap_address_t *address);
+    iwrap_device_t *iwrap_discovery_upsert(const iwrap_address_t *address);
+    void iwrap_discovery_remove(iwrap_device_t *device);
+    void iwrap_discovery_clear();
+    void iwrap_discovery_line(uint8_t type, const uint8_t *line, uint16_t length);
+    uint8_t iwrap_discovery_needs_name(const iwrap_device_t *device);
+    iwrap_device_t *iwrap_discovery_next_unnamed();
+    uint8_t iwrap_discovery_resolve(uint8_t mode);
+    void iwrap_discovery_dump(int (*write)(const char *text));
+#endif
+
+#ifdef IWRAP_INCLUDE_EIR
+    void iwrap_eir_begin(iwrap_eir_iterator_t *iterator, const uint8_t *data, uint8_t length);
+    uint8_t iwrap_eir_next(iwrap_eir_iterator_t *iterator, iwrap_eir_field_t *field);
+    uint8_t iwrap_eir_find(const uint8_t *data, uint8_t length, uint8_t type, iwrap_eir_field_t *field);
+    uint8_t iwrap_eir_name(const uint8_t *data, uint8_t length, const char **name, uint8_t *name_length);
+    uint8_t iwrap_eir_tx_power(const uint8_t *data, uint8_t length, int8_t *tx_power);
+    uint8_t iwrap_eir_manufacturer(const uint8_t *data, uint8_t length, uint16_t *company, const uint8_t **payload, uint8_t *payload_length);
+    uint8_t iwrap_eir_uuid_count(const iwrap_eir_field_t *field);
+    uint32_t iwrap_eir_uuid(const iwrap_eir_field_t *field, uint8_t index);
+    const uint8_t *iwrap_eir_uuid128(const iwrap_eir_field_t *field, uint8_t index);
+    uint8_t iwrap_eir_has_uuid(const uint8_t *data, uint8_t length, uint32_t uuid);
+    uint8_t iwrap_eir_has_uuid128(const uint8_t *data, uint8_t length, const uint8_t *uuid);
+    uint8_t iwrap_eir_accept(const uint8_t *data, uint8_t length);
+#endif
+
+#ifdef IWRAP_INCLUDE_COALESCE
+    uint8_t iwrap_coalesce_setup(uint8_t link_id, uint8_t *buffer, uint16_t size, uint16_t threshold, iwrap_time_t deadline);
+    uint8_t iwrap_coalesce_data(uint8_t link_id, uint32_t data_len, const uint8_t *data, uint8_t mode);
+    uint8_t iwrap_coalesce_flush(uint8_t link_id);
+    uint8_t iwrap_coalesce_poll();
+#endif
+
+#ifdef IWRAP_INCLUDE_LINK_CREDITS
+    uint8_t iwrap_link_credits_refresh(uint8_t mode);
+    uint8_t iwrap_link_credits_poll(uint8_t mode);
+    void iwrap_link_credits_reset(uint8_t link_id, uint16_t window);
+    void iwrap_link_credits_list(uint8_t link_id, const uint8_t *line, uint16_t length);
+    void iwrap_link_credits_stall(uint8_t link_id);
+#endif
+
+#ifdef IWRAP_INCLUDE_TX_QUEUE
+    void iwrap_tx_queue_init();
+    uint8_t iwrap_tx_submit_command(const char *cmd, uint8_t mode);
+    uint8_t iwrap_tx_submit_data(uint8_t channel, uint32_t data_len, const uint8_t *data, uint8_t mode);
+    uint16_t iwrap_tx_process(uint16_t max_slots);
+    uint8_t iwrap_tx_claim(uint16_t count, uint32_t *position);
+#endif
+
+#ifdef IWRAP_INCLUDE_RX_RINGS
+    uint8_t iwrap_rx_ring_setup(uint8_t link_id, uint8_t *buffer, uint16_t size, uint16_t high_water, uint16_t low_water);
+    uint8_t iwrap_rx_ring_push(uint8_t link_id, uint16_t length, const uint8_t *data);
+    uint16_t iwrap_rx_ring_depth(uint8_t link_id);
+    uint16_t iwrap_rx_ring_peek(uint8_t link_id, const uint8_t **data);
+    void iwrap_rx_ring_consume(uint8_t link_id, uint16_t length);
+    uint16_t iwrap_rx_ring_read(uint8_t link_id, uint8_t *dest, uint16_t length);
+    uint8_t iwrap_rx_rings_throttled();
+#endif
+
+#ifdef IWRAP_INCLUDE_LINK_STATS
+    void iwrap_link_stats_open(uint8_t link_id, iwrap_time_t now);
+    void iwrap_link_stats_close(uint8_t link_id, uint16_t error_code, iwrap_time_t now);
+    void iwrap_link_stats_account(uint8_t link_id, uint8_t tx, uint16_t length);
+    void iwrap_link_stats_sample(iwrap_link_stats_t *link, iwrap_time_t now);
+    void iwrap_link_stats_update();
+#endif
+
+#ifdef IWRAP_INCLUDE_TRACE
+    iwrap_trace_entry_t *iwrap_trace_record(uint8_t direction, uint8_t channel, uint8_t event, uint16_t length, const uint8_t *data);
+    uint8_t iwrap_trace_dump(int (*write)(int length, unsigned char *data));
+    void iwrap_trace_reset();
+#endif
+
+uint8_t iwrap_classify_line(const uint8_t *line, uint16_t length);
+uint8_t iwrap_track_line(uint8_t type, const uint8_t *line, uint16_t length);
+uint8_t iwrap_decode_rsp_call(uint8_t *line, uint16_t length, iwrap_rsp_call_t *out);
+uint8_t iwrap_decode_rsp_hid_get(uint8_t *line, uint16_t length, iwrap_rsp_hid_get_t *out);
+uint8_t iwrap_decode_rsp_info(uint8_t *line, uint16_t length, iwrap_rsp_info_t *out);
+uint8_t iwrap_decode_rsp_inquiry_count(uint8_t *line, uint16_t length, iwrap_rsp_inquiry_count_t *out);
+uint8_t iwrap_decode_rsp_inquiry_result(uint8_t *line, uint16_t length, iwrap_rsp_inquiry_result_t *out);
+uint8_t iwrap_decode_rsp_list_count(uint8_t *line, uint16_t length, iwrap_rsp_list_count_t *out);
+uint8_t iwrap_decode_rsp_list_result(uint8_t *line, uint16_t length, iwrap_rsp_list_result_t *out);
+uint8_t iwrap_decode_rsp_pair(uint8_t *line, uint16_t length, iwrap_rsp_pair_t *out);
+uint8_t iwrap_decode_rsp_set(uint8_t *line, uint16_t length, iwrap_rsp_set_t *out);
+uint8_t iwrap_decode_evt_a2dp_streaming_start(uint8_t *line, uint16_t length, iwrap_evt_a2dp_streaming_start_t *out);
+uint8_t iwrap_decode_evt_a2dp_streaming_stop(uint8_t *line, uint16_t length, iwrap_evt_a2dp_streaming_stop_t *out);
+uint8_t iwrap_decode_evt_connect(uint8_t *line, uint16_t length, iwrap_evt_connect_t *out);
+uint8_t iwrap_decode_evt_hid_output(uint8_t *line, uint16_t length, iwrap_evt_hid_output_t *out);
+uint8_t iwrap_decode_evt_hid_suspend(uint8_t *line, uint16_t length, iwrap_evt_hid_suspend_t *out);
+uint8_t iwrap_decode_evt_hfp(uint8_t *line, uint16_t length, iwrap_evt_hfp_t *out);
+uint8_t iwrap_decode_evt_hfp_ag(uint8_t *line, uint16_t length, iwrap_evt_hfp_ag_t *out);
+uint8_t iwrap_decode_evt_ident(uint8_t *line, uint16_t length, iwrap_evt_ident_t *out);
+uint8_t iwrap_decode_evt_ident_error(uint8_t *line, uint16_t length, iwrap_evt_ident_error_t *out);
+uint8_t iwrap_decode_evt_inquiry_extended(uint8_t *line, uint16_t length, iwrap_evt_inquiry_extended_t *out);
+uint8_t iwrap_decode_evt_inquiry_partial(uint8_t *line, uint16_t length, iwrap_evt_inquiry_partial_t *out);
+uint8_t iwrap_decode_evt_name(uint8_t *line, uint16_t length, iwrap_evt_name_t *out);
+uint8_t iwrap_decode_evt_name_error(uint8_t *line, uint16_t length, iwrap_evt_name_error_t *out);
+uint8_t iwrap_decode_evt_no_carrier(uint8_t *line, uint16_t length, iwrap_evt_no_carrier_t *out);
+uint8_t iwrap_decode_evt_pair(uint8_t *line, uint16_t length, iwrap_evt_pair_t *out);
+uint8_t iwrap_decode_evt_ring(uint8_t *line, uint16_t length, iwrap_evt_ring_t *out);
+uint8_t iwrap_decode_rsp_ber(uint8_t *line, uint16_t length, iwrap_rsp_ber_t *out);
+uint8_t iwrap_decode_rsp_rssi(uint8_t *line, uint16_t length, iwrap_rsp_rssi_t *out);
+uint8_t iwrap_decode_rsp_temp(uint8_t *line, uint16_t length, iwrap_rsp_temp_t *out);
+uint8_t iwrap_decode_rsp_txpower(uint8_t *line, uint16_t length, iwrap_rsp_txpower_t *out);
+uint8_t iwrap_decode_evt_battery(uint8_t *line, uint16_t length, iwrap_evt_battery_t *out);
+uint8_t iwrap_decode_evt_battery_full(uint8_t *line, uint16_t length, iwrap_evt_battery_full_t *out);
+uint8_t iwrap_decode_evt_battery_low(uint8_t *line, uint16_t length, iwrap_evt_battery_low_t *out);
+uint8_t iwrap_decode_evt_battery_shutdown(uint8_t *line, uint16_t length, iwrap_evt_battery_shutdown_t *out);
+
+#ifdef IWRAP_INCLUDE_EVENTS
+    uint8_t iwrap_event_queue_push(iwrap_event_queue_t *queue, const iwrap_event_t *event);
+    const iwrap_event_t *iwrap_event_queue_peek(iwrap_event_queue_t *queue);
+    void iwrap_event_queue_pop(iwrap_event_queue_t *queue);
+#endif
+
+void iwrap_histogram_record(iwrap_histogram_t *histogram, iwrap_time_t value);
+uint8_t iwrap_histogram_bucket(iwrap_time_t value);
+iwrap_time_t iwrap_histogram_bucket_floor(uint8_t index);
+iwrap_time_t iwrap_histogram_percentile(const iwrap_histogram_t *histogram, uint8_t percent);
+void iwrap_histogram_dump(const iwrap_histogram_t *histogram, const char *name, int (*write)(const char *text));
+#ifdef IWRAP_INCLUDE_LATENCY
+    void iwrap_latency_dump(int (*write)(const char *text));
+    void iwrap_latency_reset();
+#endif
+
+uint8_t iwrap_utoa(uint32_t value, char *dest);
+#ifdef IWRAP_DEBUG
+    void iwrap_debug_frame(const char *prefix, uint8_t channel, uint16_t length, const uint8_t *data);
+#endif
+uint16_t iwrap_scan_end(const uint8_t *line, uint16_t length);
+uint8_t iwrap_scan_uint(const uint8_t *line, uint16_t length, uint16_t *pos, uint8_t base, uint32_t *value);
+uint8_t iwrap_scan_int(const uint8_t *line, uint16_t length, uint16_t *pos, int32_t *value);
+uint8_t iwrap_scan_address(const uint8_t *line, uint16_t length, uint16_t *pos, iwrap_address_t *address);
+uint8_t iwrap_scan_skip(const uint8_t *line, uint16_t length, uint16_t *pos, const char *text);
+uint8_t iwrap_scan_find(const uint8_t *line, uint16_t length, uint16_t *pos, uint8_t c);
+uint16_t iwrap_scan_hex(const uint8_t *line, uint16_t length, uint16_t *pos, uint8_t *dest, uint16_t maxlen);
 uint8_t iwrap_hexstrtobin(const char *nptr, char **endptr, uint8_t *dest, uint8_t maxlen);
 uint8_t iwrap_bintohexstr(const uint8_t *bin, uint16_t len, char **dest, uint8_t delin, uint8_t nullterm);
 
 extern uint8_t iwrap_pending_boot;
 extern uint8_t iwrap_pending_commands;
+extern const char *iwrap_command_names[IWRAP_COMMAND_COUNT];
+#if defined(IWRAP_INCLUDE_STATS) || defined(IWRAP_INCLUDE_PROFILE)
+    extern const char *iwrap_event_names[IWRAP_EVENT_COUNT];
+#endif
 extern uint8_t iwrap_last_command_result;
 
 extern int (*iwrap_output)(int length, unsigned char *data);
+extern int (*iwrap_output_vector)(uint8_t count, const iwrap_iovec_t *vector);    // optional, e.g. writev()
+extern uint16_t iwrap_link_mtu[IWRAP_MAX_LINKS];    // max data bytes per frame by link ID (0 = IWRAP_MUX_MAX_PAYLOAD)
+extern iwrap_time_t (*iwrap_timestamp)();
 
 #ifdef IWRAP_DEBUG
     extern int (*iwrap_debug)(const char *data);
+    extern uint16_t iwrap_debug_sample;         // output every Nth frame (1 = all, 0 = none)
+    extern uint16_t iwrap_debug_rate_limit;     // max frames output per second (0 = unlimited, needs iwrap_timestamp)
+    extern uint32_t iwrap_debug_suppressed;     // frames skipped by sampling or rate limit
+#endif
+
+#ifdef IWRAP_INCLUDE_STATS
+    extern iwrap_stats_t iwrap_stats;
+#endif
+#ifdef IWRAP_INCLUDE_LATENCY
+    extern iwrap_latency_t iwrap_latency;
+#endif
+#ifdef IWRAP_INCLUDE_RX_TIMING
+    extern iwrap_rx_timing_t iwrap_rx_timing;
+    extern iwrap_time_t iwrap_rx_burst_gap;     // longer gaps between bytes start a new burst
+    extern iwrap_time_t iwrap_rx_time_first;    // arrival of first byte of current frame (valid in callbacks)
+    extern iwrap_time_t iwrap_rx_time_last;     // arrival of last byte of current frame (valid in callbacks)
+#endif
+#ifdef IWRAP_INCLUDE_PROFILE
+    extern iwrap_profile_t iwrap_profile;
+    extern iwrap_time_t iwrap_callback_budget;  // dispatch time allowed per frame before iwrap_callback_slow (0 = no limit)
+    extern void (*iwrap_callback_slow)(uint8_t event, uint8_t channel, iwrap_time_t elapsed);
+#endif
+#ifdef IWRAP_INCLUDE_REASSEMBLY
+    extern iwrap_framer_t iwrap_framers[IWRAP_MAX_LINKS];
+    extern void (*iwrap_callback_rxmessage)(uint8_t link_id, uint16_t length, const uint8_t *data);
+#endif
+#ifdef IWRAP_INCLUDE_TX_SCHEDULER
+    extern iwrap_tx_scheduler_t iwrap_tx_scheduler;
+#endif
+#ifdef IWRAP_INCLUDE_POWER
+    extern iwrap_power_link_t iwrap_power_links[IWRAP_MAX_LINKS];
+    extern uint8_t iwrap_power_manage;
+    extern iwrap_time_t iwrap_power_latency;
+    extern iwrap_time_t iwrap_power_idle;
+    extern iwrap_time_t iwrap_power_dwell;
+    extern iwrap_time_t iwrap_power_window;
+    extern uint16_t iwrap_power_wake_bytes;
+    extern void (*iwrap_callback_power)(uint8_t link_id, uint8_t powermode);
+#endif
+#ifdef IWRAP_INCLUDE_LINK_QUALITY
+    extern iwrap_quality_link_t iwrap_quality_links[IWRAP_MAX_LINKS];
+    extern uint8_t iwrap_quality_metrics;       // metrics polled, bit (1 << IWRAP_QUALITY_*) each (0 = polling off)
+    extern iwrap_time_t iwrap_quality_interval;
+    extern uint8_t iwrap_quality_batch;
+    extern void (*iwrap_callback_quality)(uint8_t link_id, uint8_t metric, int32_t value);
+#endif
+#ifdef IWRAP_INCLUDE_DISCOVERY
+    extern iwrap_discovery_t iwrap_discovery;
+    extern iwrap_time_t iwrap_discovery_name_ttl;
+    extern iwrap_time_t iwrap_discovery_name_retry;
+    extern void (*iwrap_callback_discovery)(const iwrap_device_t *device, uint8_t change);
+#endif
+#ifdef IWRAP_INCLUDE_EIR
+    extern iwrap_eir_filter_t iwrap_eir_filter;
+    extern uint32_t iwrap_eir_filtered;         // INQUIRY_EXTENDED events dropped by iwrap_eir_filter
+#endif
+#ifdef IWRAP_INCLUDE_COALESCE
+    extern iwrap_coalescer_t iwrap_coalescers[IWRAP_MAX_LINKS];
+#endif
+#ifdef IWRAP_INCLUDE_LINK_CREDITS
+    extern iwrap_link_credit_t iwrap_link_credits[IWRAP_MAX_LINKS];
+    extern uint16_t iwrap_link_credit_window;    // window given to links on CONNECT/RING (0 = no credit control)
+    extern iwrap_time_t iwrap_link_credit_interval;
+#endif
+#ifdef IWRAP_INCLUDE_TX_QUEUE
+    extern iwrap_tx_queue_t iwrap_tx_queue;
+#endif
+#ifdef IWRAP_INCLUDE_RX_RINGS
+    extern iwrap_rx_ring_t iwrap_rx_rings[IWRAP_MAX_LINKS];
+    extern void (*iwrap_callback_rx_throttle)(uint8_t link_id, uint8_t throttle);    // e.g. drive RTS or stop reading UART
+#endif
+#ifdef IWRAP_INCLUDE_LINK_STATS
+    extern iwrap_link_stats_t iwrap_link_stats[IWRAP_MAX_LINKS];
+    extern void (*iwrap_callback_link_closed)(uint8_t link_id, uint16_t error_code, const iwrap_link_stats_t *stats);
+#endif
+#ifdef IWRAP_INCLUDE_TRACE
+    extern iwrap_trace_t iwrap_trace;
+#endif
+#ifdef IWRAP_INCLUDE_EVENTS
+    extern void (*iwrap_callback_event)(const iwrap_event_t *event);
+    extern iwrap_event_queue_t *iwrap_event_queue;
 #endif
 
 #ifdef IWRAP_INCLUDE_TXCOMMAND
@@ -385,4 +1364,8 @@ extern int (*iwrap_output)(int length, unsigned char *data);
     extern void (*iwrap_evt_volume)(uint8_t volume);
 #endif
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* _IWRAP_H_ */
\ No newline at end of file
@@ -0,0 +1,414 @@
+// iWRAP external host controller library - C++ parser template
+// 2026-10-19
+//
+// Changelog:
+//  2026-10-19 - Add RSSI/TXPOWER/BER/TEMP/BATTERY records
+//  2026-10-19 - Add compile-time MUX frame builder
+//  2026-10-19 - Initial release
+
+/* ============================================
+iWRAP host controller library code is placed under the MIT license
+Copyright (c) 2015 Jeff Rowberg
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+===============================================
+*/
+
+#ifndef _IWRAP_HPP_
+#define _IWRAP_HPP_
+
+#include "iWRAP.h"
+
+// Compile-time bound alternative to iwrap_parse() for C++11 hosts. The handler
+// is any class with zero or more "void on(const record &)" overloads, where the
+// record is one of the iwrap_rsp_*_t / iwrap_evt_*_t types from iWRAP.h or one
+// of the iwrap:: records below. Responses/events with no matching overload are
+// never decoded and their dispatch code is not instantiated:
+//
+//     struct App {
+//         void on(const iwrap_evt_ring_t &ring) { ... }
+//         void on(const iwrap::idle_t &idle) { ... }
+//     };
+//
+//     App app;
+//     iwrap::Parser<App> parser(app);
+//     while (uart_rx(&b)) parser.parse(b, IWRAP_MODE_MUX);
+//
+// Pending command tracking (iwrap_pending_commands, iwrap_last_command_result)
+// is shared with the C API, so iwrap_send_command() works unchanged. No STL
+// headers are used, so this builds with avr-gcc as well.
+
+namespace iwrap {
+
+// records for responses/events which have no iWRAP.h record type
+struct ok_t {};
+struct ready_t {};
+struct rsp_at_t {};
+struct rsp_syntax_error_t {};
+struct idle_t { uint8_t result; };
+struct rx_output_t { uint16_t length; const uint8_t *data; };
+struct rx_data_t { uint8_t channel; uint16_t length; const uint8_t *data; };
+
+namespace detail {
+
+    template <bool B> struct flag {};
+
+    // declared only, for use in unevaluated operands
+    template <class T> T &reference();
+
+    // has_on<H, T>::value is true when "h.on(const T &)" is a valid call
+    template <class H, class T> class has_on {
+        template <class U> static char test(decltype(reference<U>().on(reference<const T>())) *);
+        template <class U> static long test(...);
+    public:
+        static const bool value = sizeof(test<H>(0)) == sizeof(char);
+    };
+
+    // indices<0, 1, ..., N - 1> built in log(N) template depth, so the largest
+    // 1023-byte MUX payload stays well within default instantiation limits
+    template <uint16_t... I> struct indices {};
+    template <class A, class B> struct concat_indices;
+    template <uint16_t... I, uint16_t... J> struct concat_indices<indices<I...>, indices<J...> > {
+        typedef indices<I..., (uint16_t)(sizeof...(I) + J)...> type;
+    };
+    template <uint16_t N> struct make_indices {
+        typedef typename concat_indices<typename make_indices<N / 2>::type, typename make_indices<N - N / 2>::type>::type type;
+    };
+    template <> struct make_indices<0> { typedef indices<> type; };
+    template <> struct make_indices<1> { typedef indices<0> type; };
+
+} // namespace detail
+
+/**
+ * @brief Complete MUX frame with an N-byte payload
+ */
+template <uint16_t N>
+struct Frame {
+    uint8_t data[N + 5];
+    static constexpr uint16_t size() { return N + 5; }
+};
+
+namespace detail {
+
+    template <uint16_t N, uint16_t... I>
+    constexpr Frame<N> build_frame(uint8_t channel, const char *payload, indices<I...>) {
+        return Frame<N>{{ 0xBF, channel, (uint8_t)((N >> 8) & 0x03), (uint8_t)(N & 0xFF), (uint8_t)payload[I]..., (uint8_t)(channel ^ 0xFF) }};
+    }
+
+} // namespace detail
+
+/**
+ * @brief Build complete MUX frame from string literal at compile time
+ * @param payload Command or data (terminating null is not included)
+ * @param channel Link ID, or 0xFF for iWRAP command channel
+ * @return MUX frame, to be sent with iwrap::send() or iwrap_send_frame()
+ *
+ * Declare the result constexpr so it is placed in read-only data:
+ *
+ *     static constexpr auto set_bt_pair = iwrap::mux_frame("SET BT PAIR");
+ *     iwrap::send(set_bt_pair, IWRAP_MODE_MUX);
+ */
+template <uint16_t L>
+constexpr Frame<L - 1> mux_frame(const char (&payload)[L], uint8_t channel = 0xFF) {
+    static_assert(L >= 1 && L - 1 <= 1023, "MUX frame payload is limited to 1023 bytes");
+    return detail::build_frame<L - 1>(channel, payload, typename detail::make_indices<L - 1>::type());
+}
+
+/**
+ * @brief Send pre-built MUX frame
+ * @param frame Frame built by iwrap::mux_frame()
+ * @param mode Sending mode (MUX sends whole frame, non-MUX sends only the payload)
+ * @return Result code (non-zero indicates error)
+ */
+template <uint16_t N>
+inline uint8_t send(const Frame<N> &frame, uint8_t mode) {
+    return iwrap_send_frame(frame.size(), frame.data, mode);
+}
+
+/**
+ * @brief iWRAP parser bound at compile time to a handler class
+ * @tparam Handler Class providing on(const record &) overloads
+ * @tparam BufferSize Receive buffer size, must hold the longest expected line or MUX frame
+ */
+template <class Handler, uint16_t BufferSize = 128>
+class Parser {
+public:
+    explicit Parser(Handler &handler) : handler(handler), length(0), in_packet(0) {}
+
+    /**
+     * @brief Parse incoming data from iWRAP module
+     * @param b Incoming byte to parse
+     * @param mode Receiving mode (MUX or non-MUX)
+     * @return Result code (non-zero indicates error)
+     */
+    uint8_t parse(uint8_t b, uint8_t mode) {
+        // wait for start of frame in MUX mode
+        if (mode == IWRAP_MODE_MUX && !in_packet && b != 0xBF) return 0;
+
+        // drop anything too long for the buffer and resynchronize
+        if (length >= BufferSize) {
+            length = 0;
+            in_packet = 0;
+            return 1;
+        }
+
+        buffer[length++] = b;
+        in_packet = 1;
+
+        if (mode == IWRAP_MODE_MUX) {
+            #ifdef IWRAP_INCLUDE_MUX
+                uint8_t channel, flags;
+                uint16_t frame_length, payload_length;
+                uint8_t *payload;
+
+                // check for a complete frame (10-bit length field)
+                if (length < 5) return 0;
+                frame_length = (uint16_t)((((buffer[2] & 0x03) << 8) | buffer[3]) + 5);
+                if (length != frame_length) return 0;
+                length = 0;
+                in_packet = 0;
+                if (iwrap_unpack_mux_frame(frame_length, buffer, &channel, &flags, &payload_length, &payload, 0)) return 2;
+                process(channel, payload, payload_length);
+            #else
+                return 0xFE; // MUX mode not supported
+            #endif
+        } else if (b == '\n') {
+            uint16_t line_length = length;
+            length = 0;
+            in_packet = 0;
+            process(mode == IWRAP_MODE_COMMAND ? 0xFF : 0xFE, buffer, line_length);
+        }
+        return 0;
+    }
+
+private:
+    Handler &handler;
+    uint8_t buffer[BufferSize];
+    uint16_t length;
+    uint8_t in_packet;
+
+    template <class T> void notify(const T &record) {
+        notify(record, detail::flag<detail::has_on<Handler, T>::value>());
+    }
+    template <class T> void notify(const T &record, detail::flag<true>) { handler.on(record); }
+    template <class T> void notify(const T &, detail::flag<false>) {}
+
+    template <class T, uint8_t (*Decode)(uint8_t *, uint16_t, T *)> void deliver(uint8_t *line, uint16_t line_length) {
+        deliver<T, Decode>(line, line_length, detail::flag<detail::has_on<Handler, T>::value>());
+    }
+    template <class T, uint8_t (*Decode)(uint8_t *, uint16_t, T *)> void deliver(uint8_t *line, uint16_t line_length, detail::flag<true>) {
+        T record;
+        if (!Decode(line, line_length, &record)) handler.on(static_cast<const T &>(record));
+    }
+    template <class T, uint8_t (*Decode)(uint8_t *, uint16_t, T *)> void deliver(uint8_t *, uint16_t, detail::flag<false>) {}
+
+    void process(uint8_t channel, uint8_t *line, uint16_t line_length) {
+        if (channel != 0xFF) {
+            rx_data_t data = { channel, line_length, line };
+            notify(data);
+            return;
+        }
+
+        rx_output_t output = { line_length, line };
+        notify(output);
+
+        switch (iwrap_track_line(iwrap_classify_line(line, line_length), line, line_length)) {
+            case IWRAP_EVENT_OK:
+                if (!iwrap_pending_commands) {
+                    idle_t idle = { iwrap_last_command_result };
+                    notify(idle);
+                }
+                notify(ok_t());
+                iwrap_last_command_result = 0;
+                break;
+            case IWRAP_EVENT_READY: notify(ready_t()); break;
+            case IWRAP_EVENT_RSP_AT: notify(rsp_at_t()); break;
+            case IWRAP_EVENT_RSP_SYNTAX_ERROR: notify(rsp_syntax_error_t()); break;
+            case IWRAP_EVENT_RSP_CALL: deliver<iwrap_rsp_call_t, iwrap_decode_rsp_call>(line, line_length); break;
+            case IWRAP_EVENT_RSP_HID_GET: deliver<iwrap_rsp_hid_get_t, iwrap_decode_rsp_hid_get>(line, line_length); break;
+            case IWRAP_EVENT_RSP_INFO: deliver<iwrap_rsp_info_t, iwrap_decode_rsp_info>(line, line_length); break;
+            case IWRAP_EVENT_RSP_INQUIRY_COUNT: deliver<iwrap_rsp_inquiry_count_t, iwrap_decode_rsp_inquiry_count>(line, line_length); break;
+            case IWRAP_EVENT_RSP_INQUIRY_RESULT: deliver<iwrap_rsp_inquiry_result_t, iwrap_decode_rsp_inquiry_result>(line, line_length); break;
+            case IWRAP_EVENT_RSP_LIST_COUNT: deliver<iwrap_rsp_list_count_t, iwrap_decode_rsp_list_count>(line, line_length); break;
+            case IWRAP_EVENT_RSP_LIST_RESULT: deliver<iwrap_rsp_list_result_t, iwrap_decode_rsp_list_result>(line, line_length); break;
+            case IWRAP_EVENT_RSP_PAIR: deliver<iwrap_rsp_pair_t, iwrap_decode_rsp_pair>(line, line_length); break;
+            case IWRAP_EVENT_RSP_SET: deliver<iwrap_rsp_set_t, iwrap_decode_rsp_set>(line, line_length); break;
+            case IWRAP_EVENT_A2DP_STREAMING_START: deliver<iwrap_evt_a2dp_streaming_start_t, iwrap_decode_evt_a2dp_streaming_start>(line, line_length); break;
+            case IWRAP_EVENT_A2DP_STREAMING_STOP: deliver<iwrap_evt_a2dp_streaming_stop_t, iwrap_decode_evt_a2dp_streaming_stop>(line, line_length); break;
+            case IWRAP_EVENT_CONNECT: deliver<iwrap_evt_connect_t, iwrap_decode_evt_connect>(line, line_length); break;
+            case IWRAP_EVENT_HID_OUTPUT: deliver<iwrap_evt_hid_output_t, iwrap_decode_evt_hid_output>(line, line_length); break;
+            case IWRAP_EVENT_HID_SUSPEND: deliver<iwrap_evt_hid_suspend_t, iwrap_decode_evt_hid_suspend>(line, line_length); break;
+            case IWRAP_EVENT_HFP: deliver<iwrap_evt_hfp_t, iwrap_decode_evt_hfp>(line, line_length); break;
+            case IWRAP_EVENT_HFP_AG: deliver<iwrap_evt_hfp_ag_t, iwrap_decode_evt_hfp_ag>(line, line_length); break;
+            case IWRAP_EVENT_IDENT: deliver<iwrap_evt_ident_t, iwrap_decode_evt_ident>(line, line_length); break;
+            case IWRAP_EVENT_IDENT_ERROR: deliver<iwrap_evt_ident_error_t, iwrap_decode_evt_ident_error>(line, line_length); break;
+            case IWRAP_EVENT_INQUIRY_EXTENDED: deliver<iwrap_evt_inquiry_extended_t, iwrap_decode_evt_inquiry_extended>(line, line_length); break;
+            case IWRAP_EVENT_INQUIRY_PARTIAL: deliver<iwrap_evt_inquiry_partial_t, iwrap_decode_evt_inquiry_partial>(line, line_length); break;
+            case IWRAP_EVENT_NAME: deliver<iwrap_evt_name_t, iwrap_decode_evt_name>(line, line_length); break;
+            case IWRAP_EVENT_NAME_ERROR: deliver<iwrap_evt_name_error_t, iwrap_decode_evt_name_error>(line, line_length); break;
+            case IWRAP_EVENT_NO_CARRIER: deliver<iwrap_evt_no_carrier_t, iwrap_decode_evt_no_carrier>(line, line_length); break;
+            case IWRAP_EVENT_PAIR: deliver<iwrap_evt_pair_t, iwrap_decode_evt_pair>(line, line_length); break;
+            case IWRAP_EVENT_RING: deliver<iwrap_evt_ring_t, iwrap_decode_evt_ring>(line, line_length); break;
+            case IWRAP_EVENT_RSP_BER: deliver<iwrap_rsp_ber_t, iwrap_decode_rsp_ber>(line, line_length); break;
+            case IWRAP_EVENT_RSP_RSSI: deliver<iwrap_rsp_rssi_t, iwrap_decode_rsp_rssi>(line, line_length); break;
+            case IWRAP_EVENT_RSP_TEMP: deliver<iwrap_rsp_temp_t, iwrap_decode_rsp_temp>(line, line_length); break;
+            case IWRAP_EVENT_RSP_TXPOWER: deliver<iwrap_rsp_txpower_t, iwrap_decode_rsp_txpower>(line, line_length); break;
+            case IWRAP_EVENT_BATTERY: deliver<iwrap_evt_battery_t, iwrap_decode_evt_battery>(line, line_length); break;
+            case IWRAP_EVENT_BATTERY_FULL: deliver<iwrap_evt_battery_full_t, iwrap_decode_evt_battery_full>(line, line_length); break;
+            case IWRAP_EVENT_BATTERY_LOW: deliver<iwrap_evt_battery_low_t, iwrap_decode_evt_battery_low>(line, line_length); break;
+            case IWRAP_EVENT_BATTERY_SHUTDOWN: deliver<iwrap_evt_battery_shutdown_t, iwrap_decode_evt_battery_shutdown>(line, line_length); break;
+        }
+    }
+};
+
+/**
+ * @brief Handler forwarding every record to the C API callback pointers
+ *
+ * iwrap::Parser<iwrap::CallbackHandler> behaves like iwrap_parse() with the
+ * same IWRAP_INCLUDE_* selection, minus debug output and the event queue.
+ */
+struct CallbackHandler {
+    #ifdef IWRAP_INCLUDE_RXOUTPUT
+        void on(const rx_output_t &r) { if (iwrap_callback_rxoutput) iwrap_callback_rxoutput(r.length, r.data); }
+    #endif
+    #ifdef IWRAP_INCLUDE_RXDATA
+        void on(const rx_data_t &r) { if (iwrap_callback_rxdata) iwrap_callback_rxdata(r.channel, r.length, r.data); }
+    #endif
+    #ifdef IWRAP_INCLUDE_IDLE
+        void on(const idle_t &r) { if (iwrap_callback_idle) iwrap_callback_idle(r.result); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_OK
+        void on(const ok_t &) { if (iwrap_evt_ok) iwrap_evt_ok(); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_READY
+        void on(const ready_t &) { if (iwrap_evt_ready) iwrap_evt_ready(); }
+    #endif
+    #ifdef IWRAP_INCLUDE_RSP_AT
+        void on(const rsp_at_t &) { if (iwrap_rsp_at) iwrap_rsp_at(); }
+    #endif
+    #ifdef IWRAP_INCLUDE_RSP_SYNTAX_ERROR
+        void on(const rsp_syntax_error_t &) { if (iwrap_rsp_syntax_error) iwrap_rsp_syntax_error(); }
+    #endif
+    #ifdef IWRAP_INCLUDE_RSP_BER
+        void on(const iwrap_rsp_ber_t &r) { if (iwrap_rsp_ber) iwrap_rsp_ber(&r.bd_addr, r.ber); }
+    #endif
+    #ifdef IWRAP_INCLUDE_RSP_CALL
+        void on(const iwrap_rsp_call_t &r) { if (iwrap_rsp_call) iwrap_rsp_call(r.link_id); }
+    #endif
+    #ifdef IWRAP_INCLUDE_RSP_HID_GET
+        void on(const iwrap_rsp_hid_get_t &r) { if (iwrap_rsp_hid_get) iwrap_rsp_hid_get(r.length, r.descriptor); }
+    #endif
+    #ifdef IWRAP_INCLUDE_RSP_INFO
+        void on(const iwrap_rsp_info_t &r) { if (iwrap_rsp_info) iwrap_rsp_info(r.length, r.info); }
+    #endif
+    #ifdef IWRAP_INCLUDE_RSP_INQUIRY_COUNT
+        void on(const iwrap_rsp_inquiry_count_t &r) { if (iwrap_rsp_inquiry_count) iwrap_rsp_inquiry_count(r.num_of_devices); }
+    #endif
+    #ifdef IWRAP_INCLUDE_RSP_INQUIRY_RESULT
+        void on(const iwrap_rsp_inquiry_result_t &r) { if (iwrap_rsp_inquiry_result) iwrap_rsp_inquiry_result(&r.bd_addr, r.class_of_device, r.rssi); }
+    #endif
+    #ifdef IWRAP_INCLUDE_RSP_LIST_COUNT
+        void on(const iwrap_rsp_list_count_t &r) { if (iwrap_rsp_list_count) iwrap_rsp_list_count(r.num_of_connections); }
+    #endif
+    #ifdef IWRAP_INCLUDE_RSP_LIST_RESULT
+        void on(const iwrap_rsp_list_result_t &r) {
+            if (iwrap_rsp_list_result) iwrap_rsp_list_result(r.link_id, r.mode, r.blocksize, r.elapsed_time, r.local_msc, r.remote_msc,
+                &r.bd_addr, r.channel, r.direction, r.powermode, r.role, r.crypt, r.buffer, r.eretx);
+        }
+    #endif
+    #ifdef IWRAP_INCLUDE_RSP_PAIR
+        void on(const iwrap_rsp_pair_t &r) { if (iwrap_rsp_pair) iwrap_rsp_pair(&r.bd_addr, r.result); }
+    #endif
+    #ifdef IWRAP_INCLUDE_RSP_RSSI
+        void on(const iwrap_rsp_rssi_t &r) { if (iwrap_rsp_rssi) iwrap_rsp_rssi(&r.bd_addr, r.rssi); }
+    #endif
+    #ifdef IWRAP_INCLUDE_RSP_SET
+        void on(const iwrap_rsp_set_t &r) { if (iwrap_rsp_set) iwrap_rsp_set(r.category, r.option, r.value); }
+    #endif
+    #ifdef IWRAP_INCLUDE_RSP_TEMP
+        void on(const iwrap_rsp_temp_t &r) { if (iwrap_rsp_temp) iwrap_rsp_temp(r.temp); }
+    #endif
+    #ifdef IWRAP_INCLUDE_RSP_TXPOWER
+        void on(const iwrap_rsp_txpower_t &r) { if (iwrap_rsp_txpower) iwrap_rsp_txpower(&r.bd_addr, r.txpower); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_A2DP_STREAMING_START
+        void on(const iwrap_evt_a2dp_streaming_start_t &r) { if (iwrap_evt_a2dp_streaming_start) iwrap_evt_a2dp_streaming_start(r.link_id); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_A2DP_STREAMING_STOP
+        void on(const iwrap_evt_a2dp_streaming_stop_t &r) { if (iwrap_evt_a2dp_streaming_stop) iwrap_evt_a2dp_streaming_stop(r.link_id); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_BATTERY
+        void on(const iwrap_evt_battery_t &r) { if (iwrap_evt_battery) iwrap_evt_battery(r.mv); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_BATTERY_FULL
+        void on(const iwrap_evt_battery_full_t &r) { if (iwrap_evt_battery_full) iwrap_evt_battery_full(r.mv); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_BATTERY_LOW
+        void on(const iwrap_evt_battery_low_t &r) { if (iwrap_evt_battery_low) iwrap_evt_battery_low(r.mv); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_BATTERY_SHUTDOWN
+        void on(const iwrap_evt_battery_shutdown_t &r) { if (iwrap_evt_battery_shutdown) iwrap_evt_battery_shutdown(r.mv); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_CONNECT
+        void on(const iwrap_evt_connect_t &r) { if (iwrap_evt_connect) iwrap_evt_connect(r.link_id, r.profile, r.target, r.has_address ? &r.address : 0); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_HID_OUTPUT
+        void on(const iwrap_evt_hid_output_t &r) { if (iwrap_evt_hid_output) iwrap_evt_hid_output(r.link_id, r.data_length, r.data); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_HID_SUSPEND
+        void on(const iwrap_evt_hid_suspend_t &r) { if (iwrap_evt_hid_suspend) iwrap_evt_hid_suspend(r.link_id); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_HFP
+        void on(const iwrap_evt_hfp_t &r) { if (iwrap_evt_hfp) iwrap_evt_hfp(r.link_id, r.type, r.detail); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_HFP_AG
+        void on(const iwrap_evt_hfp_ag_t &r) { if (iwrap_evt_hfp_ag) iwrap_evt_hfp_ag(r.link_id, r.type, r.detail); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_IDENT
+        void on(const iwrap_evt_ident_t &r) { if (iwrap_evt_ident) iwrap_evt_ident(r.src, r.vendor_id, r.product_id, r.version, r.descr); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_IDENT_ERROR
+        void on(const iwrap_evt_ident_error_t &r) { if (iwrap_evt_ident_error) iwrap_evt_ident_error(r.error_code, &r.address, r.message); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_INQUIRY_EXTENDED
+        void on(const iwrap_evt_inquiry_extended_t &r) { if (iwrap_evt_inquiry_extended) iwrap_evt_inquiry_extended(&r.address, r.length, r.data); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_INQUIRY_PARTIAL
+        void on(const iwrap_evt_inquiry_partial_t &r) { if (iwrap_evt_inquiry_partial) iwrap_evt_inquiry_partial(&r.address, r.class_of_device, r.cached_name, r.rssi); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_NAME
+        void on(const iwrap_evt_name_t &r) { if (iwrap_evt_name) iwrap_evt_name(&r.address, r.friendly_name); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_NAME_ERROR
+        void on(const iwrap_evt_name_error_t &r) { if (iwrap_evt_name_error) iwrap_evt_name_error(r.error_code, &r.address, r.message); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_NO_CARRIER
+        void on(const iwrap_evt_no_carrier_t &r) { if (iwrap_evt_no_carrier) iwrap_evt_no_carrier(r.link_id, r.error_code, r.message); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_PAIR
+        void on(const iwrap_evt_pair_t &r) { if (iwrap_evt_pair) iwrap_evt_pair(&r.address, r.key_type, r.link_key); }
+    #endif
+    #ifdef IWRAP_INCLUDE_EVT_RING
+        void on(const iwrap_evt_ring_t &r) { if (iwrap_evt_ring) iwrap_evt_ring(r.link_id, &r.address, r.channel, r.profile); }
+    #endif
+};
+
+} // namespace iwrap
+
+#endif /* _IWRAP_HPP_ */
@@ -2,6 +2,8 @@
 // 2014-05-25 by Jeff Rowberg <jeff@rowberg.net>
 //
 // Changelog:
+//  2026-10-19 - Use iwrap_cmd_call() instead of formatting CALL command string
+//  2026-10-19 - Send constant commands as compile-time MUX frames, fix MUX 0 frame length
 //  2014-05-25 - Initial release
 
 /* ============================================
@@ -39,10 +41,10 @@ THE SOFTWARE.
 // pre-built MUX frames can be handy for changing various settings, e.g.
 // using an app like Realterm with the "Send" tab and "Send Numbers"
 // button to send a hex string while the module is configured with MUX
-// mode enabled:
+// mode enabled (iwrap::mux_frame() in iWRAP.hpp builds these for you):
 //
 // MUX frame for "SET CONTROL MUX 0" (disable MUX mode):
-//      $bf $ff $00 $17 $53 $45 $54 $20 $43 $4f $4e $54 $52 $4f $4c $20 $4d $55 $58 $20 $30 $00
+//      $bf $ff $00 $11 $53 $45 $54 $20 $43 $4f $4e $54 $52 $4f $4c $20 $4d $55 $58 $20 $30 $00
 // MUX frame for "SET CONTROL BAUD 38400":
 //      $bf $ff $00 $16 $53 $45 $54 $20 $43 $4f $4e $54 $52 $4f $4c $20 $42 $41 $55 $44 $20 $33 $38 $34 $30 $30 $00
 // MUX frame for "SET CONTROL BAUD 115200":
@@ -81,6 +83,16 @@ THE SOFTWARE.
 // -------------------------------------------------
 
 #include <iWRAP.h>
+#include <iWRAP.hpp>
+
+// constant commands, pre-built as complete MUX frames at compile time
+static constexpr auto cmd_at = iwrap::mux_frame("AT");
+static constexpr auto cmd_set = iwrap::mux_frame("SET");
+static constexpr auto cmd_list = iwrap::mux_frame("LIST");
+static constexpr auto cmd_set_bt_pair = iwrap::mux_frame("SET BT PAIR");
+static constexpr auto cmd_set_bt_pagemode_3 = iwrap::mux_frame("SET BT PAGEMODE 3");
+static constexpr auto cmd_set_bt_pagemode_2 = iwrap::mux_frame("SET BT PAGEMODE 2");
+static constexpr auto cmd_set_bt_pagemode_0 = iwrap::mux_frame("SET BT PAGEMODE 0");
 
 #define IWRAP_STATE_IDLE            0
 #define IWRAP_STATE_UNKNOWN         1
@@ -209,7 +221,7 @@ void loop() {
                 
                 // send command to test module connectivity
                 serial_out(F("Testing iWRAP communication...\n"));
-                iwrap_send_command("AT", iwrap_mode);
+                iwrap::send(cmd_at, iwrap_mode);
                 iwrap_state = IWRAP_STATE_PENDING_AT;
 
                 // initialize time reference for connectivity test timeout
@@ -217,12 +229,12 @@ void loop() {
             } else if (iwrap_state == IWRAP_STATE_PENDING_AT) {
                 // send command to dump all module settings and pairings
                 serial_out(F("Getting iWRAP settings...\n"));
-                iwrap_send_command("SET", iwrap_mode);
+                iwrap::send(cmd_set, iwrap_mode);
                 iwrap_state = IWRAP_STATE_PENDING_SET;
             } else if (iwrap_state == IWRAP_STATE_PENDING_SET) {
                 // send command to show all current connections
                 serial_out(F("Getting active connection list...\n"));
-                iwrap_send_command("LIST", iwrap_mode);
+                iwrap::send(cmd_list, iwrap_mode);
                 iwrap_state = IWRAP_STATE_PENDING_LIST;
             } else if (iwrap_state == IWRAP_STATE_PENDING_LIST) {
                 // all done!
@@ -242,26 +254,21 @@ void loop() {
             // idle
             if (iwrap_pairings && iwrap_autocall_target > iwrap_connected_devices && !iwrap_pending_calls
                                && (!iwrap_autocall_last_time || (millis() - iwrap_autocall_last_time) >= iwrap_autocall_delay_ms)) {
-                //char cmd[] = "CALL AA:BB:CC:DD:EE:FF 19 A2DP";      // A2DP
-                //char cmd[] = "CALL AA:BB:CC:DD:EE:FF 17 AVRCP";     // AVRCP
-                //char cmd[] = "CALL AA:BB:CC:DD:EE:FF 111F HFP";     // HFP
-                //char cmd[] = "CALL AA:BB:CC:DD:EE:FF 111E HFP-AG";  // HFP-AG
-                //char cmd[] = "CALL AA:BB:CC:DD:EE:FF 11 HID";       // HID
-                //char cmd[] = "CALL AA:BB:CC:DD:EE:FF 1112 HSP";     // HSP
-                //char cmd[] = "CALL AA:BB:CC:DD:EE:FF 1108 HSP-AG";  // HSP-AG
-                //char cmd[] = "CALL AA:BB:CC:DD:EE:FF * IAP";        // IAP
-                char cmd[] = "CALL AA:BB:CC:DD:EE:FF 1101 RFCOMM";  // SPP
-                char *cptr = cmd + 5;
-                
                 // find first unconnected device
                 for (; iwrap_connection_map[iwrap_autocall_index] -> active_links; iwrap_autocall_index++);
-                
-                // write MAC string into call command buffer and send it
-                iwrap_bintohexstr((uint8_t *)(iwrap_connection_map[iwrap_autocall_index] -> mac.address), 6, &cptr, ':', 0);
+
                 char s[21];
                 sprintf(s, "Calling device #%d\r\n", iwrap_autocall_index);
                 serial_out(s);
-                iwrap_send_command(cmd, iwrap_mode);
+                //iwrap_cmd_call(&iwrap_connection_map[iwrap_autocall_index] -> mac, 0x19, "A2DP", iwrap_mode);                   // A2DP
+                //iwrap_cmd_call(&iwrap_connection_map[iwrap_autocall_index] -> mac, 0x17, "AVRCP", iwrap_mode);                  // AVRCP
+                //iwrap_cmd_call(&iwrap_connection_map[iwrap_autocall_index] -> mac, 0x111F, "HFP", iwrap_mode);                  // HFP
+                //iwrap_cmd_call(&iwrap_connection_map[iwrap_autocall_index] -> mac, 0x111E, "HFP-AG", iwrap_mode);               // HFP-AG
+                //iwrap_cmd_call(&iwrap_connection_map[iwrap_autocall_index] -> mac, 0x11, "HID", iwrap_mode);                    // HID
+                //iwrap_cmd_call(&iwrap_connection_map[iwrap_autocall_index] -> mac, 0x1112, "HSP", iwrap_mode);                  // HSP
+                //iwrap_cmd_call(&iwrap_connection_map[iwrap_autocall_index] -> mac, 0x1108, "HSP-AG", iwrap_mode);               // HSP-AG
+                //iwrap_cmd_call(&iwrap_connection_map[iwrap_autocall_index] -> mac, IWRAP_CALL_TARGET_ANY, "IAP", iwrap_mode);   // IAP
+                iwrap_cmd_call(&iwrap_connection_map[iwrap_autocall_index] -> mac, 0x1101, "RFCOMM", iwrap_mode);                 // SPP
                 iwrap_autocall_last_time = millis();
             }
         }
@@ -384,7 +391,7 @@ void my_iwrap_evt_no_carrier(uint8_t link_id, uint16_t error_code, const char *m
 
 void my_iwrap_evt_pair(const iwrap_address_t *address, uint8_t key_type, const uint8_t *link_key) {
     // request pair list again (could be a new pair, or updated pair, or new + overwritten pair)
-    iwrap_send_command("SET BT PAIR", iwrap_mode);
+    iwrap::send(cmd_set_bt_pair, iwrap_mode);
     iwrap_state = IWRAP_STATE_PENDING_SET;
 }
 
@@ -588,12 +595,12 @@ void process_demo_choice(char b) {
         }
     } else if (b == '2') {
         serial_out("=> (2) Setting page mode to 3 (discoverable and connectable)\n\n");
-        iwrap_send_command("SET BT PAGEMODE 3", iwrap_mode);
+        iwrap::send(cmd_set_bt_pagemode_3, iwrap_mode);
     } else if (b == '3') {
         serial_out("=> (3) Setting page mode to 2 (undiscoverable, but connectable)\n\n");
-        iwrap_send_command("SET BT PAGEMODE 2", iwrap_mode);
+        iwrap::send(cmd_set_bt_pagemode_2, iwrap_mode);
     } else if (b == '4') {
         serial_out("=> (4) Setting page mode to 0 (undiscoverable and unconnectable)\n\n");
-        iwrap_send_command("SET BT PAGEMODE 0", iwrap_mode);
+        iwrap::send(cmd_set_bt_pagemode_0, iwrap_mode);
     }
 }
\ No newline at end of file
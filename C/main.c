@@ -2,6 +2,8 @@
 // 2014-05-25 by Jeff Rowberg <jeff@rowberg.net>
 //
 // Changelog:
+//  2026-10-19 - Serve library statistics over a Unix socket when IWRAP_METRICS_PATH is defined
+//  2026-10-19 - Use iwrap_cmd_* builders instead of formatting command strings
 //  2014-05-25 - Initial release
 
 /* ============================================
@@ -53,6 +55,7 @@ THE SOFTWARE.
 #include <string.h>     // strlen()
 #include <sys\timeb.h>  // ftime()
 #include "uart.h"
+#include "metrics.h"
 
 // -------- iWRAP configuration definitions --------
 // COPY TO TOP OF "iWRAP.h" TO APPLY TO THIS PROGRAM
@@ -177,6 +180,11 @@ int main(int argc, char **argv) {
     // boot message to host
     console_out("iWRAP host library generic demo started\n");
     
+    #ifdef IWRAP_METRICS_PATH
+        // serve statistics, e.g. IWRAP_METRICS_PATH="/tmp/iwrap.metrics"
+        if (metrics_open(IWRAP_METRICS_PATH)) console_out("WARNING: Unable to open metrics socket\n");
+    #endif
+    
     // watch for incoming data from module and process main state machine changes
     while (1) {
         // manage iWRAP state machine
@@ -203,7 +211,7 @@ int main(int argc, char **argv) {
                 } else if (iwrap_state == IWRAP_STATE_PENDING_AT) {
                     // send command to dump all module settings and pairings
                     console_out("Getting iWRAP settings...\n");
-                    iwrap_send_command("SET", iwrap_mode);
+                    iwrap_cmd_set(0, 0, 0, iwrap_mode);
                     iwrap_state = IWRAP_STATE_PENDING_SET;
                 } else if (iwrap_state == IWRAP_STATE_PENDING_SET) {
                     // send command to show all current connections
@@ -227,26 +235,21 @@ int main(int argc, char **argv) {
                 // idle
                 if (iwrap_pairings && iwrap_autocall_target > iwrap_connected_devices && !iwrap_pending_calls) {
                     // TODO: add some sort of delay for your platform, e.g. 10 second intervals between calls
-                    //char cmd[] = "CALL AA:BB:CC:DD:EE:FF 19 A2DP";      // A2DP
-                    //char cmd[] = "CALL AA:BB:CC:DD:EE:FF 17 AVRCP";     // AVRCP
-                    //char cmd[] = "CALL AA:BB:CC:DD:EE:FF 111F HFP";     // HFP
-                    //char cmd[] = "CALL AA:BB:CC:DD:EE:FF 111E HFP-AG";  // HFP-AG
-                    //char cmd[] = "CALL AA:BB:CC:DD:EE:FF 11 HID";       // HID
-                    //char cmd[] = "CALL AA:BB:CC:DD:EE:FF 1112 HSP";     // HSP
-                    //char cmd[] = "CALL AA:BB:CC:DD:EE:FF 1108 HSP-AG";  // HSP-AG
-                    //char cmd[] = "CALL AA:BB:CC:DD:EE:FF * IAP";        // IAP
-                    char cmd[] = "CALL AA:BB:CC:DD:EE:FF 1101 RFCOMM";  // SPP
-                    char *cptr = cmd + 5;
-                    
                     // find first unconnected device
                     for (; iwrap_connection_map[iwrap_autocall_index] -> active_links; iwrap_autocall_index++);
-                    
-                    // write MAC string into call command buffer and send it
-                    iwrap_bintohexstr((uint8_t *)(iwrap_connection_map[iwrap_autocall_index] -> mac.address), 6, &cptr, ':', 0);
+
                     char s[21];
                     sprintf(s, "Calling device #%d\r\n", iwrap_autocall_index);
                     console_out(s);
-                    iwrap_send_command(cmd, iwrap_mode);
+                    //iwrap_cmd_call(&iwrap_connection_map[iwrap_autocall_index] -> mac, 0x19, "A2DP", iwrap_mode);                   // A2DP
+                    //iwrap_cmd_call(&iwrap_connection_map[iwrap_autocall_index] -> mac, 0x17, "AVRCP", iwrap_mode);                  // AVRCP
+                    //iwrap_cmd_call(&iwrap_connection_map[iwrap_autocall_index] -> mac, 0x111F, "HFP", iwrap_mode);                  // HFP
+                    //iwrap_cmd_call(&iwrap_connection_map[iwrap_autocall_index] -> mac, 0x111E, "HFP-AG", iwrap_mode);               // HFP-AG
+                    //iwrap_cmd_call(&iwrap_connection_map[iwrap_autocall_index] -> mac, 0x11, "HID", iwrap_mode);                    // HID
+                    //iwrap_cmd_call(&iwrap_connection_map[iwrap_autocall_index] -> mac, 0x1112, "HSP", iwrap_mode);                  // HSP
+                    //iwrap_cmd_call(&iwrap_connection_map[iwrap_autocall_index] -> mac, 0x1108, "HSP-AG", iwrap_mode);               // HSP-AG
+                    //iwrap_cmd_call(&iwrap_connection_map[iwrap_autocall_index] -> mac, IWRAP_CALL_TARGET_ANY, "IAP", iwrap_mode);   // IAP
+                    iwrap_cmd_call(&iwrap_connection_map[iwrap_autocall_index] -> mac, 0x1101, "RFCOMM", iwrap_mode);                 // SPP
                 }
             }
         }
@@ -254,6 +257,11 @@ int main(int argc, char **argv) {
         // check for incoming iWRAP data
         if ((result = uart_rx(1, (unsigned char *)&b, 1000))) { iwrap_parse(b, iwrap_mode); }
         
+        #ifdef IWRAP_METRICS_PATH
+            // answer pending metrics request without blocking
+            metrics_poll();
+        #endif
+        
         // check for timeout if still testing communication
         if (!iwrap_initialized && iwrap_state == IWRAP_STATE_PENDING_AT) {
             ftime(&iwrap_time_ref_end);
@@ -362,7 +370,7 @@ void my_iwrap_evt_no_carrier(uint8_t link_id, uint16_t error_code, const char *m
 
 void my_iwrap_evt_pair(const iwrap_address_t *address, uint8_t key_type, const uint8_t *link_key) {
     // request pair list again (could be a new pair, or updated pair, or new + overwritten pair)
-    iwrap_send_command("SET BT PAIR", iwrap_mode);
+    iwrap_cmd_set(IWRAP_SET_CATEGORY_BT, "PAIR", 0, iwrap_mode);
     iwrap_state = IWRAP_STATE_PENDING_SET;
 }
 
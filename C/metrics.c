@@ -0,0 +1,310 @@
+// iWRAP host library metrics exporter
+// 2026-10-19
+//
+// Serves parser, command latency and per-link statistics in Prometheus text
+// exposition format over a Unix domain socket, e.g.:
+//
+//      socat - UNIX-CONNECT:/tmp/iwrap.metrics
+//
+// Call metrics_poll() from the same loop that calls iwrap_parse(). Each
+// request takes a snapshot of the counters into a buffer right away (no
+// parser state is held while the client reads), and the buffer is written
+// out with non-blocking writes across later metrics_poll() calls, so a
+// slow or stuck client never stalls the parser.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "iWRAP.h"
+#include "metrics.h"
+
+#ifdef PLATFORM_WIN
+
+// Unix domain sockets are not available everywhere on Windows, so the
+// exporter is disabled there
+
+int metrics_open(const char *path) { return -1; }
+void metrics_close() {}
+int metrics_poll() { return 0; }
+
+#else // POSIX or Mac OS X
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+int metrics_listen_handle = -1;
+int metrics_client_handle = -1;
+char metrics_path[108];
+char *metrics_buffer = 0;
+size_t metrics_size = 0;
+size_t metrics_length = 0;
+size_t metrics_sent = 0;
+
+/**
+ * @brief Append formatted text to the response buffer, growing it as needed
+ * @return 0 on success, -1 if out of memory
+ */
+int metrics_printf(const char *format, ...) {
+    va_list args;
+    int n;
+    char *grown;
+
+    while (1) {
+        va_start(args, format);
+        n = vsnprintf(metrics_buffer + metrics_length, metrics_size - metrics_length, format, args);
+        va_end(args);
+        if (n < 0) return -1;
+        if ((size_t)n < metrics_size - metrics_length) break;
+        grown = (char *)realloc(metrics_buffer, metrics_size + (n < 4096 ? 4096 : n + 1));
+        if (!grown) return -1;
+        metrics_buffer = grown;
+        metrics_size += n < 4096 ? 4096 : n + 1;
+    }
+    metrics_length += n;
+    return 0;
+}
+
+/**
+ * @brief Append one histogram in Prometheus format (values converted to seconds)
+ * @param name Metric name
+ * @param labels Label set without braces, or empty string
+ * @param histogram Histogram to export
+ *
+ * Bucket edges are the same on every scrape: one per power of two (every
+ * fourth internal bucket), with cumulative counts, so the series never change.
+ */
+void metrics_histogram(const char *name, const char *labels, const iwrap_histogram_t *histogram) {
+    uint32_t cumulative = 0;
+    uint8_t i;
+    for (i = 0; i < IWRAP_HISTOGRAM_BUCKETS - 1; i++) {
+        cumulative += histogram -> buckets[i];
+        if ((i & 3) != 3) continue;
+        metrics_printf("%s_bucket{%s%sle=\"%g\"} %lu\n", name, labels, labels[0] ? "," : "",
+            (double)iwrap_histogram_bucket_floor(i + 1) / IWRAP_TIME_RATE, (unsigned long)cumulative);
+    }
+    metrics_printf("%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, labels[0] ? "," : "", (unsigned long)histogram -> count);
+    metrics_printf("%s_sum%s%s%s %g\n", name, labels[0] ? "{" : "", labels, labels[0] ? "}" : "", (double)histogram -> sum / IWRAP_TIME_RATE);
+    metrics_printf("%s_count%s%s%s %lu\n", name, labels[0] ? "{" : "", labels, labels[0] ? "}" : "", (unsigned long)histogram -> count);
+}
+
+/**
+ * @brief Render all available statistics into the response buffer
+ */
+void metrics_render() {
+    #ifdef IWRAP_INCLUDE_STATS
+        iwrap_stats_t stats;
+    #endif
+    #if defined(IWRAP_INCLUDE_LATENCY) || defined(IWRAP_INCLUDE_PROFILE)
+        char labels[40];
+    #endif
+    #if defined(IWRAP_INCLUDE_STATS) || defined(IWRAP_INCLUDE_LATENCY) || defined(IWRAP_INCLUDE_PROFILE) || defined(IWRAP_INCLUDE_LINK_STATS) || defined(IWRAP_INCLUDE_LINK_CREDITS) || defined(IWRAP_INCLUDE_POWER) || defined(IWRAP_INCLUDE_LINK_QUALITY)
+        uint8_t i;
+    #endif
+
+    metrics_length = 0;
+    metrics_sent = 0;
+    metrics_printf("# TYPE iwrap_pending_commands gauge\niwrap_pending_commands %u\n", iwrap_pending_commands);
+
+    #ifdef IWRAP_INCLUDE_STATS
+        iwrap_get_stats(&stats);
+        metrics_printf("# TYPE iwrap_rx_bytes_total counter\niwrap_rx_bytes_total %lu\n", (unsigned long)stats.bytes);
+        metrics_printf("# TYPE iwrap_rx_frames_total counter\niwrap_rx_frames_total %lu\n", (unsigned long)stats.frames);
+        metrics_printf("# TYPE iwrap_rx_lines_total counter\niwrap_rx_lines_total %lu\n", (unsigned long)stats.lines);
+        metrics_printf("# TYPE iwrap_rx_events_total counter\n");
+        for (i = 0; i < IWRAP_EVENT_COUNT; i++) {
+            if (stats.events[i]) metrics_printf("iwrap_rx_events_total{event=\"%s\"} %lu\n", iwrap_event_names[i], (unsigned long)stats.events[i]);
+        }
+        metrics_printf("# TYPE iwrap_mux_errors_total counter\n");
+        metrics_printf("iwrap_mux_errors_total{kind=\"format\"} %lu\n", (unsigned long)stats.mux_format_errors);
+        metrics_printf("iwrap_mux_errors_total{kind=\"checksum\"} %lu\n", (unsigned long)stats.mux_checksum_errors);
+        metrics_printf("# TYPE iwrap_rx_reallocs_total counter\niwrap_rx_reallocs_total %lu\n", (unsigned long)stats.reallocs);
+        metrics_printf("# TYPE iwrap_rx_max_line_length gauge\niwrap_rx_max_line_length %u\n", stats.max_line_length);
+        metrics_printf("# TYPE iwrap_parse_seconds_total counter\niwrap_parse_seconds_total %g\n", (double)stats.parse_time / IWRAP_TIME_RATE);
+        metrics_printf("# TYPE iwrap_dispatch_seconds_total counter\niwrap_dispatch_seconds_total %g\n", (double)stats.dispatch_time / IWRAP_TIME_RATE);
+    #endif
+
+    #ifdef IWRAP_INCLUDE_LATENCY
+        metrics_printf("# TYPE iwrap_command_latency_seconds histogram\n");
+        for (i = 0; i < IWRAP_COMMAND_COUNT; i++) {
+            if (!iwrap_latency.commands[i].count) continue;
+            snprintf(labels, sizeof(labels), "command=\"%s\"", i ? iwrap_command_names[i] : "OTHER");
+            metrics_histogram("iwrap_command_latency_seconds", labels, &iwrap_latency.commands[i]);
+        }
+        metrics_printf("# TYPE iwrap_command_syntax_errors_total counter\n");
+        for (i = 0; i < IWRAP_COMMAND_COUNT; i++) {
+            if (iwrap_latency.syntax_errors[i]) metrics_printf("iwrap_command_syntax_errors_total{command=\"%s\"} %lu\n", i ? iwrap_command_names[i] : "OTHER", (unsigned long)iwrap_latency.syntax_errors[i]);
+        }
+        metrics_printf("# TYPE iwrap_call_seconds histogram\n");
+        metrics_histogram("iwrap_call_seconds", "result=\"connect\"", &iwrap_latency.call_connect);
+        metrics_histogram("iwrap_call_seconds", "result=\"no_carrier\"", &iwrap_latency.call_failed);
+    #endif
+
+    #ifdef IWRAP_INCLUDE_PROFILE
+        metrics_printf("# TYPE iwrap_callback_seconds histogram\n");
+        for (i = 0; i < IWRAP_EVENT_COUNT; i++) {
+            if (!iwrap_profile.events[i].count) continue;
+            snprintf(labels, sizeof(labels), "event=\"%s\"", iwrap_event_names[i]);
+            metrics_histogram("iwrap_callback_seconds", labels, &iwrap_profile.events[i]);
+        }
+        if (iwrap_profile.rxdata.count) metrics_histogram("iwrap_callback_seconds", "event=\"RXDATA\"", &iwrap_profile.rxdata);
+        metrics_printf("# TYPE iwrap_callback_slow_total counter\niwrap_callback_slow_total %lu\n", (unsigned long)iwrap_profile.slow);
+    #endif
+
+    #ifdef IWRAP_INCLUDE_LINK_STATS
+        metrics_printf("# TYPE iwrap_link_active gauge\n# TYPE iwrap_link_frames_total counter\n# TYPE iwrap_link_bytes_total counter\n# TYPE iwrap_link_rate_bytes gauge\n");
+        for (i = 0; i < IWRAP_MAX_LINKS; i++) {
+            const iwrap_link_stats_t *link = &iwrap_link_stats[i];
+            if (!link -> active && !link -> rx_frames && !link -> tx_frames) continue;
+            metrics_printf("iwrap_link_active{link=\"%u\"} %u\n", i, link -> active);
+            metrics_printf("iwrap_link_frames_total{link=\"%u\",direction=\"rx\"} %lu\n", i, (unsigned long)link -> rx_frames);
+            metrics_printf("iwrap_link_frames_total{link=\"%u\",direction=\"tx\"} %lu\n", i, (unsigned long)link -> tx_frames);
+            metrics_printf("iwrap_link_bytes_total{link=\"%u\",direction=\"rx\"} %lu\n", i, (unsigned long)link -> rx_bytes);
+            metrics_printf("iwrap_link_bytes_total{link=\"%u\",direction=\"tx\"} %lu\n", i, (unsigned long)link -> tx_bytes);
+            metrics_printf("iwrap_link_rate_bytes{link=\"%u\",direction=\"rx\"} %lu\n", i, (unsigned long)link -> rx_rate);
+            metrics_printf("iwrap_link_rate_bytes{link=\"%u\",direction=\"tx\"} %lu\n", i, (unsigned long)link -> tx_rate);
+        }
+    #endif
+
+    #ifdef IWRAP_INCLUDE_POWER
+        metrics_printf("# TYPE iwrap_link_power_mode gauge\n# TYPE iwrap_link_power_seconds_total counter\n# TYPE iwrap_link_power_transitions_total counter\n");
+        for (i = 0; i < IWRAP_MAX_LINKS; i++) {
+            static const char *modes[5] = { "unknown", "active", "hold", "sniff", "park" };
+            const iwrap_power_link_t *power = &iwrap_power_links[i];
+            uint8_t m;
+            if (!power -> transitions[IWRAP_CONNECTION_POWERMODE_ACTIVE]) continue;
+            metrics_printf("iwrap_link_power_mode{link=\"%u\"} %u\n", i, power -> mode);
+            for (m = 1; m < 5; m++) {
+                if (!power -> transitions[m]) continue;
+                metrics_printf("iwrap_link_power_seconds_total{link=\"%u\",mode=\"%s\"} %g\n", i, modes[m], (double)power -> time_in[m] / IWRAP_TIME_RATE);
+                metrics_printf("iwrap_link_power_transitions_total{link=\"%u\",mode=\"%s\"} %lu\n", i, modes[m], (unsigned long)power -> transitions[m]);
+            }
+        }
+    #endif
+
+    #ifdef IWRAP_INCLUDE_LINK_QUALITY
+        metrics_printf("# TYPE iwrap_link_quality gauge\n# TYPE iwrap_link_quality_min gauge\n# TYPE iwrap_link_quality_max gauge\n# TYPE iwrap_link_quality_avg gauge\n");
+        for (i = 0; i < IWRAP_MAX_LINKS; i++) {
+            static const char *metrics[IWRAP_QUALITY_METRICS] = { "rssi_dbm", "txpower_dbm", "ber_ppm" };
+            uint8_t m;
+            for (m = 0; m < IWRAP_QUALITY_METRICS; m++) {
+                const iwrap_quality_series_t *series = &iwrap_quality_links[i].series[m];
+                if (!series -> samples) continue;
+                metrics_printf("iwrap_link_quality{link=\"%u\",metric=\"%s\"} %ld\n", i, metrics[m], (long)series -> values[(series -> head - 1) & (IWRAP_QUALITY_SAMPLES - 1)]);
+                metrics_printf("iwrap_link_quality_min{link=\"%u\",metric=\"%s\"} %ld\n", i, metrics[m], (long)series -> min);
+                metrics_printf("iwrap_link_quality_max{link=\"%u\",metric=\"%s\"} %ld\n", i, metrics[m], (long)series -> max);
+                metrics_printf("iwrap_link_quality_avg{link=\"%u\",metric=\"%s\"} %g\n", i, metrics[m], (double)series -> ewma / 256);
+            }
+        }
+    #endif
+
+    #ifdef IWRAP_INCLUDE_DISCOVERY
+        {
+            uint16_t d, named = 0;
+            for (d = 0; d < IWRAP_DISCOVERY_SIZE; d++) {
+                if (iwrap_discovery.devices[d].used && (iwrap_discovery.devices[d].flags & IWRAP_DEVICE_NAMED)) named++;
+            }
+            metrics_printf("# TYPE iwrap_discovery_devices gauge\niwrap_discovery_devices %u\n", iwrap_discovery.count);
+            metrics_printf("# TYPE iwrap_discovery_named_devices gauge\niwrap_discovery_named_devices %u\n", named);
+            metrics_printf("# TYPE iwrap_discovery_evictions_total counter\niwrap_discovery_evictions_total %lu\n", (unsigned long)iwrap_discovery.evictions);
+            metrics_printf("# TYPE iwrap_discovery_lookups_total counter\niwrap_discovery_lookups_total %lu\n", (unsigned long)iwrap_discovery.lookups);
+        }
+    #endif
+
+    #ifdef IWRAP_INCLUDE_EIR
+        metrics_printf("# TYPE iwrap_eir_filtered_total counter\niwrap_eir_filtered_total %lu\n", (unsigned long)iwrap_eir_filtered);
+    #endif
+
+    #ifdef IWRAP_INCLUDE_LINK_CREDITS
+        metrics_printf("# TYPE iwrap_link_credits_bytes gauge\n# TYPE iwrap_link_buffered_bytes gauge\n# TYPE iwrap_link_stalls_total counter\n# TYPE iwrap_link_stall_seconds_total counter\n");
+        for (i = 0; i < IWRAP_MAX_LINKS; i++) {
+            const iwrap_link_credit_t *credit = &iwrap_link_credits[i];
+            if (!credit -> window) continue;
+            metrics_printf("iwrap_link_credits_bytes{link=\"%u\"} %ld\n", i, (long)credit -> credits);
+            metrics_printf("iwrap_link_buffered_bytes{link=\"%u\"} %u\n", i, credit -> buffered);
+            metrics_printf("iwrap_link_stalls_total{link=\"%u\"} %lu\n", i, (unsigned long)credit -> stalls);
+            metrics_printf("iwrap_link_stall_seconds_total{link=\"%u\"} %g\n", i, (double)credit -> stall_time / IWRAP_TIME_RATE);
+        }
+    #endif
+}
+
+/**
+ * @brief Start listening for metrics requests on a Unix domain socket
+ * @param path Socket path (replaced if it already exists)
+ * @return 0 on success, -1 on error
+ */
+int metrics_open(const char *path) {
+    struct sockaddr_un address;
+
+    if (strlen(path) >= sizeof(address.sun_path) || strlen(path) >= sizeof(metrics_path)) return -1;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    strcpy(metrics_path, path);
+    unlink(path);
+
+    metrics_listen_handle = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (metrics_listen_handle < 0) return -1;
+    if (bind(metrics_listen_handle, (struct sockaddr *)&address, sizeof(address))
+            || listen(metrics_listen_handle, 4)
+            || fcntl(metrics_listen_handle, F_SETFL, O_NONBLOCK)) {
+        close(metrics_listen_handle);
+        metrics_listen_handle = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Stop listening, drop any client and remove the socket file
+ */
+void metrics_close() {
+    if (metrics_client_handle >= 0) close(metrics_client_handle);
+    if (metrics_listen_handle >= 0) {
+        close(metrics_listen_handle);
+        unlink(metrics_path);
+    }
+    metrics_client_handle = metrics_listen_handle = -1;
+    free(metrics_buffer);
+    metrics_buffer = 0;
+    metrics_size = metrics_length = metrics_sent = 0;
+}
+
+/**
+ * @brief Accept a pending request and/or continue sending the current response (never blocks)
+ * @return 1 if a response is in progress, 0 if idle, -1 if not open
+ */
+int metrics_poll() {
+    ssize_t written;
+
+    if (metrics_listen_handle < 0) return -1;
+
+    if (metrics_client_handle < 0) {
+        metrics_client_handle = accept(metrics_listen_handle, 0, 0);
+        if (metrics_client_handle < 0) return 0;
+        fcntl(metrics_client_handle, F_SETFL, O_NONBLOCK);
+        metrics_render();
+    }
+
+    while (metrics_sent < metrics_length) {
+        #ifdef MSG_NOSIGNAL
+            written = send(metrics_client_handle, metrics_buffer + metrics_sent, metrics_length - metrics_sent, MSG_NOSIGNAL);
+        #else
+            written = send(metrics_client_handle, metrics_buffer + metrics_sent, metrics_length - metrics_sent, 0);
+        #endif
+        if (written < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 1; // client is slow, continue next time
+            break; // client went away
+        }
+        metrics_sent += written;
+    }
+
+    close(metrics_client_handle);
+    metrics_client_handle = -1;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+int metrics_open(const char *path);
+void metrics_close();
+int metrics_poll();
+
+#endif // _METRICS_H_